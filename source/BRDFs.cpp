@@ -0,0 +1,118 @@
+#include "BRDFs.h"
+
+#include "SIMD.h"
+
+namespace dae {
+
+	namespace
+	{
+		DAE_AVX2_EXACT_FUNCTION inline __m256 Dot(__m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz)
+		{
+			return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, bx), _mm256_mul_ps(ay, by)), _mm256_mul_ps(az, bz));
+		}
+
+		// Fresnel, diffuse & specular of one color channel
+		DAE_AVX2_EXACT_FUNCTION inline __m256 Channel(float f0, float oneMinusF0, float diffuseAlbedo, __m256 fresnelWeight, __m256 specularScale)
+		{
+			const __m256 fresnel{ _mm256_add_ps(_mm256_set1_ps(f0), _mm256_mul_ps(_mm256_set1_ps(oneMinusF0), fresnelWeight)) };
+			const __m256 diffuse{ _mm256_mul_ps(_mm256_set1_ps(diffuseAlbedo), _mm256_sub_ps(_mm256_set1_ps(1.f), fresnel)) };
+			return _mm256_add_ps(diffuse, _mm256_mul_ps(fresnel, specularScale));
+		}
+
+		DAE_AVX2_EXACT_FUNCTION void CookTorrence_AVX2(const BRDF::CookTorrenceConstants& constants, const BRDF::SampleBlock& samples, ColorRGB* pBRDFs)
+		{
+			const __m256 normalX{ _mm256_load_ps(samples.normalX) };
+			const __m256 normalY{ _mm256_load_ps(samples.normalY) };
+			const __m256 normalZ{ _mm256_load_ps(samples.normalZ) };
+			const __m256 viewX{ _mm256_load_ps(samples.viewX) };
+			const __m256 viewY{ _mm256_load_ps(samples.viewY) };
+			const __m256 viewZ{ _mm256_load_ps(samples.viewZ) };
+			const __m256 lightX{ _mm256_load_ps(samples.lightX) };
+			const __m256 lightY{ _mm256_load_ps(samples.lightY) };
+			const __m256 lightZ{ _mm256_load_ps(samples.lightZ) };
+
+			__m256 halfX{ _mm256_add_ps(viewX, lightX) };
+			__m256 halfY{ _mm256_add_ps(viewY, lightY) };
+			__m256 halfZ{ _mm256_add_ps(viewZ, lightZ) };
+			// Divided like Vector3::Normalized, near the GGX peak of smooth materials one more rounding step shows
+			const __m256 length{ _mm256_sqrt_ps(Dot(halfX, halfY, halfZ, halfX, halfY, halfZ)) };
+			halfX = _mm256_div_ps(halfX, length);
+			halfY = _mm256_div_ps(halfY, length);
+			halfZ = _mm256_div_ps(halfZ, length);
+
+			// Schlick: (1 - h.v)^5
+			const __m256 oneMinusHV{ _mm256_sub_ps(_mm256_set1_ps(1.f), Dot(halfX, halfY, halfZ, viewX, viewY, viewZ)) };
+			const __m256 oneMinusHV2{ _mm256_mul_ps(oneMinusHV, oneMinusHV) };
+			const __m256 fresnelWeight{ _mm256_mul_ps(_mm256_mul_ps(oneMinusHV2, oneMinusHV2), oneMinusHV) };
+
+			// GGX: alpha^2 / (PI * ((n.h)^2 * (alpha^2 - 1) + 1)^2)
+			const __m256 nh{ Dot(normalX, normalY, normalZ, halfX, halfY, halfZ) };
+			const __m256 denominator{ _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(nh, nh), _mm256_set1_ps(constants.alpha2MinusOne)), _mm256_set1_ps(1.f)) };
+			const __m256 distribution{ _mm256_div_ps(_mm256_set1_ps(constants.alpha2DivPI), _mm256_mul_ps(denominator, denominator)) };
+
+			// Smith with Schlick GGX for both directions
+			const __m256 k{ _mm256_set1_ps(constants.k) };
+			const __m256 oneMinusK{ _mm256_set1_ps(constants.oneMinusK) };
+			const __m256 nv{ Dot(normalX, normalY, normalZ, viewX, viewY, viewZ) };
+			const __m256 nl{ Dot(normalX, normalY, normalZ, lightX, lightY, lightZ) };
+			const __m256 geometry{ _mm256_mul_ps(
+				_mm256_div_ps(nv, _mm256_add_ps(_mm256_mul_ps(nv, oneMinusK), k)),
+				_mm256_div_ps(nl, _mm256_add_ps(_mm256_mul_ps(nl, oneMinusK), k))) };
+
+			const __m256 specularScale{ _mm256_div_ps(_mm256_mul_ps(distribution, geometry), _mm256_mul_ps(_mm256_set1_ps(4.f), _mm256_mul_ps(nv, nl))) };
+
+			alignas(32) float red[BRDF::SampleBlock::Width];
+			alignas(32) float green[BRDF::SampleBlock::Width];
+			alignas(32) float blue[BRDF::SampleBlock::Width];
+			_mm256_store_ps(red, Channel(constants.f0.r, constants.oneMinusF0.r, constants.diffuseAlbedo.r, fresnelWeight, specularScale));
+			_mm256_store_ps(green, Channel(constants.f0.g, constants.oneMinusF0.g, constants.diffuseAlbedo.g, fresnelWeight, specularScale));
+			_mm256_store_ps(blue, Channel(constants.f0.b, constants.oneMinusF0.b, constants.diffuseAlbedo.b, fresnelWeight, specularScale));
+
+			for (uint32_t i{}; i < BRDF::SampleBlock::Width; ++i)
+			{
+				pBRDFs[i] = { red[i], green[i], blue[i] };
+			}
+		}
+
+		void CookTorrence_Scalar(const BRDF::CookTorrenceConstants& constants, const BRDF::SampleBlock& samples, ColorRGB* pBRDFs)
+		{
+			for (uint32_t i{}; i < BRDF::SampleBlock::Width; ++i)
+			{
+				const Vector3 n{ samples.normalX[i], samples.normalY[i], samples.normalZ[i] };
+				const Vector3 v{ samples.viewX[i], samples.viewY[i], samples.viewZ[i] };
+				const Vector3 l{ samples.lightX[i], samples.lightY[i], samples.lightZ[i] };
+				const Vector3 h{ (v + l).Normalized() };
+
+				const float oneMinusHV{ 1.f - Vector3::Dot(h, v) };
+				const float oneMinusHV2{ oneMinusHV * oneMinusHV };
+				const float fresnelWeight{ oneMinusHV2 * oneMinusHV2 * oneMinusHV };
+
+				const float nh{ Vector3::Dot(n, h) };
+				const float denominator{ nh * nh * constants.alpha2MinusOne + 1.f };
+				const float distribution{ constants.alpha2DivPI / (denominator * denominator) };
+
+				const float nv{ Vector3::Dot(n, v) };
+				const float nl{ Vector3::Dot(n, l) };
+				const float geometry{ nv / (nv * constants.oneMinusK + constants.k) * (nl / (nl * constants.oneMinusK + constants.k)) };
+
+				const float specularScale{ distribution * geometry / (4.f * (nv * nl)) };
+				const ColorRGB fresnel{ constants.f0 + constants.oneMinusF0 * fresnelWeight };
+				pBRDFs[i] = constants.diffuseAlbedo * (ColorRGB{ 1.f, 1.f, 1.f } - fresnel) + fresnel * specularScale;
+			}
+		}
+	}
+
+	namespace BRDF
+	{
+		void CookTorrence_x8(const CookTorrenceConstants& constants, const SampleBlock& samples, ColorRGB* pBRDFs)
+		{
+			if (SIMD::HasAVX2())
+			{
+				CookTorrence_AVX2(constants, samples, pBRDFs);
+				return;
+			}
+
+			CookTorrence_Scalar(constants, samples, pBRDFs);
+		}
+	}
+}
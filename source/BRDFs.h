@@ -1,5 +1,6 @@
 #pragma once
 #include <cassert>
+#include <cstdint>
 #include "Math.h"
 
 namespace dae
@@ -98,5 +99,67 @@ namespace dae
 			return BRDF::GeometryFunction_SchlickGGX(n, v, roughness) * BRDF::GeometryFunction_SchlickGGX(n,l,roughness);
 		}
 
+		//The parts of Cook-Torrance that only depend on the material, worked out once instead of for every sample
+		struct CookTorrenceConstants
+		{
+			ColorRGB f0{};
+			ColorRGB oneMinusF0{};
+			// (1 - F) * diffuseAlbedo is the Lambert part, black for metals
+			ColorRGB diffuseAlbedo{};
+			// roughness^4 / PI & roughness^4 - 1 of the GGX distribution
+			float alpha2DivPI{};
+			float alpha2MinusOne{};
+			// (roughness^2 + 1)^2 / 8 of the Schlick GGX geometry term
+			float k{};
+			float oneMinusK{};
+		};
+
+		/**
+		 * \brief Same material model as Material_CookTorrence::Shade, metalness >= 1 counts as a metal
+		 * \return Constants for CookTorrence_x8
+		 */
+		inline CookTorrenceConstants GetCookTorrenceConstants(const ColorRGB& albedo, float metalness, float roughness)
+		{
+			const bool isMetal{ metalness >= 1.f };
+			const float roughness2{ roughness * roughness };
+			const float alpha2{ roughness2 * roughness2 };
+			const float k{ (roughness2 + 1.f) * (roughness2 + 1.f) / 8.f };
+
+			CookTorrenceConstants constants{};
+			constants.f0 = isMetal ? albedo : ColorRGB{ 0.04f, 0.04f, 0.04f };
+			constants.oneMinusF0 = ColorRGB{ 1.f, 1.f, 1.f } - constants.f0;
+			constants.diffuseAlbedo = isMetal ? ColorRGB{} : albedo * (1.f / PI);
+			constants.alpha2DivPI = alpha2 / PI;
+			constants.alpha2MinusOne = alpha2 - 1.f;
+			constants.k = k;
+			constants.oneMinusK = 1.f - k;
+			return constants;
+		}
+
+		//8 samples of one material stored SoA, all directions normalized
+		struct alignas(32) SampleBlock
+		{
+			static constexpr uint32_t Width{ 8 };
+
+			float normalX[Width]{};
+			float normalY[Width]{};
+			float normalZ[Width]{};
+			// Towards the viewer
+			float viewX[Width]{};
+			float viewY[Width]{};
+			float viewZ[Width]{};
+			// Towards the light
+			float lightX[Width]{};
+			float lightY[Width]{};
+			float lightZ[Width]{};
+		};
+
+		/**
+		 * \brief Cook-Torrance (Schlick Fresnel, GGX, Smith) of all 8 samples at once, falls back to one lane at a time without AVX2
+		 * The powers are plain multiplies, the result matches the scalar BRDFs up to rounding
+		 * \param pBRDFs receives one color per sample
+		 */
+		void CookTorrence_x8(const CookTorrenceConstants& constants, const SampleBlock& samples, ColorRGB* pBRDFs);
+
 	}
 }
\ No newline at end of file
@@ -0,0 +1,1010 @@
+#include "BVH.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <numeric>
+#include <thread>
+
+#include "ppl.h"
+#include "Sorting.h"
+
+namespace dae {
+
+	namespace
+	{
+		AABB GetTriangleBounds(const std::vector<Vector3>& positions, const std::vector<int>& indices, uint32_t triangleIndex)
+		{
+			AABB bounds{};
+			bounds.Grow(positions[indices[triangleIndex * 3]]);
+			bounds.Grow(positions[indices[triangleIndex * 3 + 1]]);
+			bounds.Grow(positions[indices[triangleIndex * 3 + 2]]);
+			return bounds;
+		}
+
+		// Reduces [first, first + count) into result, in parallel every chunk gets its own partial result that is merged in afterwards
+		template<typename Result, typename ChunkReduce, typename Merge>
+		void ReduceChunks(uint32_t first, uint32_t count, bool parallel, Result& result, ChunkReduce&& chunkReduce, Merge&& merge)
+		{
+			if (!parallel)
+			{
+				chunkReduce(first, first + count, result);
+				return;
+			}
+
+			// A few chunks per thread, so one slow chunk doesn't keep the others waiting
+			const uint32_t chunkCount{ std::min(count, std::max(1u, std::thread::hardware_concurrency()) * 4) };
+			std::vector<Result> chunkResults(chunkCount);
+			concurrency::parallel_for(0u, chunkCount, [&](uint32_t chunk)
+				{
+					const uint32_t begin{ first + static_cast<uint32_t>(uint64_t{ count } * chunk / chunkCount) };
+					const uint32_t end{ first + static_cast<uint32_t>(uint64_t{ count } * (chunk + 1) / chunkCount) };
+					chunkReduce(begin, end, chunkResults[chunk]);
+				});
+
+			for (const Result& chunkResult : chunkResults)
+			{
+				merge(result, chunkResult);
+			}
+		}
+
+		void MergeBounds(AABB& bounds, const AABB& chunkBounds)
+		{
+			bounds.Grow(chunkBounds);
+		}
+
+		bool IsValid(const AABB& bounds)
+		{
+			return bounds.min.x <= bounds.max.x && bounds.min.y <= bounds.max.y && bounds.min.z <= bounds.max.z;
+		}
+
+		AABB Intersect(const AABB& a, const AABB& b)
+		{
+			return AABB{ Vector3::Max(a.min, b.min), Vector3::Min(a.max, b.max) };
+		}
+
+		// Bounds of the part of the triangle between two planes along the axis: its vertices in between & its edges crossing a plane
+		AABB ClipTriangleBounds(const std::vector<Vector3>& positions, const std::vector<int>& indices, uint32_t triangleIndex, int axis, float planeMin, float planeMax)
+		{
+			const Vector3 vertices[3]{ positions[indices[triangleIndex * 3]], positions[indices[triangleIndex * 3 + 1]], positions[indices[triangleIndex * 3 + 2]] };
+
+			AABB bounds{};
+			for (int i{}; i < 3; ++i)
+			{
+				const Vector3& start{ vertices[i] };
+				const Vector3& end{ vertices[(i + 1) % 3] };
+
+				if (start[axis] >= planeMin && start[axis] <= planeMax)
+					bounds.Grow(start);
+
+				for (const float plane : { planeMin, planeMax })
+				{
+					if ((start[axis] < plane && end[axis] > plane) || (start[axis] > plane && end[axis] < plane))
+					{
+						const float t{ (plane - start[axis]) / (end[axis] - start[axis]) };
+						Vector3 intersection{ start + (end - start) * t };
+						intersection[axis] = plane;
+						bounds.Grow(intersection);
+					}
+				}
+			}
+			return bounds;
+		}
+	}
+
+	void BVH::Build(const std::vector<Vector3>& positions, const std::vector<int>& indices)
+	{
+		const uint32_t triangleCount{ static_cast<uint32_t>(indices.size() / 3) };
+
+		// Precompute the bounds & centroid of every triangle, the build only looks at these
+		m_PrimitiveBounds.resize(triangleCount);
+		m_Centroids.resize(triangleCount);
+		const auto precomputeTriangle{ [&](uint32_t i)
+			{
+				m_PrimitiveBounds[i] = GetTriangleBounds(positions, indices, i);
+				m_Centroids[i] = (positions[indices[i * 3]] + positions[indices[i * 3 + 1]] + positions[indices[i * 3 + 2]]) / 3.f;
+			} };
+
+		if (IsParallel(triangleCount))
+		{
+			concurrency::parallel_for(0u, triangleCount, precomputeTriangle);
+		}
+		else
+		{
+			for (uint32_t i{}; i < triangleCount; ++i)
+			{
+				precomputeTriangle(i);
+			}
+		}
+
+		if (m_BuildMode == BVHBuildMode::SpatialSplits)
+			BuildSpatialHierarchy(positions, indices);
+		else if (m_BuildMode == BVHBuildMode::Linear)
+			BuildLinearHierarchy();
+		else
+			BuildHierarchy();
+
+		m_PrimitiveCount = triangleCount;
+		ReorderNodes();
+		AlignLeaves();
+	}
+
+	void BVH::Build(const std::vector<AABB>& primitiveBounds)
+	{
+		m_PrimitiveBounds = primitiveBounds;
+		m_Centroids.resize(primitiveBounds.size());
+		for (size_t i{}; i < primitiveBounds.size(); ++i)
+		{
+			m_Centroids[i] = (primitiveBounds[i].min + primitiveBounds[i].max) * 0.5f;
+		}
+
+		// Object bounds can't be clipped, so spatial splits fall back to the regular SAH build
+		if (m_BuildMode == BVHBuildMode::Linear)
+			BuildLinearHierarchy();
+		else
+			BuildHierarchy();
+
+		m_PrimitiveCount = primitiveBounds.size();
+		ReorderNodes();
+		AlignLeaves();
+	}
+
+	void BVH::BuildHierarchy()
+	{
+		const uint32_t primitiveCount{ static_cast<uint32_t>(m_PrimitiveBounds.size()) };
+
+		Clear();
+		if (primitiveCount == 0)
+			return;
+
+		m_PrimitiveIndices.resize(primitiveCount);
+		std::iota(m_PrimitiveIndices.begin(), m_PrimitiveIndices.end(), 0);
+
+		// A binary tree with N leaves never has more than 2N - 1 nodes
+		// Allocating them all up front keeps node references valid while subtrees are built in parallel
+		m_Nodes.resize(primitiveCount * 2 - 1);
+		m_Nodes[0].leftFirst = 0;
+		m_Nodes[0].primitiveCount = primitiveCount;
+
+		std::atomic<uint32_t> nodeCount{ 1 };
+		UpdateNodeBounds(0);
+		Subdivide(0, 1, nodeCount);
+		m_Nodes.resize(nodeCount);
+
+		m_BuildSAHCost = ComputeSAHCost();
+	}
+
+	void BVH::Clear()
+	{
+		m_Nodes.clear();
+		m_PrimitiveIndices.clear();
+		m_PrimitiveCount = 0;
+	}
+
+	void BVH::ReleaseNodes()
+	{
+		// Swapped with empty vectors, clear() would keep the capacity allocated
+		BVHNodeList{}.swap(m_Nodes);
+		ReleaseBuildData();
+	}
+
+	void BVH::ReleaseBuildData()
+	{
+		// Update compares the primitive count against the bounds, so it rebuilds from scratch once they are gone
+		std::vector<AABB>{}.swap(m_PrimitiveBounds);
+		std::vector<Vector3>{}.swap(m_Centroids);
+	}
+
+	void BVH::Refit(const std::vector<Vector3>& positions, const std::vector<int>& indices)
+	{
+		assert(indices.size() / 3 == m_PrimitiveBounds.size() && "Refit needs the same triangles the BVH was built with");
+
+		for (uint32_t i{}; i < m_PrimitiveBounds.size(); ++i)
+		{
+			m_PrimitiveBounds[i] = GetTriangleBounds(positions, indices, i);
+		}
+
+		RefitHierarchy();
+	}
+
+	void BVH::Refit(const std::vector<AABB>& primitiveBounds)
+	{
+		assert(primitiveBounds.size() == m_PrimitiveBounds.size() && "Refit needs the same primitives the BVH was built with");
+
+		m_PrimitiveBounds = primitiveBounds;
+		RefitHierarchy();
+	}
+
+	bool BVH::Update(const std::vector<Vector3>& positions, const std::vector<int>& indices)
+	{
+		if (!HasNodes() || indices.size() / 3 != m_PrimitiveBounds.size())
+		{
+			Build(positions, indices);
+			return true;
+		}
+
+		Refit(positions, indices);
+		if (!NeedsRebuild())
+			return false;
+
+		Build(positions, indices);
+		return true;
+	}
+
+	bool BVH::Update(const std::vector<AABB>& primitiveBounds)
+	{
+		if (!HasNodes() || primitiveBounds.size() != m_PrimitiveBounds.size())
+		{
+			Build(primitiveBounds);
+			return true;
+		}
+
+		Refit(primitiveBounds);
+		if (!NeedsRebuild())
+			return false;
+
+		Build(primitiveBounds);
+		return true;
+	}
+
+	float BVH::ComputeSAHCost() const
+	{
+		if (m_Nodes.empty())
+			return 0.f;
+
+		float cost{};
+		for (const BVHNode& node : m_Nodes)
+		{
+			const float area{ AABB{ node.minAABB, node.maxAABB }.SurfaceArea() };
+			cost += node.IsLeaf() ? area * node.primitiveCount : area;
+		}
+
+		const float rootArea{ GetBounds().SurfaceArea() };
+		return rootArea > 0.f ? cost / rootArea : 0.f;
+	}
+
+	void BVH::RefitHierarchy()
+	{
+		// Children are always allocated after their parent, so walking the nodes backwards is a bottom-up pass
+		for (size_t i{ m_Nodes.size() }; i-- > 0;)
+		{
+			BVHNode& node{ m_Nodes[i] };
+			if (node.IsLeaf())
+			{
+				UpdateNodeBounds(static_cast<uint32_t>(i));
+				continue;
+			}
+
+			const BVHNode& left{ m_Nodes[node.leftFirst] };
+			const BVHNode& right{ m_Nodes[node.leftFirst + 1] };
+			node.minAABB = Vector3::Min(left.minAABB, right.minAABB);
+			node.maxAABB = Vector3::Max(left.maxAABB, right.maxAABB);
+		}
+	}
+
+	bool BVH::NeedsRebuild() const
+	{
+		// A refit keeps the old split planes, so the tree gets worse the further the primitives move away from them
+		return ComputeSAHCost() > m_BuildSAHCost * RebuildThreshold;
+	}
+
+	void BVH::UpdateNodeBounds(uint32_t nodeIndex)
+	{
+		BVHNode& node{ m_Nodes[nodeIndex] };
+
+		AABB bounds{};
+		ReduceChunks(node.leftFirst, node.primitiveCount, IsParallel(node.primitiveCount), bounds,
+			[this](uint32_t begin, uint32_t end, AABB& chunkBounds)
+			{
+				for (uint32_t i{ begin }; i < end; ++i)
+				{
+					chunkBounds.Grow(m_PrimitiveBounds[m_PrimitiveIndices[i]]);
+				}
+			}, MergeBounds);
+
+		node.minAABB = bounds.min;
+		node.maxAABB = bounds.max;
+	}
+
+	void BVH::Subdivide(uint32_t nodeIndex, uint32_t depth, std::atomic<uint32_t>& nodeCount)
+	{
+		if (m_Nodes[nodeIndex].primitiveCount <= m_LeafSize || depth >= MaxDepth)
+			return;
+
+		// Only split when the SAH says two children are cheaper than intersecting every primitive in this node
+		int axis{};
+		float splitPosition{};
+		const float splitCost{ FindBestSplit(m_Nodes[nodeIndex], axis, splitPosition) };
+
+		const BVHNode& node{ m_Nodes[nodeIndex] };
+		const AABB nodeBounds{ node.minAABB, node.maxAABB };
+		const float leafCost{ node.primitiveCount * nodeBounds.SurfaceArea() };
+		if (splitCost >= leafCost)
+			return;
+
+		// Partition the primitive indices in place around the split plane
+		uint32_t i{ node.leftFirst };
+		uint32_t j{ node.leftFirst + node.primitiveCount };
+		while (i < j)
+		{
+			if (m_Centroids[m_PrimitiveIndices[i]][axis] < splitPosition)
+				++i;
+			else
+				std::swap(m_PrimitiveIndices[i], m_PrimitiveIndices[--j]);
+		}
+
+		const uint32_t leftCount{ i - node.leftFirst };
+		if (leftCount == 0 || leftCount == node.primitiveCount)
+			return;
+
+		// Children are allocated as a pair, so the right child is always left + 1
+		const uint32_t leftChildIndex{ nodeCount.fetch_add(2) };
+
+		BVHNode& parent{ m_Nodes[nodeIndex] };
+		m_Nodes[leftChildIndex].leftFirst = parent.leftFirst;
+		m_Nodes[leftChildIndex].primitiveCount = leftCount;
+		m_Nodes[leftChildIndex + 1].leftFirst = i;
+		m_Nodes[leftChildIndex + 1].primitiveCount = parent.primitiveCount - leftCount;
+
+		parent.leftFirst = leftChildIndex;
+		parent.primitiveCount = 0;
+
+		UpdateNodeBounds(leftChildIndex);
+		UpdateNodeBounds(leftChildIndex + 1);
+
+		// Both subtrees only touch their own range of primitive indices, so they can be built at the same time
+		if (IsParallel(std::min(m_Nodes[leftChildIndex].primitiveCount, m_Nodes[leftChildIndex + 1].primitiveCount)))
+		{
+			concurrency::parallel_invoke(
+				[&] { Subdivide(leftChildIndex, depth + 1, nodeCount); },
+				[&] { Subdivide(leftChildIndex + 1, depth + 1, nodeCount); });
+		}
+		else
+		{
+			Subdivide(leftChildIndex, depth + 1, nodeCount);
+			Subdivide(leftChildIndex + 1, depth + 1, nodeCount);
+		}
+	}
+
+	float BVH::FindBestSplit(const BVHNode& node, int& axis, float& splitPosition) const
+	{
+		struct BinSet
+		{
+			AABB bounds[3][BinCount]{};
+			uint32_t counts[3][BinCount]{};
+		};
+
+		const bool parallel{ IsParallel(node.primitiveCount) };
+
+		// Bin over the centroid bounds, not the node bounds, so no bin is wasted on empty space
+		AABB centroidBounds{};
+		ReduceChunks(node.leftFirst, node.primitiveCount, parallel, centroidBounds,
+			[this](uint32_t begin, uint32_t end, AABB& chunkBounds)
+			{
+				for (uint32_t i{ begin }; i < end; ++i)
+				{
+					chunkBounds.Grow(m_Centroids[m_PrimitiveIndices[i]]);
+				}
+			}, MergeBounds);
+
+		float scale[3]{};
+		for (int a{}; a < 3; ++a)
+		{
+			const float extent{ centroidBounds.max[a] - centroidBounds.min[a] };
+			scale[a] = extent > 0.f ? BinCount / extent : 0.f;
+		}
+
+		// All 3 axes are binned in the same pass over the primitives
+		BinSet bins{};
+		ReduceChunks(node.leftFirst, node.primitiveCount, parallel, bins,
+			[&](uint32_t begin, uint32_t end, BinSet& chunkBins)
+			{
+				for (uint32_t i{ begin }; i < end; ++i)
+				{
+					const uint32_t primitiveIndex{ m_PrimitiveIndices[i] };
+					for (int a{}; a < 3; ++a)
+					{
+						const uint32_t binIndex{ std::min(BinCount - 1, static_cast<uint32_t>((m_Centroids[primitiveIndex][a] - centroidBounds.min[a]) * scale[a])) };
+
+						++chunkBins.counts[a][binIndex];
+						chunkBins.bounds[a][binIndex].Grow(m_PrimitiveBounds[primitiveIndex]);
+					}
+				}
+			},
+			[](BinSet& bins, const BinSet& chunkBins)
+			{
+				for (int a{}; a < 3; ++a)
+				{
+					for (uint32_t i{}; i < BinCount; ++i)
+					{
+						bins.counts[a][i] += chunkBins.counts[a][i];
+						bins.bounds[a][i].Grow(chunkBins.bounds[a][i]);
+					}
+				}
+			});
+
+		float bestCost{ FLT_MAX };
+
+		for (int a{}; a < 3; ++a)
+		{
+			const float boundsMin{ centroidBounds.min[a] };
+			const float boundsMax{ centroidBounds.max[a] };
+			if (boundsMin == boundsMax)
+				continue;
+
+			const AABB* binBounds{ bins.bounds[a] };
+			const uint32_t* binCount{ bins.counts[a] };
+
+			// Sweep from both sides to get the area & count on each side of the BinCount - 1 candidate planes
+			float leftArea[BinCount - 1]{};
+			float rightArea[BinCount - 1]{};
+			uint32_t leftCount[BinCount - 1]{};
+			uint32_t rightCount[BinCount - 1]{};
+
+			AABB leftBox{};
+			AABB rightBox{};
+			uint32_t leftSum{};
+			uint32_t rightSum{};
+			for (uint32_t i{}; i < BinCount - 1; ++i)
+			{
+				leftSum += binCount[i];
+				leftCount[i] = leftSum;
+				leftBox.Grow(binBounds[i]);
+				leftArea[i] = leftBox.SurfaceArea();
+
+				rightSum += binCount[BinCount - 1 - i];
+				rightCount[BinCount - 2 - i] = rightSum;
+				rightBox.Grow(binBounds[BinCount - 1 - i]);
+				rightArea[BinCount - 2 - i] = rightBox.SurfaceArea();
+			}
+
+			const float binWidth{ (boundsMax - boundsMin) / BinCount };
+			for (uint32_t i{}; i < BinCount - 1; ++i)
+			{
+				if (leftCount[i] == 0 || rightCount[i] == 0)
+					continue;
+
+				const float cost{ leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i] };
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					axis = a;
+					splitPosition = boundsMin + binWidth * (i + 1);
+				}
+			}
+		}
+
+		return bestCost;
+	}
+
+	void BVH::ReorderNodes()
+	{
+		if (m_NodeOrder == BVHNodeOrder::Build || m_Nodes.size() <= 3)
+			return;
+
+		// New index of every node, siblings are always placed together so the right child stays at left + 1
+		std::vector<uint32_t> newIndices(m_Nodes.size());
+		uint32_t nextIndex{ 1 };
+
+		if (m_NodeOrder == BVHNodeOrder::DepthFirst)
+		{
+			LayoutDepthFirst(0, newIndices, nextIndex);
+		}
+		else
+		{
+			// Height of the tree in sibling pairs, children come after their parent so walking backwards is bottom-up
+			std::vector<uint32_t> heights(m_Nodes.size());
+			for (size_t i{ m_Nodes.size() }; i-- > 0;)
+			{
+				const BVHNode& node{ m_Nodes[i] };
+				if (!node.IsLeaf())
+					heights[i] = 1 + std::max(heights[node.leftFirst], heights[node.leftFirst + 1]);
+			}
+
+			LayoutVanEmdeBoas(0, heights[0], newIndices, nextIndex);
+		}
+
+		BVHNodeList reorderedNodes(m_Nodes.size());
+		for (size_t i{}; i < m_Nodes.size(); ++i)
+		{
+			BVHNode node{ m_Nodes[i] };
+			if (!node.IsLeaf())
+				node.leftFirst = newIndices[node.leftFirst];
+
+			reorderedNodes[newIndices[i]] = node;
+		}
+		m_Nodes.swap(reorderedNodes);
+	}
+
+	void BVH::AlignLeaves()
+	{
+		if (m_LeafAlignment <= 1)
+			return;
+
+		// Leaves own disjoint ranges of the primitive order, each one gets copied over and padded to the next multiple
+		std::vector<uint32_t> alignedIndices{};
+		alignedIndices.reserve(m_PrimitiveIndices.size() + m_Nodes.size() / 2 * (m_LeafAlignment - 1));
+
+		for (BVHNode& node : m_Nodes)
+		{
+			if (!node.IsLeaf())
+				continue;
+
+			const auto first{ m_PrimitiveIndices.begin() + node.leftFirst };
+			node.leftFirst = static_cast<uint32_t>(alignedIndices.size());
+			alignedIndices.insert(alignedIndices.end(), first, first + node.primitiveCount);
+
+			const size_t alignedSize{ (alignedIndices.size() + m_LeafAlignment - 1) / m_LeafAlignment * m_LeafAlignment };
+			alignedIndices.resize(alignedSize, alignedIndices.back());
+		}
+		m_PrimitiveIndices.swap(alignedIndices);
+	}
+
+	void BVH::AssignPair(uint32_t parentIndex, std::vector<uint32_t>& newIndices, uint32_t& nextIndex) const
+	{
+		const uint32_t leftChildIndex{ m_Nodes[parentIndex].leftFirst };
+		newIndices[leftChildIndex] = nextIndex++;
+		newIndices[leftChildIndex + 1] = nextIndex++;
+	}
+
+	void BVH::LayoutDepthFirst(uint32_t nodeIndex, std::vector<uint32_t>& newIndices, uint32_t& nextIndex) const
+	{
+		const BVHNode& node{ m_Nodes[nodeIndex] };
+		if (node.IsLeaf())
+			return;
+
+		AssignPair(nodeIndex, newIndices, nextIndex);
+		LayoutDepthFirst(node.leftFirst, newIndices, nextIndex);
+		LayoutDepthFirst(node.leftFirst + 1, newIndices, nextIndex);
+	}
+
+	void BVH::LayoutVanEmdeBoas(uint32_t nodeIndex, uint32_t height, std::vector<uint32_t>& newIndices, uint32_t& nextIndex) const
+	{
+		if (height == 0 || m_Nodes[nodeIndex].IsLeaf())
+			return;
+
+		if (height == 1)
+		{
+			AssignPair(nodeIndex, newIndices, nextIndex);
+			return;
+		}
+
+		// Top half of the pair levels first, then every subtree hanging below it as one contiguous block
+		const uint32_t topHeight{ height / 2 };
+		LayoutVanEmdeBoas(nodeIndex, topHeight, newIndices, nextIndex);
+
+		std::vector<uint32_t> bottomRoots{};
+		CollectAtDepth(nodeIndex, topHeight, bottomRoots);
+		for (const uint32_t bottomRoot : bottomRoots)
+		{
+			LayoutVanEmdeBoas(bottomRoot, height - topHeight, newIndices, nextIndex);
+		}
+	}
+
+	void BVH::CollectAtDepth(uint32_t nodeIndex, uint32_t depth, std::vector<uint32_t>& nodeIndices) const
+	{
+		const BVHNode& node{ m_Nodes[nodeIndex] };
+		if (depth == 0)
+		{
+			nodeIndices.push_back(nodeIndex);
+			return;
+		}
+
+		if (node.IsLeaf())
+			return;
+
+		CollectAtDepth(node.leftFirst, depth - 1, nodeIndices);
+		CollectAtDepth(node.leftFirst + 1, depth - 1, nodeIndices);
+	}
+
+	void BVH::BuildLinearHierarchy()
+	{
+		const uint32_t primitiveCount{ static_cast<uint32_t>(m_PrimitiveBounds.size()) };
+
+		Clear();
+		if (primitiveCount == 0)
+			return;
+
+		const bool parallel{ IsParallel(primitiveCount) };
+
+		AABB centroidBounds{};
+		ReduceChunks(0, primitiveCount, parallel, centroidBounds,
+			[this](uint32_t begin, uint32_t end, AABB& chunkBounds)
+			{
+				for (uint32_t i{ begin }; i < end; ++i)
+				{
+					chunkBounds.Grow(m_Centroids[i]);
+				}
+			}, MergeBounds);
+
+		// Morton codes of the centroids inside a cube around their bounds, stretching flat meshes to a cube would split the thin axis far too early
+		const Vector3 extent{ centroidBounds.max - centroidBounds.min };
+		const float maxExtent{ std::max(extent.x, std::max(extent.y, extent.z)) };
+		const float scale{ maxExtent > 0.f ? 1.f / maxExtent : 0.f };
+
+		std::vector<uint32_t> mortonCodes(primitiveCount);
+		m_PrimitiveIndices.resize(primitiveCount);
+		const auto computeMortonCode{ [&](uint32_t i)
+			{
+				const Vector3 offset{ m_Centroids[i] - centroidBounds.min };
+				mortonCodes[i] = Sorting::GetMortonCode(offset.x * scale, offset.y * scale, offset.z * scale);
+				m_PrimitiveIndices[i] = i;
+			} };
+
+		if (parallel)
+		{
+			concurrency::parallel_for(0u, primitiveCount, computeMortonCode);
+		}
+		else
+		{
+			for (uint32_t i{}; i < primitiveCount; ++i)
+			{
+				computeMortonCode(i);
+			}
+		}
+
+		Sorting::RadixSort(mortonCodes, m_PrimitiveIndices, 30, parallel);
+
+		m_Nodes.resize(primitiveCount * 2 - 1);
+		m_Nodes[0].leftFirst = 0;
+		m_Nodes[0].primitiveCount = primitiveCount;
+
+		std::atomic<uint32_t> nodeCount{ 1 };
+		EmitLinearNode(0, mortonCodes, 1, nodeCount);
+		m_Nodes.resize(nodeCount);
+
+		// Only the topology was emitted, children come after their parent so a refit fills in every box
+		RefitHierarchy();
+		m_BuildSAHCost = ComputeSAHCost();
+	}
+
+	void BVH::EmitLinearNode(uint32_t nodeIndex, const std::vector<uint32_t>& mortonCodes, uint32_t depth, std::atomic<uint32_t>& nodeCount)
+	{
+		const uint32_t first{ m_Nodes[nodeIndex].leftFirst };
+		const uint32_t count{ m_Nodes[nodeIndex].primitiveCount };
+		if (count <= std::max(LinearLeafSize, m_LeafSize) || depth >= MaxDepth)
+			return;
+
+		// Split where the highest bit that differs within the range flips, a range of equal codes is split in the middle
+		uint32_t split{ first + count / 2 };
+		const uint32_t firstCode{ mortonCodes[first] };
+		const uint32_t lastCode{ mortonCodes[first + count - 1] };
+		if (firstCode != lastCode)
+		{
+			const uint32_t splitBit{ 1u << (31 - std::countl_zero(firstCode ^ lastCode)) };
+			const auto rangeBegin{ mortonCodes.begin() + first };
+			split = static_cast<uint32_t>(std::partition_point(rangeBegin, rangeBegin + count, [splitBit](uint32_t code) { return (code & splitBit) == 0; }) - mortonCodes.begin());
+		}
+
+		// Children are allocated as a pair, so the right child is always left + 1
+		const uint32_t leftChildIndex{ nodeCount.fetch_add(2) };
+		m_Nodes[leftChildIndex].leftFirst = first;
+		m_Nodes[leftChildIndex].primitiveCount = split - first;
+		m_Nodes[leftChildIndex + 1].leftFirst = split;
+		m_Nodes[leftChildIndex + 1].primitiveCount = first + count - split;
+
+		m_Nodes[nodeIndex].leftFirst = leftChildIndex;
+		m_Nodes[nodeIndex].primitiveCount = 0;
+
+		if (IsParallel(std::min(split - first, first + count - split)))
+		{
+			concurrency::parallel_invoke(
+				[&] { EmitLinearNode(leftChildIndex, mortonCodes, depth + 1, nodeCount); },
+				[&] { EmitLinearNode(leftChildIndex + 1, mortonCodes, depth + 1, nodeCount); });
+		}
+		else
+		{
+			EmitLinearNode(leftChildIndex, mortonCodes, depth + 1, nodeCount);
+			EmitLinearNode(leftChildIndex + 1, mortonCodes, depth + 1, nodeCount);
+		}
+	}
+
+	struct BVH::SpatialReference
+	{
+		AABB bounds{};
+		uint32_t primitiveIndex{};
+	};
+
+	struct BVH::SpatialSplit
+	{
+		float cost{ FLT_MAX };
+		int axis{};
+		float position{};
+		bool isSpatial{ false };
+		AABB leftBounds{};
+		AABB rightBounds{};
+	};
+
+	struct BVH::SpatialBuildContext
+	{
+		const std::vector<Vector3>& positions;
+		const std::vector<int>& indices;
+		float rootArea{};
+		size_t remainingDuplicates{};
+	};
+
+	void BVH::BuildSpatialHierarchy(const std::vector<Vector3>& positions, const std::vector<int>& indices)
+	{
+		const uint32_t primitiveCount{ static_cast<uint32_t>(m_PrimitiveBounds.size()) };
+
+		Clear();
+		if (primitiveCount == 0)
+			return;
+
+		std::vector<SpatialReference> references(primitiveCount);
+		AABB rootBounds{};
+		for (uint32_t i{}; i < primitiveCount; ++i)
+		{
+			references[i] = { m_PrimitiveBounds[i], i };
+			rootBounds.Grow(m_PrimitiveBounds[i]);
+		}
+
+		SpatialBuildContext context{ positions, indices, rootBounds.SurfaceArea(), static_cast<size_t>(primitiveCount * m_SpatialSplitBudget) };
+
+		m_PrimitiveIndices.reserve(primitiveCount + context.remainingDuplicates);
+		m_Nodes.reserve((primitiveCount + context.remainingDuplicates) * 2 - 1);
+		m_Nodes.emplace_back();
+		SubdivideSpatial(context, 0, references, 1);
+
+		// Refits only know the full triangle bounds, so the rebuild threshold is measured against the tree with those instead of the clipped ones
+		const BVHNodeList clippedNodes{ m_Nodes };
+		RefitHierarchy();
+		m_BuildSAHCost = ComputeSAHCost();
+		m_Nodes = clippedNodes;
+	}
+
+	void BVH::SubdivideSpatial(SpatialBuildContext& context, uint32_t nodeIndex, std::vector<SpatialReference>& references, uint32_t depth)
+	{
+		AABB nodeBounds{};
+		for (const SpatialReference& reference : references)
+		{
+			nodeBounds.Grow(reference.bounds);
+		}
+
+		m_Nodes[nodeIndex].minAABB = nodeBounds.min;
+		m_Nodes[nodeIndex].maxAABB = nodeBounds.max;
+
+		const auto makeLeaf{ [&]
+			{
+				m_Nodes[nodeIndex].leftFirst = static_cast<uint32_t>(m_PrimitiveIndices.size());
+				m_Nodes[nodeIndex].primitiveCount = static_cast<uint32_t>(references.size());
+				for (const SpatialReference& reference : references)
+				{
+					m_PrimitiveIndices.push_back(reference.primitiveIndex);
+				}
+			} };
+
+		if (references.size() <= m_LeafSize || depth >= MaxDepth)
+		{
+			makeLeaf();
+			return;
+		}
+
+		SpatialSplit split{ FindObjectSplit(references) };
+
+		// Only long or diagonal triangles make the object split children overlap, otherwise spatial splits rarely win
+		const AABB overlap{ Intersect(split.leftBounds, split.rightBounds) };
+		if (context.remainingDuplicates > 0 && IsValid(overlap) && overlap.SurfaceArea() > SpatialSplitOverlapThreshold * context.rootArea)
+		{
+			const SpatialSplit spatialSplit{ FindSpatialSplit(context, nodeBounds, references) };
+			if (spatialSplit.cost < split.cost)
+				split = spatialSplit;
+		}
+
+		// The node itself is counted too, spatial splits keep shrinking the pieces of a few references and would otherwise never stop
+		const float nodeArea{ nodeBounds.SurfaceArea() };
+		if (split.cost + nodeArea >= references.size() * nodeArea)
+		{
+			makeLeaf();
+			return;
+		}
+
+		std::vector<SpatialReference> leftReferences{};
+		std::vector<SpatialReference> rightReferences{};
+		leftReferences.reserve(references.size());
+		rightReferences.reserve(references.size());
+
+		const int axis{ split.axis };
+		for (const SpatialReference& reference : references)
+		{
+			const float centroid{ (reference.bounds.min[axis] + reference.bounds.max[axis]) * 0.5f };
+			if (!split.isSpatial)
+			{
+				(centroid < split.position ? leftReferences : rightReferences).push_back(reference);
+				continue;
+			}
+
+			if (reference.bounds.max[axis] <= split.position)
+			{
+				leftReferences.push_back(reference);
+				continue;
+			}
+
+			if (reference.bounds.min[axis] >= split.position)
+			{
+				rightReferences.push_back(reference);
+				continue;
+			}
+
+			// Straddles the plane, reference it from both sides with the bounds of the part on that side
+			SpatialReference leftPart{ Intersect(ClipTriangleBounds(context.positions, context.indices, reference.primitiveIndex, axis, reference.bounds.min[axis], split.position), reference.bounds), reference.primitiveIndex };
+			SpatialReference rightPart{ Intersect(ClipTriangleBounds(context.positions, context.indices, reference.primitiveIndex, axis, split.position, reference.bounds.max[axis]), reference.bounds), reference.primitiveIndex };
+
+			// Out of budget (or float trouble), keep the reference whole on the side of its centroid
+			if (context.remainingDuplicates == 0 || !IsValid(leftPart.bounds) || !IsValid(rightPart.bounds))
+			{
+				(centroid < split.position ? leftReferences : rightReferences).push_back(reference);
+				continue;
+			}
+
+			--context.remainingDuplicates;
+			leftReferences.push_back(leftPart);
+			rightReferences.push_back(rightPart);
+		}
+
+		if (leftReferences.empty() || rightReferences.empty())
+		{
+			makeLeaf();
+			return;
+		}
+
+		// The parent's references are not needed anymore, free them before going deeper
+		std::vector<SpatialReference>{}.swap(references);
+
+		// Children are allocated as a pair, so the right child is always left + 1
+		const uint32_t leftChildIndex{ static_cast<uint32_t>(m_Nodes.size()) };
+		m_Nodes.emplace_back();
+		m_Nodes.emplace_back();
+		m_Nodes[nodeIndex].leftFirst = leftChildIndex;
+		m_Nodes[nodeIndex].primitiveCount = 0;
+
+		SubdivideSpatial(context, leftChildIndex, leftReferences, depth + 1);
+		SubdivideSpatial(context, leftChildIndex + 1, rightReferences, depth + 1);
+	}
+
+	BVH::SpatialSplit BVH::FindObjectSplit(const std::vector<SpatialReference>& references) const
+	{
+		SpatialSplit bestSplit{};
+
+		AABB centroidBounds{};
+		for (const SpatialReference& reference : references)
+		{
+			centroidBounds.Grow((reference.bounds.min + reference.bounds.max) * 0.5f);
+		}
+
+		for (int a{}; a < 3; ++a)
+		{
+			const float boundsMin{ centroidBounds.min[a] };
+			const float boundsMax{ centroidBounds.max[a] };
+			if (boundsMin == boundsMax)
+				continue;
+
+			AABB binBounds[BinCount]{};
+			uint32_t binCount[BinCount]{};
+			const float scale{ BinCount / (boundsMax - boundsMin) };
+			for (const SpatialReference& reference : references)
+			{
+				const float centroid{ (reference.bounds.min[a] + reference.bounds.max[a]) * 0.5f };
+				const uint32_t binIndex{ std::min(BinCount - 1, static_cast<uint32_t>((centroid - boundsMin) * scale)) };
+
+				++binCount[binIndex];
+				binBounds[binIndex].Grow(reference.bounds);
+			}
+
+			// Same sweep as FindBestSplit, but the boxes on both sides are kept to check their overlap
+			AABB leftBoxes[BinCount - 1]{};
+			AABB rightBoxes[BinCount - 1]{};
+			uint32_t leftCount[BinCount - 1]{};
+			uint32_t rightCount[BinCount - 1]{};
+
+			AABB leftBox{};
+			AABB rightBox{};
+			uint32_t leftSum{};
+			uint32_t rightSum{};
+			for (uint32_t i{}; i < BinCount - 1; ++i)
+			{
+				leftSum += binCount[i];
+				leftCount[i] = leftSum;
+				leftBox.Grow(binBounds[i]);
+				leftBoxes[i] = leftBox;
+
+				rightSum += binCount[BinCount - 1 - i];
+				rightCount[BinCount - 2 - i] = rightSum;
+				rightBox.Grow(binBounds[BinCount - 1 - i]);
+				rightBoxes[BinCount - 2 - i] = rightBox;
+			}
+
+			const float binWidth{ (boundsMax - boundsMin) / BinCount };
+			for (uint32_t i{}; i < BinCount - 1; ++i)
+			{
+				if (leftCount[i] == 0 || rightCount[i] == 0)
+					continue;
+
+				const float cost{ leftCount[i] * leftBoxes[i].SurfaceArea() + rightCount[i] * rightBoxes[i].SurfaceArea() };
+				if (cost < bestSplit.cost)
+					bestSplit = { cost, a, boundsMin + binWidth * (i + 1), false, leftBoxes[i], rightBoxes[i] };
+			}
+		}
+
+		return bestSplit;
+	}
+
+	BVH::SpatialSplit BVH::FindSpatialSplit(const SpatialBuildContext& context, const AABB& nodeBounds, const std::vector<SpatialReference>& references) const
+	{
+		SpatialSplit bestSplit{};
+
+		for (int a{}; a < 3; ++a)
+		{
+			// Spatial bins cover the node bounds, a reference is counted where it enters & where it exits
+			const float boundsMin{ nodeBounds.min[a] };
+			const float boundsMax{ nodeBounds.max[a] };
+			if (boundsMin == boundsMax)
+				continue;
+
+			AABB binBounds[BinCount]{};
+			uint32_t entryCount[BinCount]{};
+			uint32_t exitCount[BinCount]{};
+			const float binWidth{ (boundsMax - boundsMin) / BinCount };
+			const float scale{ BinCount / (boundsMax - boundsMin) };
+
+			for (const SpatialReference& reference : references)
+			{
+				const uint32_t firstBin{ std::min(BinCount - 1, static_cast<uint32_t>(std::max(0.f, (reference.bounds.min[a] - boundsMin) * scale))) };
+				const uint32_t lastBin{ std::max(firstBin, std::min(BinCount - 1, static_cast<uint32_t>(std::max(0.f, (reference.bounds.max[a] - boundsMin) * scale)))) };
+
+				++entryCount[firstBin];
+				++exitCount[lastBin];
+
+				if (firstBin == lastBin)
+				{
+					binBounds[firstBin].Grow(reference.bounds);
+					continue;
+				}
+
+				// Every bin the reference passes through only gets the clipped piece inside it
+				for (uint32_t bin{ firstBin }; bin <= lastBin; ++bin)
+				{
+					const float planeMin{ bin == firstBin ? reference.bounds.min[a] : boundsMin + binWidth * bin };
+					const float planeMax{ bin == lastBin ? reference.bounds.max[a] : boundsMin + binWidth * (bin + 1) };
+					const AABB clippedBounds{ Intersect(ClipTriangleBounds(context.positions, context.indices, reference.primitiveIndex, a, planeMin, planeMax), reference.bounds) };
+					if (IsValid(clippedBounds))
+						binBounds[bin].Grow(clippedBounds);
+				}
+			}
+
+			AABB leftBoxes[BinCount - 1]{};
+			AABB rightBoxes[BinCount - 1]{};
+			uint32_t leftCount[BinCount - 1]{};
+			uint32_t rightCount[BinCount - 1]{};
+
+			AABB leftBox{};
+			AABB rightBox{};
+			uint32_t leftSum{};
+			uint32_t rightSum{};
+			for (uint32_t i{}; i < BinCount - 1; ++i)
+			{
+				leftSum += entryCount[i];
+				leftCount[i] = leftSum;
+				leftBox.Grow(binBounds[i]);
+				leftBoxes[i] = leftBox;
+
+				rightSum += exitCount[BinCount - 1 - i];
+				rightCount[BinCount - 2 - i] = rightSum;
+				rightBox.Grow(binBounds[BinCount - 1 - i]);
+				rightBoxes[BinCount - 2 - i] = rightBox;
+			}
+
+			for (uint32_t i{}; i < BinCount - 1; ++i)
+			{
+				if (leftCount[i] == 0 || rightCount[i] == 0)
+					continue;
+
+				const float cost{ leftCount[i] * leftBoxes[i].SurfaceArea() + rightCount[i] * rightBoxes[i].SurfaceArea() };
+				if (cost < bestSplit.cost)
+					bestSplit = { cost, a, boundsMin + binWidth * (i + 1), true, leftBoxes[i], rightBoxes[i] };
+			}
+		}
+
+		return bestSplit;
+	}
+}
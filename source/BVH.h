@@ -0,0 +1,218 @@
+#pragma once
+#include <atomic>
+#include <cfloat>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+#include "Math.h"
+
+namespace dae
+{
+	struct AABB
+	{
+		Vector3 min{ FLT_MAX, FLT_MAX, FLT_MAX };
+		Vector3 max{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+		void Grow(const Vector3& p)
+		{
+			min = Vector3::Min(min, p);
+			max = Vector3::Max(max, p);
+		}
+
+		void Grow(const AABB& aabb)
+		{
+			min = Vector3::Min(min, aabb.min);
+			max = Vector3::Max(max, aabb.max);
+		}
+
+		float SurfaceArea() const
+		{
+			const Vector3 extent{ max - min };
+			return 2.f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+		}
+	};
+
+	//Node format a mesh gets traversed with, every layout is derived from the binary SAH tree
+	enum class BVHLayout
+	{
+		Binary,
+		Wide8,
+		Quantized
+	};
+
+	enum class BVHBuildMode
+	{
+		SAH,
+		// SBVH: a triangle straddling a split plane can be referenced from both children, only used for triangle meshes
+		SpatialSplits,
+		// LBVH: primitives sorted along a Morton curve, builds in a fraction of the time but traces slower
+		Linear
+	};
+
+	// 32 bytes, so two nodes (a sibling pair) share a 64 byte cache line
+	struct BVHNode
+	{
+		Vector3 minAABB{};
+		uint32_t leftFirst{}; // Interior: index of the left child (right child = left + 1), Leaf: first entry in the primitive index list
+		Vector3 maxAABB{};
+		uint32_t primitiveCount{}; // 0 for interior nodes
+
+		bool IsLeaf() const { return primitiveCount > 0; }
+	};
+
+	//Memory order of the nodes after a build, the tree itself is the same
+	enum class BVHNodeOrder
+	{
+		Build, // Whatever order the builder allocated them in
+		DepthFirst, // Sibling pairs in pre-order, the near path of a ray is mostly one forward walk through memory
+		VanEmdeBoas // Recursively the top half of the tree, then each of its bottom subtrees, good for any cache size
+	};
+
+	//Offsets the allocation so element 1 starts a cache line: the root sits alone at the end of the line before it,
+	//and every sibling pair after it (children are allocated as pairs starting at 1) fills exactly one 64 byte line
+	template<typename T>
+	struct NodeAllocator
+	{
+		using value_type = T;
+		static constexpr size_t CacheLineSize{ 64 };
+		static constexpr size_t Offset{ CacheLineSize - sizeof(T) % CacheLineSize };
+
+		NodeAllocator() = default;
+		template<typename U>
+		NodeAllocator(const NodeAllocator<U>&) {}
+
+		T* allocate(size_t count)
+		{
+			char* pMemory{ static_cast<char*>(::operator new(count * sizeof(T) + CacheLineSize, std::align_val_t{ CacheLineSize })) };
+			return reinterpret_cast<T*>(pMemory + Offset);
+		}
+
+		void deallocate(T* pElements, size_t)
+		{
+			::operator delete(reinterpret_cast<char*>(pElements) - Offset, std::align_val_t{ CacheLineSize });
+		}
+
+		template<typename U>
+		bool operator==(const NodeAllocator<U>&) const { return true; }
+	};
+
+	using BVHNodeList = std::vector<BVHNode, NodeAllocator<BVHNode>>;
+
+	//Bounding Volume Hierarchy built with the binned Surface Area Heuristic
+	//Leaves reference primitives by their index in the input: a triangle of the mesh, or an object of the scene
+	class BVH final
+	{
+	public:
+		// Traversal keeps a fixed size stack, so the build never goes deeper than this
+		static constexpr uint32_t MaxDepth{ 64 };
+		// A refitted tree gets rebuilt once its SAH cost grows past this factor of the cost right after the last build
+		static constexpr float RebuildThreshold{ 1.5f };
+
+		void Build(const std::vector<Vector3>& positions, const std::vector<int>& indices);
+		void Build(const std::vector<AABB>& primitiveBounds);
+		void Clear();
+		//Frees the nodes and the build & refit data, only the primitive order stays for the layouts that index it
+		//The next Update does a full build
+		void ReleaseNodes();
+		//Frees only the build & refit data, the tree can still be traversed but the next Update does a full build
+		void ReleaseBuildData();
+
+		//Keeps the topology and only recomputes the node bounds bottom-up, the primitive count has to be unchanged
+		void Refit(const std::vector<Vector3>& positions, const std::vector<int>& indices);
+		void Refit(const std::vector<AABB>& primitiveBounds);
+
+		//Refits when possible, rebuilds when the primitive count changed or the refitted tree degraded past RebuildThreshold
+		//Returns true when the tree was rebuilt
+		bool Update(const std::vector<Vector3>& positions, const std::vector<int>& indices);
+		bool Update(const std::vector<AABB>& primitiveBounds);
+
+		//Expected cost of a ray through the tree (traversal & intersection cost 1), relative to hitting the root
+		float ComputeSAHCost() const;
+
+		//Large nodes are split with parallel reductions and their subtrees get built as separate tasks, on by default
+		//The resulting tree is the same either way, only the order of the nodes can differ
+		void SetParallelBuild(bool enabled) { m_ParallelBuild = enabled; }
+		//Takes effect on the next build
+		void SetBuildMode(BVHBuildMode mode) { m_BuildMode = mode; }
+		BVHBuildMode GetBuildMode() const { return m_BuildMode; }
+		//Extra triangle references spatial splits are allowed to add, as a fraction of the triangle count
+		void SetSpatialSplitBudget(float budget) { m_SpatialSplitBudget = budget; }
+		//Takes effect on the next build, refits keep the order
+		//Build order by default, neither layout was faster on every mesh measured so far and both cost an extra pass per build
+		void SetNodeOrder(BVHNodeOrder order) { m_NodeOrder = order; }
+		//Nodes with at most this many primitives stay leaves, for leaves that test several primitives at once
+		void SetLeafSize(uint32_t leafSize) { m_LeafSize = leafSize; }
+		uint32_t GetLeafSize() const { return m_LeafSize; }
+		//Every leaf starts at a multiple of this in the primitive order, so a leaf stored in fixed size blocks finds its first block without a lookup
+		//The gap after a leaf repeats its last primitive, no leaf references it
+		void SetLeafAlignment(uint32_t alignment) { m_LeafAlignment = alignment; }
+		uint32_t GetLeafAlignment() const { return m_LeafAlignment; }
+
+		//Still true after ReleaseNodes, leaves of a derived layout keep indexing the primitive order
+		bool IsBuilt() const { return !m_PrimitiveIndices.empty(); }
+		bool HasNodes() const { return !m_Nodes.empty(); }
+		size_t GetPrimitiveCount() const { return m_PrimitiveCount; }
+		//Primitive references in the leaves, more than the primitive count when spatial splits duplicated some
+		size_t GetReferenceCount() const { return m_PrimitiveIndices.size(); }
+		AABB GetBounds() const { return m_Nodes.empty() ? AABB{} : AABB{ m_Nodes[0].minAABB, m_Nodes[0].maxAABB }; }
+
+		const BVHNodeList& GetNodes() const { return m_Nodes; }
+		const std::vector<uint32_t>& GetPrimitiveIndices() const { return m_PrimitiveIndices; }
+		//Bytes needed by traversal (nodes & primitive indices), the build & refit data is not counted
+		size_t GetMemoryUsage() const { return m_Nodes.size() * sizeof(BVHNode) + m_PrimitiveIndices.size() * sizeof(uint32_t); }
+		size_t GetBuildDataMemoryUsage() const { return m_PrimitiveBounds.size() * sizeof(AABB) + m_Centroids.size() * sizeof(Vector3); }
+
+	private:
+		static constexpr uint32_t BinCount{ 16 };
+		// Nodes with fewer primitives are built on the calling thread, a task costs more than it saves there
+		static constexpr uint32_t ParallelThreshold{ 4096 };
+		// Spatial splits are only tried when the children of the best object split overlap by more than this fraction of the root area
+		static constexpr float SpatialSplitOverlapThreshold{ 1e-5f };
+
+		// Ranges of at most this many primitives become a leaf in the linear build
+		static constexpr uint32_t LinearLeafSize{ 4 };
+
+		struct SpatialReference;
+		struct SpatialSplit;
+		struct SpatialBuildContext;
+
+		void BuildHierarchy();
+		void RefitHierarchy();
+		bool NeedsRebuild() const;
+		bool IsParallel(uint32_t primitiveCount) const { return m_ParallelBuild && primitiveCount >= ParallelThreshold; }
+		void UpdateNodeBounds(uint32_t nodeIndex);
+		void Subdivide(uint32_t nodeIndex, uint32_t depth, std::atomic<uint32_t>& nodeCount);
+		float FindBestSplit(const BVHNode& node, int& axis, float& splitPosition) const;
+
+		void ReorderNodes();
+		void AlignLeaves();
+		void AssignPair(uint32_t parentIndex, std::vector<uint32_t>& newIndices, uint32_t& nextIndex) const;
+		void LayoutDepthFirst(uint32_t nodeIndex, std::vector<uint32_t>& newIndices, uint32_t& nextIndex) const;
+		void LayoutVanEmdeBoas(uint32_t nodeIndex, uint32_t height, std::vector<uint32_t>& newIndices, uint32_t& nextIndex) const;
+		void CollectAtDepth(uint32_t nodeIndex, uint32_t depth, std::vector<uint32_t>& nodeIndices) const;
+
+		void BuildLinearHierarchy();
+		void EmitLinearNode(uint32_t nodeIndex, const std::vector<uint32_t>& mortonCodes, uint32_t depth, std::atomic<uint32_t>& nodeCount);
+
+		void BuildSpatialHierarchy(const std::vector<Vector3>& positions, const std::vector<int>& indices);
+		void SubdivideSpatial(SpatialBuildContext& context, uint32_t nodeIndex, std::vector<SpatialReference>& references, uint32_t depth);
+		SpatialSplit FindObjectSplit(const std::vector<SpatialReference>& references) const;
+		SpatialSplit FindSpatialSplit(const SpatialBuildContext& context, const AABB& nodeBounds, const std::vector<SpatialReference>& references) const;
+
+		BVHNodeList m_Nodes{};
+		std::vector<uint32_t> m_PrimitiveIndices{};
+		size_t m_PrimitiveCount{};
+		float m_BuildSAHCost{};
+		bool m_ParallelBuild{ true };
+		BVHBuildMode m_BuildMode{ BVHBuildMode::SAH };
+		float m_SpatialSplitBudget{ 0.3f };
+		BVHNodeOrder m_NodeOrder{ BVHNodeOrder::Build };
+		uint32_t m_LeafSize{ 1 };
+		uint32_t m_LeafAlignment{ 1 };
+
+		//Bounds are kept for refits, the centroids are build-only but kept around so rebuilds don't reallocate
+		std::vector<AABB> m_PrimitiveBounds{};
+		std::vector<Vector3> m_Centroids{};
+	};
+}
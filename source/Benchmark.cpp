@@ -0,0 +1,1209 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include "RayStream.h"
+#include "Scene.h"
+#include "Material.h"
+#include "SIMD.h"
+#include "Timer.h"
+#include "Utils.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace dae {
+	namespace Benchmark
+	{
+		namespace
+		{
+			//L1 data & last level cache misses of the calling thread, read from the hardware counters through perf_event_open
+			//Linux only: Windows has no user-mode API for these counters, so the MSVC build (and kernels that don't allow it) reports IsAvailable() == false
+			//and the node order comparison only delivers rays per second there
+			class CacheMissCounters final
+			{
+			public:
+				CacheMissCounters()
+				{
+#ifdef __linux__
+					m_L1File = Open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+					m_LLCFile = Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+#endif
+				}
+
+				~CacheMissCounters()
+				{
+#ifdef __linux__
+					if (m_L1File >= 0)
+						close(m_L1File);
+					if (m_LLCFile >= 0)
+						close(m_LLCFile);
+#endif
+				}
+
+				CacheMissCounters(const CacheMissCounters&) = delete;
+				CacheMissCounters(CacheMissCounters&&) noexcept = delete;
+				CacheMissCounters& operator=(const CacheMissCounters&) = delete;
+				CacheMissCounters& operator=(CacheMissCounters&&) noexcept = delete;
+
+				bool IsAvailable() const { return m_L1File >= 0 && m_LLCFile >= 0; }
+
+				void Start()
+				{
+#ifdef __linux__
+					for (const int file : { m_L1File, m_LLCFile })
+					{
+						ioctl(file, PERF_EVENT_IOC_RESET, 0);
+						ioctl(file, PERF_EVENT_IOC_ENABLE, 0);
+					}
+#endif
+				}
+
+				void Stop()
+				{
+#ifdef __linux__
+					ioctl(m_L1File, PERF_EVENT_IOC_DISABLE, 0);
+					ioctl(m_LLCFile, PERF_EVENT_IOC_DISABLE, 0);
+					if (read(m_L1File, &m_L1Misses, sizeof(m_L1Misses)) != sizeof(m_L1Misses))
+						m_L1Misses = 0;
+					if (read(m_LLCFile, &m_LLCMisses, sizeof(m_LLCMisses)) != sizeof(m_LLCMisses))
+						m_LLCMisses = 0;
+#endif
+				}
+
+				uint64_t GetL1Misses() const { return m_L1Misses; }
+				uint64_t GetLLCMisses() const { return m_LLCMisses; }
+
+			private:
+#ifdef __linux__
+				static int Open(uint32_t type, uint64_t config)
+				{
+					perf_event_attr attributes{};
+					attributes.size = sizeof(attributes);
+					attributes.type = type;
+					attributes.config = config;
+					attributes.disabled = 1;
+					attributes.exclude_kernel = 1;
+					attributes.exclude_hv = 1;
+					return static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+				}
+#endif
+
+				int m_L1File{ -1 };
+				int m_LLCFile{ -1 };
+				uint64_t m_L1Misses{};
+				uint64_t m_LLCMisses{};
+			};
+
+			void PrintRayStats(std::ostream& out, const char* label, const RayStats& stats)
+			{
+				out << ">> " << label << " = " << stats.RaysPerSecond() / 1'000'000.0 << " MRays/s ("
+					<< stats.rayCount << " rays in " << stats.seconds << "s)\n";
+			}
+
+			//Pinhole projection of the renderer through the pixel centers, every benchmark shooting camera rays traces the same view with it
+			class CameraRays final
+			{
+			public:
+				CameraRays(const Camera& camera, uint32_t width, uint32_t height)
+					: m_Camera(camera), m_Width(width), m_Height(height), m_AspectRatio(width / static_cast<float>(height)), m_FOV(std::tan(camera.fovAngle * TO_RADIANS / 2.f)) {}
+
+				Ray GetRay(uint32_t px, uint32_t py) const
+				{
+					const float cx{ (2 * (px + 0.5f) / float(m_Width) - 1) * m_AspectRatio * m_FOV };
+					const float cy{ (1 - 2 * ((py + 0.5f) / float(m_Height))) * m_FOV };
+
+					const Vector3 rayDirection{ cx * m_Camera.right + cy * m_Camera.up + m_Camera.forward };
+					return Ray{ m_Camera.origin, rayDirection.Normalized() };
+				}
+
+				const Camera& GetCamera() const { return m_Camera; }
+				float GetAspectRatio() const { return m_AspectRatio; }
+				float GetFOV() const { return m_FOV; }
+
+			private:
+				const Camera& m_Camera;
+				uint32_t m_Width;
+				uint32_t m_Height;
+				float m_AspectRatio;
+				float m_FOV;
+			};
+
+			// Rolling heightfield with 2 * resolution^2 triangles, big enough to give every build thread work
+			void CreateTerrain(uint32_t resolution, std::vector<Vector3>& positions, std::vector<int>& indices)
+			{
+				positions.clear();
+				indices.clear();
+				positions.reserve(size_t{ resolution + 1 } * (resolution + 1));
+				indices.reserve(size_t{ resolution } * resolution * 6);
+
+				for (uint32_t z{}; z <= resolution; ++z)
+				{
+					for (uint32_t x{}; x <= resolution; ++x)
+					{
+						const float height{ sinf(x * 0.05f) * cosf(z * 0.07f) * 4.f };
+						positions.emplace_back(static_cast<float>(x), height, static_cast<float>(z));
+					}
+				}
+
+				for (uint32_t z{}; z < resolution; ++z)
+				{
+					for (uint32_t x{}; x < resolution; ++x)
+					{
+						const int corner{ static_cast<int>(z * (resolution + 1) + x) };
+						const int row{ static_cast<int>(resolution + 1) };
+						indices.insert(indices.end(), { corner, corner + row, corner + 1 });
+						indices.insert(indices.end(), { corner + 1, corner + row, corner + row + 1 });
+					}
+				}
+			}
+
+			void RunMeshBVHComparison(std::ostream& out, uint32_t width, uint32_t height)
+			{
+				Scene_W4_BunnyScene scene{};
+				scene.Initialize();
+				scene.UpdateAccelerationStructures();
+
+				out << "**MESH TRAVERSAL (Bunny Scene)**\n";
+
+				scene.SetMeshBVHEnabled(false);
+				const RayStats linear{ TraceFrame(scene, width, height) };
+				PrintRayStats(out, "LINEAR", linear);
+
+				scene.SetMeshBVHEnabled(true);
+				const RayStats bvh{ TraceFrame(scene, width, height) };
+				PrintRayStats(out, "BVH", bvh);
+
+				out << ">> SPEEDUP = " << bvh.RaysPerSecond() / linear.RaysPerSecond() << "x\n";
+			}
+
+			void RunWideBVHComparison(std::ostream& out, uint32_t width, uint32_t height)
+			{
+				Scene_W4_BunnyScene scene{};
+				scene.Initialize();
+				scene.UpdateAccelerationStructures();
+
+				out << "**BVH LAYOUT (Bunny Scene, " << (SIMD::HasAVX2() ? "AVX2" : "scalar") << " node test)**\n";
+
+				scene.SetBVHLayout(BVHLayout::Binary);
+				const RayStats binary{ TraceFrame(scene, width, height) };
+				PrintRayStats(out, "BINARY", binary);
+
+				scene.SetBVHLayout(BVHLayout::Wide8);
+				const RayStats wide{ TraceFrame(scene, width, height) };
+				PrintRayStats(out, "WIDE8", wide);
+
+				out << ">> SPEEDUP = " << wide.RaysPerSecond() / binary.RaysPerSecond() << "x\n";
+			}
+
+			void RunQuantizedBVHComparison(std::ostream& out, uint32_t width, uint32_t height)
+			{
+				out << "**BVH COMPRESSION (Bunny)**\n";
+
+				TriangleMesh mesh{};
+				if (!Utils::ParseOBJ("Resources/lowpoly_bunny.obj", mesh.positions, mesh.normals, mesh.indices))
+				{
+					out << ">> Resources/lowpoly_bunny.obj not found\n";
+					return;
+				}
+
+				mesh.UpdateTransforms();
+
+				const double triangleCount{ static_cast<double>(mesh.indices.size() / 3) };
+				const size_t geometryBytes{ mesh.positions.size() * sizeof(Vector3) + mesh.normals.size() * sizeof(Vector3) + mesh.indices.size() * sizeof(int) };
+				out << ">> GEOMETRY = " << geometryBytes / triangleCount << " bytes/triangle\n";
+
+				// Everything a mesh keeps resident to be traced with the layout: its nodes, the primitive order and the leaf records or blocks
+				const std::pair<BVHLayout, const char*> layouts[]{ { BVHLayout::Binary, "BINARY" }, { BVHLayout::Wide8, "WIDE8" }, { BVHLayout::Quantized, "QUANTIZED" } };
+				for (const auto& [layout, label] : layouts)
+				{
+					mesh.bvhLayout = layout;
+					mesh.UpdateGeometry();
+
+					const size_t traversalBytes{ mesh.bvh.GetMemoryUsage() + mesh.wideBVH.GetMemoryUsage() + mesh.quantizedBVH.GetMemoryUsage()
+						+ mesh.triangleRecords.size() * sizeof(TriangleRecord) + mesh.triangleBlocks.GetMemoryUsage() };
+					out << ">> " << label << " RESIDENT = " << traversalBytes / triangleCount << " bytes/triangle (nodes, indices & leaves)\n";
+				}
+
+				Scene_W4_BunnyScene scene{};
+				scene.Initialize();
+				scene.UpdateAccelerationStructures();
+
+				scene.SetBVHLayout(BVHLayout::Binary);
+				const RayStats full{ TraceFrame(scene, width, height) };
+				PrintRayStats(out, "FULL", full);
+
+				scene.SetBVHLayout(BVHLayout::Quantized);
+				const RayStats quantized{ TraceFrame(scene, width, height) };
+				PrintRayStats(out, "QUANTIZED", quantized);
+
+				out << ">> SPEEDUP = " << quantized.RaysPerSecond() / full.RaysPerSecond() << "x\n";
+			}
+
+			//Leaf storage the tracer reads per triangle: the records or blocks plus the normals, against the 16-bit encoding
+			//Rays straight down onto the terrain count the holes the quantization would open between neighbours
+			void RunCompactMeshComparison(std::ostream& out, uint32_t width, uint32_t height)
+			{
+				for (const uint32_t resolution : { 128u, 512u })
+				{
+					std::vector<Vector3> positions{};
+					std::vector<int> indices{};
+					CreateTerrain(resolution, positions, indices);
+
+					TriangleMesh mesh{ positions, indices, TriangleCullMode::NoCulling };
+					TriangleMesh compactMesh{ positions, indices, TriangleCullMode::NoCulling };
+					compactMesh.useCompactStorage = true;
+					compactMesh.UpdateGeometry();
+					compactMesh.UpdateTransforms();
+
+					const double triangleCount{ static_cast<double>(indices.size() / 3) };
+					out << "**COMPACT MESH STORAGE (Terrain, " << indices.size() / 3 << " triangles, " << positions.size() << " vertices)**\n";
+
+					const size_t normalBytes{ mesh.normals.size() * sizeof(Vector3) };
+					out << ">> RECORDS = " << (indices.size() / 3 * sizeof(TriangleRecord) + normalBytes) / triangleCount << " bytes/triangle\n";
+					if (mesh.triangleBlocks.IsBuilt())
+						out << ">> AVX2 BLOCKS = " << (mesh.triangleBlocks.GetMemoryUsage() + normalBytes) / triangleCount << " bytes/triangle\n";
+					out << ">> COMPACT = " << compactMesh.compactTriangles.GetMemoryUsage() / triangleCount << " bytes/triangle\n";
+
+					// Straight down onto the heightfield every ray has to hit, a crack between neighbours shows up as a miss
+					std::mt19937 randomEngine{ 1234 };
+					std::uniform_real_distribution<float> terrain{ 0.f, static_cast<float>(resolution) };
+					const MeshInstance instance{ mesh.GetInstance() };
+					const MeshInstance compactInstance{ compactMesh.GetInstance() };
+					uint32_t fullHoles{};
+					uint32_t compactHoles{};
+					constexpr uint32_t holeRayCount{ 1'000'000 };
+					for (uint32_t i{}; i < holeRayCount; ++i)
+					{
+						const Ray ray{ { terrain(randomEngine), 50.f, terrain(randomEngine) }, { 0.f, -1.f, 0.f } };
+						uint32_t triangleIndex{};
+						if (GeometryUtils::ClosestHit_TriangleMesh(mesh, instance, ray, triangleIndex) == FLT_MAX)
+							++fullHoles;
+						if (GeometryUtils::ClosestHit_TriangleMesh(compactMesh, compactInstance, ray, triangleIndex) == FLT_MAX)
+							++compactHoles;
+					}
+					out << ">> HOLES = " << fullHoles << " full, " << compactHoles << " compact (of " << holeRayCount << " rays)\n";
+
+					// Everything the meshes keep allocated, the compact one freed its full size arrays & the BVH build data
+					out << ">> TOTAL RESIDENT = " << mesh.GetMemoryUsage() / triangleCount << " bytes/triangle full, "
+						<< compactMesh.GetMemoryUsage() / triangleCount << " compact";
+
+					// Rebuilt from the decoded 16-bit data, the binary nodes are most of what is left
+					compactMesh.bvhLayout = BVHLayout::Quantized;
+					compactMesh.UpdateGeometry();
+					out << ", " << compactMesh.GetMemoryUsage() / triangleCount << " compact with quantized nodes\n";
+				}
+
+				Scene_W4_BunnyScene scene{};
+				scene.Initialize();
+				scene.UpdateAccelerationStructures();
+
+				out << "**COMPACT MESH TRACING (Bunny Scene)**\n";
+
+				const RayStats full{ TraceFrame(scene, width, height) };
+				PrintRayStats(out, "FULL", full);
+
+				scene.SetCompactMeshStorageEnabled(true);
+				const RayStats compact{ TraceFrame(scene, width, height) };
+				PrintRayStats(out, "COMPACT", compact);
+
+				out << ">> SPEEDUP = " << compact.RaysPerSecond() / full.RaysPerSecond() << "x\n";
+			}
+
+			void RunSIMDTriangleComparison(std::ostream& out, uint32_t width, uint32_t height)
+			{
+				Scene_W4_BunnyScene scene{};
+				scene.Initialize();
+				scene.UpdateAccelerationStructures();
+
+				out << "**LEAF TRIANGLE TEST (Bunny Scene)**\n";
+
+				if (!SIMD::HasAVX2())
+				{
+					out << ">> AVX2 not supported, leaves use the scalar test\n";
+					return;
+				}
+
+				scene.SetSIMDTrianglesEnabled(false);
+				const RayStats scalar{ TraceFrame(scene, width, height) };
+				PrintRayStats(out, "SCALAR", scalar);
+
+				scene.SetSIMDTrianglesEnabled(true);
+				const RayStats simd{ TraceFrame(scene, width, height) };
+				PrintRayStats(out, "AVX2 x8", simd);
+
+				out << ">> SPEEDUP = " << simd.RaysPerSecond() / scalar.RaysPerSecond() << "x\n";
+			}
+
+			//Closest hit of the ray against every record, with the kernel of one cull mode
+			template<TriangleCullMode CullMode>
+			bool ClosestHit_TriangleRecords(const std::vector<TriangleRecord>& records, const Ray& ray)
+			{
+				Ray closestRay{ ray };
+				for (const TriangleRecord& record : records)
+				{
+					const float t{ GeometryUtils::IntersectTriangle<CullMode>(record.v0, record.edge1, record.edge2, closestRay) };
+					if (t != FLT_MAX)
+						closestRay.max = t;
+				}
+				return closestRay.max != ray.max;
+			}
+
+			//Brute force triangle tests on a small terrain, the cull mode read per triangle (as Triangle::cullMode is) against the kernel compiled for it
+			//Rays come from above and below, so every cull mode rejects about half of the sides they reach
+			void RunCullModeComparison(std::ostream& out)
+			{
+				std::vector<Vector3> positions{};
+				std::vector<int> indices{};
+				CreateTerrain(32, positions, indices);
+
+				std::vector<TriangleRecord> records(indices.size() / 3);
+				for (size_t i{}; i < records.size(); ++i)
+				{
+					const Vector3& v0{ positions[indices[i * 3]] };
+					records[i] = { v0, positions[indices[i * 3 + 1]] - v0, positions[indices[i * 3 + 2]] - v0, static_cast<uint32_t>(i) };
+				}
+
+				std::mt19937 randomEngine{ 1234 };
+				std::uniform_real_distribution<float> terrain{ 0.f, 32.f };
+				std::vector<Ray> rays{};
+				rays.reserve(4096);
+				for (uint32_t i{}; i < 4096; ++i)
+				{
+					const float side{ i % 2 == 0 ? 1.f : -1.f };
+					const Vector3 origin{ terrain(randomEngine), side * 20.f, terrain(randomEngine) };
+					const Vector3 target{ terrain(randomEngine), 0.f, terrain(randomEngine) };
+					rays.emplace_back(origin, (target - origin).Normalized());
+				}
+
+				out << "**CULL MODE KERNELS (Terrain, " << records.size() << " triangles, " << rays.size() << " rays)**\n";
+
+				// One ray is every triangle tested against it, so the numbers are triangle tests per second
+				const auto measure{ [&](const char* label, auto&& traceRay)
+					{
+						uint32_t hitCount{};
+						const auto start{ std::chrono::high_resolution_clock::now() };
+						for (const Ray& ray : rays)
+						{
+							if (traceRay(ray))
+								++hitCount;
+						}
+
+						RayStats stats{};
+						stats.rayCount = rays.size() * records.size();
+						stats.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+						PrintRayStats(out, label, stats);
+						out << "   hits = " << hitCount << "/" << rays.size() << "\n";
+						return stats;
+					} };
+
+				const auto compare{ [&](const char* variant, TriangleCullMode cullMode, auto&& closestHit)
+					{
+						const std::vector<TriangleCullMode> cullModes(records.size(), cullMode);
+						const RayStats runtime{ measure("PER TRIANGLE CULL MODE", [&](const Ray& ray)
+							{
+								Ray closestRay{ ray };
+								for (size_t i{}; i < records.size(); ++i)
+								{
+									const TriangleRecord& record{ records[i] };
+									const float t{ GeometryUtils::IntersectTriangle(record.v0, record.edge1, record.edge2, cullModes[i], closestRay) };
+									if (t != FLT_MAX)
+										closestRay.max = t;
+								}
+								return closestRay.max != ray.max;
+							}) };
+
+						const RayStats specialized{ measure("PER MESH KERNEL", closestHit) };
+						out << ">> " << variant << " SPEEDUP = " << specialized.RaysPerSecond() / runtime.RaysPerSecond() << "x\n";
+					} };
+
+				out << "FRONT FACE CULLING\n";
+				compare("FRONT FACE CULLING", TriangleCullMode::FrontFaceCulling, [&](const Ray& ray)
+					{ return ClosestHit_TriangleRecords<TriangleCullMode::FrontFaceCulling>(records, ray); });
+				out << "BACK FACE CULLING\n";
+				compare("BACK FACE CULLING", TriangleCullMode::BackFaceCulling, [&](const Ray& ray)
+					{ return ClosestHit_TriangleRecords<TriangleCullMode::BackFaceCulling>(records, ray); });
+				out << "NO CULLING\n";
+				compare("NO CULLING", TriangleCullMode::NoCulling, [&](const Ray& ray)
+					{ return ClosestHit_TriangleRecords<TriangleCullMode::NoCulling>(records, ray); });
+
+				// Shadow rays stop at the first triangle whatever side it shows, the old path picked that per triangle from the ignoreHitRecord flag
+				out << "ANY HIT\n";
+				std::vector<Triangle> triangles{};
+				triangles.reserve(records.size());
+				for (const TriangleRecord& record : records)
+					triangles.emplace_back(record.v0, record.v0 + record.edge1, record.v0 + record.edge2).cullMode = TriangleCullMode::BackFaceCulling;
+
+				const RayStats anyHitRuntime{ measure("PER TRIANGLE HIT RECORD FLAG", [&](const Ray& ray)
+					{
+						HitRecord hitRecord{};
+						for (const Triangle& triangle : triangles)
+						{
+							if (GeometryUtils::HitTest_Triangle(triangle, ray, hitRecord, true))
+								return true;
+						}
+						return false;
+					}) };
+				const RayStats anyHit{ measure("PER MESH KERNEL", [&](const Ray& ray)
+					{
+						for (const TriangleRecord& record : records)
+						{
+							if (GeometryUtils::IsOccluded_TriangleRecord(record, ray))
+								return true;
+						}
+						return false;
+					}) };
+				out << ">> ANY HIT SPEEDUP = " << anyHit.RaysPerSecond() / anyHitRuntime.RaysPerSecond() << "x\n";
+			}
+
+			void RunBVHBuildComparison(std::ostream& out)
+			{
+				std::vector<Vector3> positions{};
+				std::vector<int> indices{};
+				CreateTerrain(512, positions, indices);
+
+				out << "**BVH BUILD (Terrain, " << indices.size() / 3 << " triangles, "
+					<< std::thread::hardware_concurrency() << " hardware threads)**\n";
+
+				double buildSeconds[2]{};
+				for (int parallel{}; parallel < 2; ++parallel)
+				{
+					BVH bvh{};
+					bvh.SetParallelBuild(parallel == 1);
+
+					const auto start{ std::chrono::high_resolution_clock::now() };
+					bvh.Build(positions, indices);
+					buildSeconds[parallel] = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+					out << ">> " << (parallel ? "PARALLEL" : "SERIAL") << " = " << buildSeconds[parallel] * 1000.0 << " ms, SAH cost "
+						<< bvh.ComputeSAHCost() << ", " << bvh.GetNodes().size() << " nodes\n";
+				}
+
+				out << ">> SPEEDUP = " << buildSeconds[0] / buildSeconds[1] << "x\n";
+			}
+
+			void RunSpatialSplitComparison(std::ostream& out, uint32_t width, uint32_t height)
+			{
+				Scene_StretchedTriangles scene{};
+				scene.Initialize();
+				scene.UpdateAccelerationStructures();
+
+				out << "**SPATIAL SPLITS (Stretched Triangles)**\n";
+
+				const std::pair<BVHBuildMode, const char*> buildModes[]{ { BVHBuildMode::SAH, "SAH" }, { BVHBuildMode::SpatialSplits, "SBVH" } };
+				double raysPerSecond[2]{};
+				for (int i{}; i < 2; ++i)
+				{
+					const auto start{ std::chrono::high_resolution_clock::now() };
+					scene.SetBVHBuildMode(buildModes[i].first);
+					const double buildSeconds{ std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() };
+
+					const BVH& bvh{ scene.GetTriangleMeshGeometries()[0].bvh };
+					out << ">> " << buildModes[i].second << " BUILD = " << buildSeconds * 1000.0 << " ms, SAH cost " << bvh.ComputeSAHCost()
+						<< ", " << bvh.GetReferenceCount() << " references for " << bvh.GetPrimitiveCount() << " triangles\n";
+
+					const RayStats stats{ TraceFrame(scene, width, height) };
+					PrintRayStats(out, buildModes[i].second, stats);
+					raysPerSecond[i] = stats.RaysPerSecond();
+				}
+
+				out << ">> SPEEDUP = " << raysPerSecond[1] / raysPerSecond[0] << "x\n";
+			}
+
+			void RunLinearBVHComparison(std::ostream& out, uint32_t width, uint32_t height)
+			{
+				std::vector<Vector3> positions{};
+				std::vector<int> indices{};
+				CreateTerrain(708, positions, indices);
+
+				out << "**LINEAR BVH (Terrain, " << indices.size() / 3 << " triangles, 16.7 ms frame budget)**\n";
+
+				const std::pair<BVHBuildMode, const char*> buildModes[]{ { BVHBuildMode::SAH, "SAH" }, { BVHBuildMode::Linear, "LBVH" } };
+				for (const auto& [buildMode, label] : buildModes)
+				{
+					BVH bvh{};
+					bvh.SetBuildMode(buildMode);
+
+					const auto start{ std::chrono::high_resolution_clock::now() };
+					bvh.Build(positions, indices);
+					const double buildSeconds{ std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() };
+
+					out << ">> " << label << " BUILD = " << buildSeconds * 1000.0 << " ms, SAH cost " << bvh.ComputeSAHCost() << "\n";
+				}
+
+				Scene_W4_BunnyScene scene{};
+				scene.Initialize();
+				scene.UpdateAccelerationStructures();
+
+				double raysPerSecond[2]{};
+				for (int i{}; i < 2; ++i)
+				{
+					scene.SetBVHBuildMode(buildModes[i].first);
+					const RayStats stats{ TraceFrame(scene, width, height) };
+					PrintRayStats(out, buildModes[i].second, stats);
+					raysPerSecond[i] = stats.RaysPerSecond();
+				}
+
+				out << ">> TRACE SPEED LBVH / SAH = " << raysPerSecond[1] / raysPerSecond[0] << "x\n";
+			}
+
+			void RunNodeOrderComparison(std::ostream& out, uint32_t width, uint32_t height)
+			{
+				Scene_W4_BunnyScene scene{};
+				scene.Initialize();
+				scene.UpdateAccelerationStructures();
+
+				CacheMissCounters counters{};
+				out << "**NODE ORDER (Bunny Scene)**\n";
+				if (!counters.IsAvailable())
+					out << ">> cache miss counts not available (needs perf_event access on Linux), comparing rays per second alone\n";
+
+				const std::pair<BVHNodeOrder, const char*> nodeOrders[]{ { BVHNodeOrder::Build, "BUILD ORDER" }, { BVHNodeOrder::DepthFirst, "DEPTH FIRST" }, { BVHNodeOrder::VanEmdeBoas, "VAN EMDE BOAS" } };
+				for (const auto& [nodeOrder, label] : nodeOrders)
+				{
+					scene.SetBVHNodeOrder(nodeOrder);
+
+					counters.Start();
+					const RayStats stats{ TraceFrame(scene, width, height) };
+					counters.Stop();
+
+					PrintRayStats(out, label, stats);
+					if (counters.IsAvailable())
+					{
+						out << "   L1 misses/ray = " << static_cast<double>(counters.GetL1Misses()) / stats.rayCount
+							<< ", LLC misses/ray = " << static_cast<double>(counters.GetLLCMisses()) / stats.rayCount << "\n";
+					}
+				}
+			}
+
+			void RunTopLevelBVHComparison(std::ostream& out, uint32_t width, uint32_t height)
+			{
+				Scene_SphereField scene{};
+				scene.Initialize();
+				scene.UpdateAccelerationStructures();
+
+				out << "**TOP-LEVEL TRAVERSAL (Sphere Field)**\n";
+
+				scene.SetTopLevelBVHEnabled(false);
+				const RayStats linear{ TraceFrame(scene, width, height) };
+				PrintRayStats(out, "LINEAR", linear);
+
+				scene.SetTopLevelBVHEnabled(true);
+				const RayStats bvh{ TraceFrame(scene, width, height) };
+				PrintRayStats(out, "TLAS", bvh);
+
+				out << ">> SPEEDUP = " << bvh.RaysPerSecond() / linear.RaysPerSecond() << "x\n";
+			}
+
+			void RunSphereBlockComparison(std::ostream& out, uint32_t width, uint32_t height)
+			{
+				// 320 x 320, a particle-sized sphere count
+				Scene_SphereField scene{ 320 };
+				scene.Initialize();
+				scene.UpdateAccelerationStructures();
+
+				out << "**SPHERE STORAGE (Sphere Field, 102400 spheres, " << (SIMD::HasAVX2() ? "AVX2" : "scalar") << " sphere test)**\n";
+
+				scene.SetSphereBlocksEnabled(false);
+				const RayStats single{ TraceFrame(scene, width, height) };
+				PrintRayStats(out, "SPHERE PER LEAF", single);
+
+				scene.SetSphereBlocksEnabled(true);
+				const RayStats blocks{ TraceFrame(scene, width, height) };
+				PrintRayStats(out, "SOA BLOCKS x8", blocks);
+
+				out << ">> SPEEDUP = " << blocks.RaysPerSecond() / single.RaysPerSecond() << "x\n";
+			}
+
+			//Rays from the middle of the Reference Scene room against its planes, the authoring structs one at a time against the compiled SoA blocks
+			void RunPlaneBlockComparison(std::ostream& out)
+			{
+				Scene_W4_ReferenceScene scene{};
+				scene.Initialize();
+
+				const std::vector<Plane>& planes{ scene.GetPlaneGeometries() };
+				PlaneBlockList planeBlocks{};
+				planeBlocks.Build(planes);
+
+				std::mt19937 randomEngine{ 1234 };
+				std::uniform_real_distribution<float> unit{ -1.f, 1.f };
+				std::vector<Ray> rays{};
+				rays.reserve(1'000'000);
+				while (rays.size() < rays.capacity())
+				{
+					const Vector3 direction{ unit(randomEngine), unit(randomEngine), unit(randomEngine) };
+					if (direction.SqrMagnitude() > 0.f)
+						rays.emplace_back(Vector3{ 0.f, 5.f, 5.f }, direction.Normalized());
+				}
+
+				out << "**PLANE STORAGE (Reference Scene, " << planes.size() << " planes, " << (SIMD::HasAVX2() ? "AVX2" : "scalar") << " plane test)**\n";
+
+				const auto measure{ [&](const char* label, auto&& intersect)
+					{
+						double distanceSum{};
+						const auto start{ std::chrono::high_resolution_clock::now() };
+						for (const Ray& ray : rays)
+						{
+							const float t{ intersect(ray) };
+							if (t != FLT_MAX)
+								distanceSum += t;
+						}
+
+						RayStats stats{};
+						stats.rayCount = rays.size();
+						stats.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+						PrintRayStats(out, label, stats);
+						out << "   distance sum = " << distanceSum << "\n";
+						return stats;
+					} };
+
+				const RayStats structs{ measure("PLANE STRUCTS", [&](const Ray& ray)
+					{
+						Ray closestRay{ ray };
+						for (const Plane& plane : planes)
+							closestRay.max = std::min(closestRay.max, GeometryUtils::IntersectPlane(plane, closestRay));
+						return closestRay.max == ray.max ? FLT_MAX : closestRay.max;
+					}) };
+
+				const RayStats blocks{ measure("SOA BLOCKS x8", [&](const Ray& ray)
+					{
+						Ray closestRay{ ray };
+						for (const PlaneBlock& block : planeBlocks.GetBlocks())
+						{
+							uint32_t lane{};
+							closestRay.max = std::min(closestRay.max, PlaneBlockList::Intersect(block, closestRay, lane));
+						}
+						return closestRay.max == ray.max ? FLT_MAX : closestRay.max;
+					}) };
+
+				out << ">> SPEEDUP = " << blocks.RaysPerSecond() / structs.RaysPerSecond() << "x\n";
+			}
+
+			//Camera rays only, traced one at a time or as 8x8 packets, the hits are counted so both runs can be checked against each other
+			RayStats TracePrimaryRays(Scene& scene, uint32_t width, uint32_t height, bool usePackets, uint64_t& hitCount)
+			{
+				const CameraRays cameraRays{ scene.GetCamera(), width, height };
+
+				RayStats stats{};
+				hitCount = 0;
+				const auto start{ std::chrono::high_resolution_clock::now() };
+
+				if (usePackets)
+				{
+					RayPacket packet{};
+					HitRecord closestHits[RayPacket::RayCount]{};
+					for (uint32_t firstY{}; firstY < height; firstY += RayPacket::Size)
+					{
+						for (uint32_t firstX{}; firstX < width; firstX += RayPacket::Size)
+						{
+							packet.SetPrimaryRays(cameraRays.GetCamera(), firstX, firstY, width, height, cameraRays.GetAspectRatio(), cameraRays.GetFOV());
+							std::fill(std::begin(closestHits), std::end(closestHits), HitRecord{});
+							scene.GetClosestHits(packet, closestHits);
+
+							for (const HitRecord& closestHit : closestHits)
+							{
+								hitCount += closestHit.didHit;
+							}
+							stats.rayCount += std::popcount(packet.activeMask);
+						}
+					}
+				}
+				else
+				{
+					for (uint32_t py{}; py < height; ++py)
+					{
+						for (uint32_t px{}; px < width; ++px)
+						{
+							HitRecord closestHit{};
+							scene.GetClosestHit(cameraRays.GetRay(px, py), closestHit);
+
+							hitCount += closestHit.didHit;
+							++stats.rayCount;
+						}
+					}
+				}
+
+				stats.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+				return stats;
+			}
+
+			void RunPacketComparison(std::ostream& out, const char* sceneName, Scene& scene, uint32_t width, uint32_t height)
+			{
+				scene.Initialize();
+				scene.UpdateAccelerationStructures();
+
+				out << "**PRIMARY RAYS (" << sceneName << ")**\n";
+
+				uint64_t singleHits{};
+				const RayStats single{ TracePrimaryRays(scene, width, height, false, singleHits) };
+				PrintRayStats(out, "SINGLE RAYS", single);
+
+				uint64_t packetHits{};
+				const RayStats packets{ TracePrimaryRays(scene, width, height, true, packetHits) };
+				PrintRayStats(out, "8x8 PACKETS", packets);
+
+				out << "   hits = " << singleHits << " / " << packetHits << "\n";
+				out << ">> SPEEDUP = " << packets.RaysPerSecond() / single.RaysPerSecond() << "x\n";
+			}
+
+			void RunPacketComparisons(std::ostream& out, uint32_t width, uint32_t height)
+			{
+				Scene_W4_BunnyScene bunnyScene{};
+				RunPacketComparison(out, "Bunny Scene", bunnyScene, width, height);
+
+				Scene_W4_ReferenceScene referenceScene{};
+				RunPacketComparison(out, "Reference Scene", referenceScene, width, height);
+
+				Scene_SphereField sphereField{};
+				RunPacketComparison(out, "Sphere Field", sphereField, width, height);
+			}
+
+			void RunCookTorrenceComparison(std::ostream& out)
+			{
+				const Material_CookTorrence material{ { 0.972f, 0.96f, 0.915f }, 1.f, 0.6f };
+
+				// Directions on the upper hemisphere of random normals, like the samples that pass the observed area test
+				std::mt19937 randomEngine{ 1234 };
+				std::uniform_real_distribution<float> unit{ -1.f, 1.f };
+				const auto randomDirection{ [&]()
+					{
+						Vector3 direction{};
+						do
+						{
+							direction = { unit(randomEngine), unit(randomEngine), unit(randomEngine) };
+						} while (direction.SqrMagnitude() < 0.01f || direction.SqrMagnitude() > 1.f);
+						return direction.Normalized();
+					} };
+
+				std::vector<BRDF::SampleBlock> blocks(1'000'000 / BRDF::SampleBlock::Width);
+				for (BRDF::SampleBlock& block : blocks)
+				{
+					for (uint32_t i{}; i < BRDF::SampleBlock::Width; ++i)
+					{
+						const Vector3 normal{ randomDirection() };
+						Vector3 view{ randomDirection() };
+						Vector3 light{ randomDirection() };
+						if (Vector3::Dot(normal, view) < 0.f)
+							view = -view;
+						if (Vector3::Dot(normal, light) < 0.f)
+							light = -light;
+
+						block.normalX[i] = normal.x;
+						block.normalY[i] = normal.y;
+						block.normalZ[i] = normal.z;
+						block.viewX[i] = view.x;
+						block.viewY[i] = view.y;
+						block.viewZ[i] = view.z;
+						block.lightX[i] = light.x;
+						block.lightY[i] = light.y;
+						block.lightZ[i] = light.z;
+					}
+				}
+
+				out << "**COOK-TORRENCE SHADING (" << blocks.size() * BRDF::SampleBlock::Width << " samples, " << (SIMD::HasAVX2() ? "AVX2" : "scalar") << " x8 kernel)**\n";
+
+				std::vector<ColorRGB> scalarBRDFs(blocks.size() * BRDF::SampleBlock::Width);
+				auto start{ std::chrono::high_resolution_clock::now() };
+				for (size_t blockIndex{}; blockIndex < blocks.size(); ++blockIndex)
+				{
+					const BRDF::SampleBlock& block{ blocks[blockIndex] };
+					for (uint32_t i{}; i < BRDF::SampleBlock::Width; ++i)
+					{
+						HitRecord hitRecord{};
+						hitRecord.normal = { block.normalX[i], block.normalY[i], block.normalZ[i] };
+						const Vector3 light{ block.lightX[i], block.lightY[i], block.lightZ[i] };
+						const Vector3 view{ block.viewX[i], block.viewY[i], block.viewZ[i] };
+						scalarBRDFs[blockIndex * BRDF::SampleBlock::Width + i] = material.Shade(hitRecord, light, view);
+					}
+				}
+				const double scalarSeconds{ std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() };
+
+				std::vector<ColorRGB> blockBRDFs(scalarBRDFs.size());
+				start = std::chrono::high_resolution_clock::now();
+				for (size_t blockIndex{}; blockIndex < blocks.size(); ++blockIndex)
+				{
+					BRDF::CookTorrence_x8(material.GetConstants(), blocks[blockIndex], &blockBRDFs[blockIndex * BRDF::SampleBlock::Width]);
+				}
+				const double blockSeconds{ std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() };
+
+				float maxRelativeError{};
+				for (size_t i{}; i < scalarBRDFs.size(); ++i)
+				{
+					const ColorRGB& expected{ scalarBRDFs[i] };
+					const ColorRGB& actual{ blockBRDFs[i] };
+					maxRelativeError = std::max({ maxRelativeError,
+						std::abs(actual.r - expected.r) / std::max(std::abs(expected.r), 1e-3f),
+						std::abs(actual.g - expected.g) / std::max(std::abs(expected.g), 1e-3f),
+						std::abs(actual.b - expected.b) / std::max(std::abs(expected.b), 1e-3f) });
+				}
+
+				out << ">> SCALAR = " << scalarBRDFs.size() / scalarSeconds / 1'000'000.0 << " MSamples/s\n";
+				out << ">> X8 = " << blockBRDFs.size() / blockSeconds / 1'000'000.0 << " MSamples/s\n";
+				out << "   max relative difference = " << maxRelativeError << "\n";
+				out << ">> SPEEDUP = " << scalarSeconds / blockSeconds << "x\n";
+			}
+
+			void RunFrameOverlapComparison(std::ostream& out, uint32_t width, uint32_t height)
+			{
+				Scene_W4_ReferenceScene scene{};
+				scene.Initialize();
+				scene.UpdateAccelerationStructures();
+
+				out << "**FRAME PIPELINE (Reference Scene, animated)**\n";
+
+				Timer timer{};
+				timer.Start();
+
+				constexpr int frameCount{ 20 };
+				const auto measure{ [&](const char* label, auto&& runFrame)
+					{
+						RayStats stats{};
+						const auto start{ std::chrono::high_resolution_clock::now() };
+						for (int frame{}; frame < frameCount; ++frame)
+						{
+							const RayStats frameStats{ runFrame() };
+							stats.rayCount += frameStats.rayCount;
+							timer.Update();
+						}
+						stats.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+						PrintRayStats(out, label, stats);
+						out << "   frame time = " << stats.seconds * 1000.0 / frameCount << " ms\n";
+						return stats;
+					} };
+
+				const RayStats sequential{ measure("UPDATE THEN RENDER", [&]()
+					{
+						scene.Update(&timer);
+						scene.UpdateAccelerationStructures();
+						return TraceFrame(scene, width, height);
+					}) };
+
+				// The next frame is compiled on a worker while the current one is traced
+				const RayStats overlapped{ measure("UPDATE DURING RENDER", [&]()
+					{
+						auto nextFrame{ std::async(std::launch::async, [&]()
+							{
+								scene.Update(&timer);
+								scene.BuildNextFrame();
+							}) };
+						const RayStats stats{ TraceFrame(scene, width, height) };
+						nextFrame.wait();
+						scene.SwapFrames();
+						return stats;
+					}) };
+
+				out << ">> SPEEDUP = " << sequential.seconds / overlapped.seconds << "x\n";
+			}
+
+			void RunBVHUpdateComparison(std::ostream& out)
+			{
+				out << "**BVH UPDATE (Bunny, rotating)**\n";
+
+				TriangleMesh mesh{};
+				if (!Utils::ParseOBJ("Resources/lowpoly_bunny.obj", mesh.positions, mesh.normals, mesh.indices))
+				{
+					out << ">> Resources/lowpoly_bunny.obj not found\n";
+					return;
+				}
+
+				mesh.Scale({ 2.f, 2.f, 2.f });
+				mesh.UpdateTransforms();
+
+				// Rigid motion of an instance only touches its matrices
+				constexpr int frameCount{ 100 };
+				auto start{ std::chrono::high_resolution_clock::now() };
+				for (int frame{}; frame < frameCount; ++frame)
+				{
+					mesh.RotateY(PI_2 * frame / frameCount);
+					mesh.UpdateTransforms();
+				}
+				const double instanceSeconds{ std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() };
+
+				// Moving the vertices themselves (as a deforming mesh would) needs the BVH to follow, both trees see the same vertices
+				BVH rebuiltBVH{ mesh.bvh };
+				BVH refittedBVH{ mesh.bvh };
+				std::vector<Vector3> animatedPositions(mesh.positions.size());
+
+				double rebuildSeconds{};
+				double refitSeconds{};
+				float rebuildSAHCost{};
+				float refitSAHCost{};
+				int refitRebuildCount{};
+
+				for (int frame{}; frame < frameCount; ++frame)
+				{
+					const Matrix rotation{ Matrix::CreateRotationY(PI_2 * frame / frameCount) };
+					for (size_t i{}; i < mesh.positions.size(); ++i)
+					{
+						animatedPositions[i] = rotation.TransformPoint(mesh.positions[i]);
+					}
+
+					start = std::chrono::high_resolution_clock::now();
+					rebuiltBVH.Build(animatedPositions, mesh.indices);
+					rebuildSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+					start = std::chrono::high_resolution_clock::now();
+					if (refittedBVH.Update(animatedPositions, mesh.indices))
+						++refitRebuildCount;
+					refitSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+					rebuildSAHCost += rebuiltBVH.ComputeSAHCost();
+					refitSAHCost += refittedBVH.ComputeSAHCost();
+				}
+
+				out << ">> TRIANGLES = " << mesh.indices.size() / 3 << ", FRAMES = " << frameCount << "\n";
+				out << ">> INSTANCE TRANSFORM = " << instanceSeconds * 1000.0 / frameCount << " ms/frame\n";
+				out << ">> VERTEX ANIMATION, REBUILD = " << rebuildSeconds * 1000.0 / frameCount << " ms/frame, avg SAH cost " << rebuildSAHCost / frameCount << "\n";
+				out << ">> VERTEX ANIMATION, REFIT = " << refitSeconds * 1000.0 / frameCount << " ms/frame, avg SAH cost " << refitSAHCost / frameCount
+					<< " (" << refitRebuildCount << " threshold rebuilds)\n";
+			}
+
+			struct ShadowRay
+			{
+				Ray ray{};
+				uint32_t lightIndex{};
+				uint32_t pixelIndex{};
+			};
+
+			//Shadow rays of one frame, ordered per pixel and per light like the renderer shoots them
+			std::vector<ShadowRay> CollectShadowRays(const Scene& scene, const Camera& camera, uint32_t width, uint32_t height)
+			{
+				const CameraRays cameraRays{ camera, width, height };
+
+				const std::vector<Light>& lights{ scene.GetLights() };
+				std::vector<ShadowRay> shadowRays{};
+				for (uint32_t py{}; py < height; ++py)
+				{
+					for (uint32_t px{}; px < width; ++px)
+					{
+						HitRecord closestHit{};
+						scene.GetClosestHit(cameraRays.GetRay(px, py), closestHit);
+						if (!closestHit.didHit)
+							continue;
+
+						for (uint32_t i{}; i < lights.size(); ++i)
+						{
+							Vector3 directionToLight{ LightUtils::GetDirectionToLight(lights[i], closestHit.origin) };
+							const float distance{ directionToLight.Normalize() };
+							if (Vector3::Dot(closestHit.normal, directionToLight) >= 0.f)
+								shadowRays.push_back({ Ray{ closestHit.origin, directionToLight, 0.0001f, distance }, i, px + py * width });
+						}
+					}
+				}
+				return shadowRays;
+			}
+
+			void RunShadowRayComparison(std::ostream& out, const char* sceneName, Scene& scene, uint32_t width, uint32_t height)
+			{
+				scene.Initialize();
+				scene.UpdateAccelerationStructures();
+
+				out << "**SHADOW RAYS (" << sceneName << ")**\n";
+
+				const std::vector<ShadowRay> shadowRays{ CollectShadowRays(scene, scene.GetCamera(), width, height) };
+
+				const auto measure{ [&](const char* label, auto&& isOccluded)
+					{
+						uint32_t occludedCount{};
+						const auto start{ std::chrono::high_resolution_clock::now() };
+						for (const ShadowRay& shadowRay : shadowRays)
+						{
+							if (isOccluded(shadowRay))
+								++occludedCount;
+						}
+
+						RayStats stats{};
+						stats.rayCount = shadowRays.size();
+						stats.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+						PrintRayStats(out, label, stats);
+						out << "   occluded = " << occludedCount << "/" << shadowRays.size() << "\n";
+						return stats;
+					} };
+
+				// The closest hit applies the cull modes of the triangles, so it sees fewer blockers than a shadow query does
+				const RayStats closestHit{ measure("CLOSEST HIT", [&](const ShadowRay& shadowRay)
+					{
+						HitRecord hitRecord{};
+						scene.GetClosestHit(shadowRay.ray, hitRecord);
+						return hitRecord.didHit;
+					}) };
+
+				const RayStats anyHit{ measure("ANY HIT", [&](const ShadowRay& shadowRay)
+					{
+						Scene::OccluderHint lastOccluder{};
+						return scene.IsOccluded(shadowRay.ray, lastOccluder);
+					}) };
+
+				std::vector<Scene::OccluderHint> lastOccluders(scene.GetLights().size());
+				const RayStats lastOccluder{ measure("ANY HIT + LAST OCCLUDER", [&](const ShadowRay& shadowRay)
+					{
+						return scene.IsOccluded(shadowRay.ray, lastOccluders[shadowRay.lightIndex]);
+					}) };
+
+				out << ">> SPEEDUP ANY HIT = " << anyHit.RaysPerSecond() / closestHit.RaysPerSecond()
+					<< "x, WITH LAST OCCLUDER = " << lastOccluder.RaysPerSecond() / closestHit.RaysPerSecond() << "x\n";
+			}
+
+			void RunShadowRayComparisons(std::ostream& out, uint32_t width, uint32_t height)
+			{
+				Scene_W4_ReferenceScene referenceScene{};
+				RunShadowRayComparison(out, "Reference Scene", referenceScene, width, height);
+
+				// Deep sphere BVH, a hit on the last leaf skips the whole walk down to it
+				Scene_SphereField sphereField{ 320 };
+				RunShadowRayComparison(out, "Sphere Field", sphereField, width, height);
+			}
+
+			//Shadow rays traced in pixel order as the renderer shoots them, against the sorted stream of the wavefront mode (sorting included)
+			void RunRayStreamComparison(std::ostream& out, const char* sceneName, Scene& scene, uint32_t width, uint32_t height)
+			{
+				scene.Initialize();
+				scene.UpdateAccelerationStructures();
+
+				out << "**SHADOW RAY STREAM (" << sceneName << ")**\n";
+
+				const std::vector<ShadowRay> shadowRays{ CollectShadowRays(scene, scene.GetCamera(), width, height) };
+				const uint32_t lightCount{ static_cast<uint32_t>(scene.GetLights().size()) };
+
+				uint32_t pixelOrderOccluded{};
+				std::vector<Scene::OccluderHint> lastOccluders(lightCount);
+				auto start{ std::chrono::high_resolution_clock::now() };
+				for (const ShadowRay& shadowRay : shadowRays)
+				{
+					if (scene.IsOccluded(shadowRay.ray, lastOccluders[shadowRay.lightIndex]))
+						++pixelOrderOccluded;
+				}
+
+				RayStats pixelOrder{};
+				pixelOrder.rayCount = shadowRays.size();
+				pixelOrder.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+				PrintRayStats(out, "PIXEL ORDER", pixelOrder);
+
+				ShadowRayStream stream{};
+				stream.Reset(width * height, lightCount);
+				for (const ShadowRay& shadowRay : shadowRays)
+				{
+					stream.SetRay(shadowRay.pixelIndex, shadowRay.lightIndex, shadowRay.ray);
+				}
+
+				start = std::chrono::high_resolution_clock::now();
+				stream.Trace(scene, false);
+
+				RayStats sorted{};
+				sorted.rayCount = stream.GetRayCount();
+				sorted.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+				PrintRayStats(out, "SORTED STREAM", sorted);
+
+				uint32_t sortedOccluded{};
+				for (const ShadowRay& shadowRay : shadowRays)
+				{
+					if (stream.IsOccluded(shadowRay.pixelIndex, shadowRay.lightIndex))
+						++sortedOccluded;
+				}
+
+				out << "   occluded = " << pixelOrderOccluded << " / " << sortedOccluded << "\n";
+				out << ">> SPEEDUP = " << sorted.RaysPerSecond() / pixelOrder.RaysPerSecond() << "x\n";
+			}
+
+			void RunRayStreamComparisons(std::ostream& out, uint32_t width, uint32_t height)
+			{
+				Scene_W4_BunnyScene bunnyScene{};
+				RunRayStreamComparison(out, "Bunny Scene", bunnyScene, width, height);
+
+				Scene_W4_ReferenceScene referenceScene{};
+				RunRayStreamComparison(out, "Reference Scene", referenceScene, width, height);
+
+				Scene_SphereField sphereField{};
+				RunRayStreamComparison(out, "Sphere Field", sphereField, width, height);
+			}
+		}
+
+		RayStats TraceFrame(Scene& scene, uint32_t width, uint32_t height)
+		{
+			const CameraRays cameraRays{ scene.GetFrameCamera(), width, height };
+			const std::vector<Light>& lights{ scene.GetFrameLights() };
+			std::vector<Scene::OccluderHint> lastOccluders(lights.size());
+
+			RayStats stats{};
+			const auto start{ std::chrono::high_resolution_clock::now() };
+
+			for (uint32_t py{}; py < height; ++py)
+			{
+				for (uint32_t px{}; px < width; ++px)
+				{
+					const Ray viewRay{ cameraRays.GetRay(px, py) };
+
+					HitRecord closestHit{};
+					scene.GetClosestHit(viewRay, closestHit);
+					++stats.rayCount;
+
+					if (!closestHit.didHit)
+						continue;
+
+					for (size_t i{}; i < lights.size(); ++i)
+					{
+						Vector3 directionToLight{ LightUtils::GetDirectionToLight(lights[i], closestHit.origin) };
+						const float distance{ directionToLight.Normalize() };
+
+						if (Vector3::Dot(closestHit.normal, directionToLight) < 0.f)
+							continue;
+
+						scene.IsOccluded(Ray{ closestHit.origin, directionToLight, 0.0001f, distance }, lastOccluders[i]);
+						++stats.rayCount;
+					}
+				}
+			}
+
+			stats.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+			return stats;
+		}
+
+		void Run(uint32_t width, uint32_t height)
+		{
+			std::stringstream results{};
+			results << "RESOLUTION = " << width << "x" << height << " (single thread)\n";
+
+			RunMeshBVHComparison(results, width, height);
+			RunWideBVHComparison(results, width, height);
+			RunQuantizedBVHComparison(results, width, height);
+			RunCompactMeshComparison(results, width, height);
+			RunSIMDTriangleComparison(results, width, height);
+			RunCullModeComparison(results);
+			RunSpatialSplitComparison(results, width, height);
+			RunNodeOrderComparison(results, width, height);
+			RunTopLevelBVHComparison(results, width, height);
+			RunSphereBlockComparison(results, width, height);
+			RunPlaneBlockComparison(results);
+			RunCookTorrenceComparison(results);
+			RunPacketComparisons(results, width, height);
+			RunShadowRayComparisons(results, width, height);
+			RunRayStreamComparisons(results, width, height);
+			RunFrameOverlapComparison(results, width, height);
+			RunBVHUpdateComparison(results);
+			RunBVHBuildComparison(results);
+			RunLinearBVHComparison(results, width, height);
+
+			//print
+			std::cout << "**BENCHMARK FINISHED**\n" << results.str();
+
+			//file save
+			std::ofstream fileStream("benchmark_rays.txt");
+			fileStream << results.str();
+			fileStream.close();
+		}
+	}
+}
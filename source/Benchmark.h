@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+
+namespace dae
+{
+	class Scene;
+
+	namespace Benchmark
+	{
+		struct RayStats
+		{
+			uint64_t rayCount{};
+			double seconds{};
+
+			double RaysPerSecond() const { return seconds > 0.0 ? rayCount / seconds : 0.0; }
+		};
+
+		/**
+		 * \brief Traces one camera ray per pixel and a shadow ray per light for every hit, on the calling thread
+		 * \param scene initialized scene to trace
+		 * \param width horizontal resolution
+		 * \param height vertical resolution
+		 * \return number of rays traced and the time it took
+		 */
+		RayStats TraceFrame(Scene& scene, uint32_t width, uint32_t height);
+
+		//Runs every benchmark, prints the results and saves them to benchmark_rays.txt
+		void Run(uint32_t width, uint32_t height);
+	}
+}
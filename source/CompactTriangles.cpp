@@ -0,0 +1,153 @@
+#include "CompactTriangles.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace dae {
+
+	namespace
+	{
+		constexpr float GridMax{ 65535.f };
+		constexpr float NormalMax{ 32767.f };
+
+		uint16_t EncodeSnorm(float value)
+		{
+			return static_cast<uint16_t>(static_cast<int16_t>(std::lround(std::clamp(value, -1.f, 1.f) * NormalMax)));
+		}
+
+		float DecodeSnorm(uint32_t value)
+		{
+			return std::max(static_cast<int16_t>(value & 0xFFFF) / NormalMax, -1.f);
+		}
+
+		// Projects the unit sphere onto an octahedron that gets unfolded into the [-1, 1] square, the lower half folds over the diagonals
+		uint32_t EncodeOctahedral(const Vector3& normal)
+		{
+			const float length{ std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z) };
+			float x{ length > 0.f ? normal.x / length : 0.f };
+			float y{ length > 0.f ? normal.y / length : 0.f };
+
+			if (normal.z < 0.f)
+			{
+				const float foldedX{ (1.f - std::abs(y)) * (x >= 0.f ? 1.f : -1.f) };
+				const float foldedY{ (1.f - std::abs(x)) * (y >= 0.f ? 1.f : -1.f) };
+				x = foldedX;
+				y = foldedY;
+			}
+
+			return EncodeSnorm(x) | static_cast<uint32_t>(EncodeSnorm(y)) << 16;
+		}
+	}
+
+	void CompactTriangleList::Quantize(const std::vector<Vector3>& positions, const Vector3& minAABB, const Vector3& maxAABB)
+	{
+		Clear();
+		if (positions.empty())
+			return;
+
+		// A flat axis keeps a zero step, every vertex decodes to the origin on it
+		m_Origin = minAABB;
+		m_Step = (maxAABB - minAABB) / GridMax;
+
+		m_Positions.resize(positions.size() * 3);
+		for (size_t i{}; i < positions.size(); ++i)
+		{
+			for (int axis{}; axis < 3; ++axis)
+			{
+				const float cell{ m_Step[axis] > 0.f ? (positions[i][axis] - m_Origin[axis]) / m_Step[axis] : 0.f };
+				m_Positions[i * 3 + axis] = static_cast<uint16_t>(std::clamp(std::lround(cell), 0l, static_cast<long>(GridMax)));
+			}
+		}
+	}
+
+	std::vector<Vector3> CompactTriangleList::GetPositions() const
+	{
+		std::vector<Vector3> positions(m_Positions.size() / 3);
+		for (size_t i{}; i < positions.size(); ++i)
+			positions[i] = GetVertex(static_cast<uint32_t>(i));
+
+		return positions;
+	}
+
+	void CompactTriangleList::Build(const BVH& bvh, const std::vector<int>& indices, const std::vector<Vector3>& normals)
+	{
+		m_Indices16.clear();
+		m_Indices32.clear();
+		m_Normals.clear();
+
+		const std::vector<uint32_t>& references{ bvh.GetPrimitiveIndices() };
+		const bool shortIndices{ m_Positions.size() / 3 <= size_t{ UINT16_MAX } + 1 };
+		if (shortIndices)
+			m_Indices16.resize(references.size() * 3);
+		else
+			m_Indices32.resize(references.size() * 3);
+
+		for (size_t i{}; i < references.size(); ++i)
+		{
+			const size_t firstIndex{ references[i] * size_t{ 3 } };
+			for (size_t corner{}; corner < 3; ++corner)
+			{
+				if (shortIndices)
+					m_Indices16[i * 3 + corner] = static_cast<uint16_t>(indices[firstIndex + corner]);
+				else
+					m_Indices32[i * 3 + corner] = static_cast<uint32_t>(indices[firstIndex + corner]);
+			}
+		}
+
+		m_Normals.reserve(normals.size());
+		for (const Vector3& normal : normals)
+			m_Normals.push_back(EncodeOctahedral(normal));
+	}
+
+	void CompactTriangleList::Decode(const BVH& bvh, std::vector<Vector3>& positions, std::vector<int>& indices, std::vector<Vector3>& normals) const
+	{
+		positions = GetPositions();
+
+		// Back from leaf order, a triangle referenced twice writes the same corners twice
+		const std::vector<uint32_t>& references{ bvh.GetPrimitiveIndices() };
+		indices.resize(m_Normals.size() * 3);
+		for (size_t i{}; i < references.size(); ++i)
+		{
+			const size_t firstIndex{ references[i] * size_t{ 3 } };
+			for (size_t corner{}; corner < 3; ++corner)
+			{
+				indices[firstIndex + corner] = m_Indices16.empty() ? static_cast<int>(m_Indices32[i * 3 + corner]) : m_Indices16[i * 3 + corner];
+			}
+		}
+
+		normals.resize(m_Normals.size());
+		for (uint32_t i{}; i < normals.size(); ++i)
+			normals[i] = GetNormal(i);
+	}
+
+	void CompactTriangleList::Clear()
+	{
+		m_Origin = {};
+		m_Step = {};
+		m_Positions.clear();
+		m_Indices16.clear();
+		m_Indices32.clear();
+		m_Normals.clear();
+	}
+
+	size_t CompactTriangleList::GetMemoryUsage() const
+	{
+		return m_Positions.size() * sizeof(uint16_t) + m_Indices16.size() * sizeof(uint16_t) + m_Indices32.size() * sizeof(uint32_t)
+			+ m_Normals.size() * sizeof(uint32_t);
+	}
+
+	Vector3 CompactTriangleList::GetNormal(uint32_t triangleIndex) const
+	{
+		const uint32_t encoded{ m_Normals[triangleIndex] };
+		float x{ DecodeSnorm(encoded) };
+		float y{ DecodeSnorm(encoded >> 16) };
+		const float z{ 1.f - std::abs(x) - std::abs(y) };
+
+		// Unfolds the lower half, the upper half has no overlap to undo
+		const float fold{ std::max(-z, 0.f) };
+		x += x >= 0.f ? -fold : fold;
+		y += y >= 0.f ? -fold : fold;
+
+		return Vector3{ x, y, z }.Normalized();
+	}
+}
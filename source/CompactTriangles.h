@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "BVH.h"
+
+namespace dae
+{
+	//The triangles of every BVH leaf in 16-bit storage, decoded while they are tested:
+	// positions quantized to a grid over the mesh AABB, 16-bit indices when the mesh has at most 65536 vertices
+	// and octahedral encoded normals (2 x 16 bit)
+	//Triangles share their quantized vertices, so neighbours decode the exact same corners and the surface stays closed
+	class CompactTriangleList final
+	{
+	public:
+		//Snaps the vertices to the grid, the BVH has to be built over the decoded GetPositions instead of the original ones
+		void Quantize(const std::vector<Vector3>& positions, const Vector3& minAABB, const Vector3& maxAABB);
+		std::vector<Vector3> GetPositions() const;
+		//Stores the triangles in leaf order like the BVH references, call after the BVH was built over GetPositions
+		void Build(const BVH& bvh, const std::vector<int>& indices, const std::vector<Vector3>& normals);
+		//The arrays Build started from, with the quantized positions & normals, call while bvh still has the references the triangles were stored with
+		void Decode(const BVH& bvh, std::vector<Vector3>& positions, std::vector<int>& indices, std::vector<Vector3>& normals) const;
+		void Clear();
+
+		bool IsBuilt() const { return !m_Normals.empty(); }
+		size_t GetTriangleCount() const { return m_Normals.size(); }
+		size_t GetMemoryUsage() const;
+
+		//Corners of the triangle at a BVH reference
+		void GetTriangle(uint32_t reference, Vector3& v0, Vector3& v1, Vector3& v2) const
+		{
+			const size_t firstIndex{ reference * size_t{ 3 } };
+			if (m_Indices16.empty())
+			{
+				v0 = GetVertex(m_Indices32[firstIndex]);
+				v1 = GetVertex(m_Indices32[firstIndex + 1]);
+				v2 = GetVertex(m_Indices32[firstIndex + 2]);
+				return;
+			}
+
+			v0 = GetVertex(m_Indices16[firstIndex]);
+			v1 = GetVertex(m_Indices16[firstIndex + 1]);
+			v2 = GetVertex(m_Indices16[firstIndex + 2]);
+		}
+
+		//Normal of a triangle (indices / 3, not a reference), only looked up for the final hit
+		Vector3 GetNormal(uint32_t triangleIndex) const;
+
+	private:
+		Vector3 GetVertex(uint32_t vertex) const
+		{
+			const uint16_t* pPosition{ &m_Positions[vertex * size_t{ 3 }] };
+			return { m_Origin.x + pPosition[0] * m_Step.x, m_Origin.y + pPosition[1] * m_Step.y, m_Origin.z + pPosition[2] * m_Step.z };
+		}
+
+		Vector3 m_Origin{};
+		Vector3 m_Step{};
+
+		std::vector<uint16_t> m_Positions{}; // x, y, z per vertex
+		// 3 per BVH reference, only one of them is used
+		std::vector<uint16_t> m_Indices16{};
+		std::vector<uint32_t> m_Indices32{};
+		std::vector<uint32_t> m_Normals{}; // Per triangle, x in the low & y in the high 16 bits
+	};
+}
@@ -2,6 +2,14 @@
 #include <cassert>
 
 #include "Math.h"
+#include "BVH.h"
+#include "CompactTriangles.h"
+#include "PlaneBlock.h"
+#include "QuantizedBVH.h"
+#include "SIMD.h"
+#include "SphereBlock.h"
+#include "TriangleBlock.h"
+#include "WideBVH.h"
 #include "vector"
 #include <iostream>
 
@@ -57,6 +65,25 @@ namespace dae
 		unsigned char materialIndex{};
 	};
 
+	//Render-ready copy of a mesh triangle: the edges are subtracted once and nothing has to be gathered through the indices
+	struct TriangleRecord
+	{
+		Vector3 v0{};
+		Vector3 edge1{}; // v1 - v0
+		Vector3 edge2{}; // v2 - v0
+		uint32_t triangleIndex{}; // Into indices / 3 & normals, only looked up for the final hit
+	};
+
+	//Where a mesh is placed in one frame, everything a query reads from a mesh besides its object space geometry
+	struct MeshInstance
+	{
+		Matrix worldToObject{};
+		// Turns the object space normals, like TriangleMesh::rotationTransform
+		Matrix rotationTransform{};
+		Vector3 transformedMinAABB{};
+		Vector3 transformedMaxAABB{};
+	};
+
 	struct TriangleMesh
 	{
 		TriangleMesh() = default;
@@ -95,10 +122,36 @@ namespace dae
 		Vector3 transformedMinAABB{};
 		Vector3 transformedMaxAABB{};
 
-
-		std::vector<Vector3> transformedPositions{};
-		std::vector<Vector3> transformedNormals{};
-
+		// The vertices are never transformed, rays are brought into object space instead
+		Matrix objectToWorld{};
+		Matrix worldToObject{};
+
+		// Built over the object space positions, only has to follow UpdateGeometry
+		BVH bvh{};
+		bool useBVH{ true };
+		// Refit the BVH in UpdateGeometry instead of rebuilding it, it still gets rebuilt once the refitted tree degrades too far
+		// Only the Binary layout keeps the nodes a refit needs, the others rebuild every time
+		bool refitBVH{ true };
+		// Wide8 collapses the binary BVH into 8-wide nodes that are slab tested with SIMD, Quantized halves the node size
+		// Only the tree of the selected layout stays resident, the binary nodes are released for the other two
+		BVHLayout bvhLayout{ BVHLayout::Binary };
+		WideBVH wideBVH{};
+		QuantizedBVH quantizedBVH{};
+		// One record per BVH leaf reference, in leaf order, every layout indexes it with its position in the leaf list
+		std::vector<TriangleRecord> triangleRecords{};
+		// Leaves tested 8 triangles at a time instead, replaces the records when the CPU has AVX2
+		// The BVH is then built with leaves of up to 8 triangles that each start a block of their own
+		TriangleBlockList triangleBlocks{};
+		bool useSIMDTriangles{ true };
+		// 16-bit vertices, indices & normals decoded in the leaf test instead, for huge meshes, the BVH bounds the quantized vertices then
+		// UpdateGeometry frees positions, normals & indices once they are stored, later rebuilds decode them again (quantized)
+		CompactTriangleList compactTriangles{};
+		bool useCompactStorage{ false };
+
+		MeshInstance GetInstance() const
+		{
+			return { worldToObject, rotationTransform, transformedMinAABB, transformedMaxAABB };
+		}
 
 		void Translate(const Vector3& translation)
 		{
@@ -161,29 +214,140 @@ namespace dae
 
 		void UpdateTransforms()
 		{
+			// Geometry that was never uploaded, or changed its triangle count, still needs its AABB & BVH
+			if (!bvh.IsBuilt() || bvh.GetPrimitiveCount() != GetTriangleCount())
+				UpdateGeometry();
+
 			//Calculate Final Transform 
 			// First scale, then rotate, then translate
-			const auto finalTransform = scaleTransform * rotationTransform * translationTransform;
+			objectToWorld = scaleTransform * rotationTransform * translationTransform;
+			worldToObject = Matrix::Inverse(objectToWorld);
 
-			// Loop over every position & apply the transformation
-			transformedPositions.clear();
-			transformedPositions.reserve(positions.size());
-			for (const Vector3& p : positions)
+			UpdateTransformedAABB(objectToWorld);
+		}
+
+		//Call after editing positions or indices (deforming meshes), rigid motion only needs UpdateTransforms
+		//Compact meshes have no arrays left to edit, they can only be rebuilt (layout or build mode changes) or turned back into full storage
+		void UpdateGeometry()
+		{
+			// Decoded before the BVH changes, the compact indices are stored in the order of its references
+			if (positions.empty() && compactTriangles.IsBuilt())
+				compactTriangles.Decode(bvh, positions, indices, normals);
+
+			UpdateAABB();
+
+			if (useCompactStorage)
+			{
+				// Quantized vertices can round just past the box, grow it so the mesh bounds still hold them
+				compactTriangles.Quantize(positions, minAABB, maxAABB);
+				const std::vector<Vector3> quantizedPositions{ compactTriangles.GetPositions() };
+				for (const Vector3& p : quantizedPositions)
+				{
+					minAABB = Vector3::Min(minAABB, p);
+					maxAABB = Vector3::Max(maxAABB, p);
+				}
+				UpdateBVH(quantizedPositions);
+			}
+			else
 			{
-				transformedPositions.emplace_back(finalTransform.TransformPoint(p));
+				compactTriangles.Clear();
+				UpdateBVH(positions);
 			}
 
+			if (bvhLayout == BVHLayout::Wide8)
+				wideBVH.Build(bvh);
+			else
+				wideBVH.Clear();
+
+			if (bvhLayout == BVHLayout::Quantized)
+				quantizedBVH.Build(bvh);
+			else
+				quantizedBVH.Clear();
+
+			UpdateTriangleRecords();
+
+			// The other layouts only traverse their own nodes, the leaves were grouped above so just the primitive order stays
+			if (bvhLayout != BVHLayout::Binary)
+				bvh.ReleaseNodes();
 
-			//Transform Normals (normals > transformedNormals)
-			//...
-			transformedNormals.clear();
-			transformedNormals.reserve(normals.size());
-			for (const Vector3& n : normals)
+			// Only the 16-bit data is traced, the full size arrays & the build data of the BVH would otherwise stay resident next to it
+			if (useCompactStorage)
 			{
-				transformedNormals.emplace_back(rotationTransform.TransformVector(n));
+				std::vector<Vector3>{}.swap(positions);
+				std::vector<Vector3>{}.swap(normals);
+				std::vector<int>{}.swap(indices);
+				bvh.ReleaseBuildData();
 			}
+		}
 
-			UpdateTransformedAABB(finalTransform);
+		size_t GetTriangleCount() const
+		{
+			return compactTriangles.IsBuilt() ? compactTriangles.GetTriangleCount() : indices.size() / 3;
+		}
+
+		//Everything the mesh keeps allocated: the arrays, every BVH layout with the build data & the leaf storage
+		size_t GetMemoryUsage() const
+		{
+			return positions.size() * sizeof(Vector3) + normals.size() * sizeof(Vector3) + indices.size() * sizeof(int)
+				+ bvh.GetMemoryUsage() + bvh.GetBuildDataMemoryUsage() + wideBVH.GetMemoryUsage() + quantizedBVH.GetMemoryUsage()
+				+ triangleRecords.size() * sizeof(TriangleRecord) + triangleBlocks.GetMemoryUsage() + compactTriangles.GetMemoryUsage();
+		}
+
+		void UpdateBVH(const std::vector<Vector3>& bvhPositions)
+		{
+			// A refit keeps the old leaves, so switching to or from the triangle blocks needs a full build
+			const uint32_t leafSize{ UseTriangleBlocks() ? TriangleBlock::Width : 1 };
+			const bool leavesChanged{ leafSize != bvh.GetLeafSize() };
+			bvh.SetLeafSize(leafSize);
+			bvh.SetLeafAlignment(leafSize);
+
+			if (refitBVH && !leavesChanged)
+				bvh.Update(bvhPositions, indices);
+			else
+				bvh.Build(bvhPositions, indices);
+		}
+
+		bool UseTriangleBlocks() const
+		{
+			return useSIMDTriangles && !useCompactStorage && SIMD::HasAVX2();
+		}
+
+		//The records are in object space like the BVH, so rigid motion never touches them
+		//Walks the binary leaves, UpdateGeometry calls it before those can be released
+		void UpdateTriangleRecords()
+		{
+			// The vertices were quantized by UpdateGeometry
+			if (useCompactStorage)
+			{
+				compactTriangles.Build(bvh, indices, normals);
+				triangleBlocks.Clear();
+				triangleRecords.clear();
+				return;
+			}
+
+			if (UseTriangleBlocks())
+			{
+				triangleBlocks.Build(bvh, positions, indices);
+				triangleRecords.clear();
+				return;
+			}
+
+			triangleBlocks.Clear();
+
+			const std::vector<uint32_t>& references{ bvh.GetPrimitiveIndices() };
+			triangleRecords.resize(references.size());
+
+			for (size_t i{}; i < references.size(); ++i)
+			{
+				const size_t firstIndex{ references[i] * size_t{ 3 } };
+				const Vector3& v0{ positions[indices[firstIndex]] };
+
+				TriangleRecord& record{ triangleRecords[i] };
+				record.v0 = v0;
+				record.edge1 = positions[indices[firstIndex + 1]] - v0;
+				record.edge2 = positions[indices[firstIndex + 2]] - v0;
+				record.triangleIndex = references[i];
+			}
 		}
 
 		void UpdateAABB()
@@ -203,31 +367,20 @@ namespace dae
 
 		void UpdateTransformedAABB(const Matrix& finalTransform)
 		{
-			// Instead of transforming every position, we can use the min/max AABB to calculate the transformed AAB		
-
-			Vector3 tMinAABB = finalTransform.TransformPoint(minAABB);
-			Vector3 tMaxAABB = tMinAABB;
-			Vector3 tAABB = finalTransform.TransformPoint(maxAABB.x, minAABB.y, minAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
-			tAABB = finalTransform.TransformPoint(maxAABB.x, minAABB.y, maxAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
-			tAABB = finalTransform.TransformPoint(minAABB.x, minAABB.y, maxAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
-			tAABB = finalTransform.TransformPoint(minAABB.x, maxAABB.y, minAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
-			tAABB = finalTransform.TransformPoint(maxAABB.x, maxAABB.y, minAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
-			tAABB = finalTransform.TransformPoint(maxAABB);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
-			tAABB = finalTransform.TransformPoint(minAABB.x, maxAABB.y, minAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
+			// Instead of transforming every position, we can use the min/max AABB to calculate the transformed AABB
+			// Transform all 8 corners, a rotated box can have its extremes in any of them
+			Vector3 tMinAABB{ FLT_MAX, FLT_MAX, FLT_MAX };
+			Vector3 tMaxAABB{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+			for (int corner{}; corner < 8; ++corner)
+			{
+				const Vector3 tAABB = finalTransform.TransformPoint(
+					(corner & 1) ? maxAABB.x : minAABB.x,
+					(corner & 2) ? maxAABB.y : minAABB.y,
+					(corner & 4) ? maxAABB.z : minAABB.z);
+
+				tMinAABB = Vector3::Min(tAABB, tMinAABB);
+				tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
+			}
 			transformedMinAABB = tMinAABB;
 			transformedMaxAABB = tMaxAABB;
 		}
@@ -251,13 +404,30 @@ namespace dae
 	};
 #pragma endregion
 #pragma region MISC
+	//The reciprocal direction & its signs are computed once here, so slab tests against boxes only multiply
+	//Build a new ray instead of changing the direction of an existing one, they would go out of sync
 	struct Ray
 	{
+		Ray() = default;
+		Ray(const Vector3& origin, const Vector3& direction, float min = 0.0001f, float max = FLT_MAX)
+			: origin{ origin }
+			, direction{ direction }
+			, min{ min }
+			, max{ max }
+			, invDirection{ SafeReciprocal(direction.x), SafeReciprocal(direction.y), SafeReciprocal(direction.z) }
+			, sign{ invDirection.x < 0.f, invDirection.y < 0.f, invDirection.z < 0.f }
+		{
+		}
+
 		Vector3 origin{};
 		Vector3 direction{};
 
 		float min{ 0.0001f };
 		float max{ FLT_MAX };
+
+		Vector3 invDirection{};
+		// 1 when the direction points down the axis, picks the box plane the ray enters through
+		uint8_t sign[3]{};
 	};
 
 	struct HitRecord
@@ -1,44 +1,23 @@
 #pragma once
+#include <variant>
+
 #include "Math.h"
 #include "DataTypes.h"
 #include "BRDFs.h"
 
 namespace dae
 {
-#pragma region Material BASE
-	class Material
-	{
-	public:
-		Material() = default;
-		virtual ~Material() = default;
-
-		Material(const Material&) = delete;
-		Material(Material&&) noexcept = delete;
-		Material& operator=(const Material&) = delete;
-		Material& operator=(Material&&) noexcept = delete;
-
-		/**
-		 * \brief Function used to calculate the correct color for the specific material and its parameters
-		 * \param hitRecord current hitrecord
-		 * \param l light direction
-		 * \param v view direction
-		 * \return color
-		 */
-		virtual ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) = 0;
-	};
-#pragma endregion
-
 #pragma region Material SOLID COLOR
 	//SOLID COLOR
 	//===========
-	class Material_SolidColor final : public Material
+	class Material_SolidColor final
 	{
 	public:
 		Material_SolidColor(const ColorRGB& color): m_Color(color)
 		{
 		}
 
-		ColorRGB Shade(const HitRecord& hitRecord, const Vector3& l, const Vector3& v) override
+		ColorRGB Shade(const HitRecord& hitRecord, const Vector3& l, const Vector3& v) const
 		{
 			return m_Color;
 		}
@@ -51,13 +30,13 @@ namespace dae
 #pragma region Material LAMBERT
 	//LAMBERT
 	//=======
-	class Material_Lambert final : public Material
+	class Material_Lambert final
 	{
 	public:
 		Material_Lambert(const ColorRGB& diffuseColor, float diffuseReflectance) :
 			m_DiffuseColor(diffuseColor), m_DiffuseReflectance(diffuseReflectance){}
 
-		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
+		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) const
 		{
 			//todo: W3
 			return BRDF::Lambert(m_DiffuseReflectance, m_DiffuseColor);
@@ -72,7 +51,7 @@ namespace dae
 #pragma region Material LAMBERT PHONG
 	//LAMBERT-PHONG
 	//=============
-	class Material_LambertPhong final : public Material
+	class Material_LambertPhong final
 	{
 	public:
 		Material_LambertPhong(const ColorRGB& diffuseColor, float kd, float ks, float phongExponent):
@@ -81,7 +60,7 @@ namespace dae
 		{
 		}
 
-		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
+		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) const
 		{
 			//todo: W3
 			return BRDF::Lambert(m_DiffuseReflectance, m_DiffuseColor)
@@ -98,15 +77,19 @@ namespace dae
 
 #pragma region Material COOK TORRENCE
 	//COOK TORRENCE
-	class Material_CookTorrence final : public Material
+	class Material_CookTorrence final
 	{
 	public:
 		Material_CookTorrence(const ColorRGB& albedo, float metalness, float roughness):
-			m_Albedo(albedo), m_Metalness(metalness), m_Roughness(roughness)
+			m_Albedo(albedo), m_Metalness(metalness), m_Roughness(roughness),
+			m_Constants(BRDF::GetCookTorrenceConstants(albedo, metalness, roughness))
 		{
 		}
 
-		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
+		//For shading 8 samples at once with BRDF::CookTorrence_x8
+		const BRDF::CookTorrenceConstants& GetConstants() const { return m_Constants; }
+
+		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) const
 		{
 			//todo: W3
 
@@ -142,6 +125,31 @@ namespace dae
 		ColorRGB m_Albedo{0.955f, 0.637f, 0.538f}; //Copper
 		float m_Metalness{1.0f};
 		float m_Roughness{0.1f}; // [1.0 > 0.0] >> [ROUGH > SMOOTH]
+		BRDF::CookTorrenceConstants m_Constants{};
 	};
 #pragma endregion
+
+#pragma region Material CLOSED SET
+	//Every material a scene can use, stored by value so the materials of a scene sit in one contiguous array
+	using Material = std::variant<Material_SolidColor, Material_Lambert, Material_LambertPhong, Material_CookTorrence>;
+
+	/**
+	 * \brief Shades with whichever material is stored, the type is tested directly so every kernel is inlined (no vtable)
+	 * \param material material of the hit
+	 * \param hitRecord current hitrecord
+	 * \param l light direction
+	 * \param v view direction
+	 * \return color
+	 */
+	template<size_t TypeIndex = 0>
+	ColorRGB Shade(const Material& material, const HitRecord& hitRecord, const Vector3& l, const Vector3& v)
+	{
+		if constexpr (TypeIndex + 1 < std::variant_size_v<Material>)
+		{
+			if (material.index() != TypeIndex)
+				return Shade<TypeIndex + 1>(material, hitRecord, l, v);
+		}
+		return std::get_if<TypeIndex>(&material)->Shade(hitRecord, l, v);
+	}
+#pragma endregion
 }
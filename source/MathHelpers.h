@@ -1,4 +1,5 @@
 #pragma once
+#include <cfloat>
 #include <cmath>
 
 namespace dae
@@ -23,6 +24,13 @@ namespace dae
 		return ((1 - factor) * a) + (factor * b);
 	}
 
+	//1 / a, where zero (and denormals) become the smallest normal float of the same sign
+	//The result stays finite, so multiplying it with 0 gives 0 instead of NaN
+	inline float SafeReciprocal(float a)
+	{
+		return 1.f / (std::abs(a) >= FLT_MIN ? a : std::copysign(FLT_MIN, a));
+	}
+
 	inline bool AreEqual(float a, float b, float epsilon = FLT_EPSILON)
 	{
 		return abs(a - b) < epsilon;
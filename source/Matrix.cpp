@@ -82,6 +82,42 @@ namespace dae {
 		return out;
 	}
 
+	const Matrix& Matrix::Inverse()
+	{
+		// Affine transforms only (last column 0,0,0,1): invert the 3x3 part, then move the translation through it
+		const Vector3 a{ data[0] };
+		const Vector3 b{ data[1] };
+		const Vector3 c{ data[2] };
+		const Vector3 t{ data[3] };
+
+		const Vector3 bc{ Vector3::Cross(b, c) };
+		const Vector3 ca{ Vector3::Cross(c, a) };
+		const Vector3 ab{ Vector3::Cross(a, b) };
+
+		const float determinant{ Vector3::Dot(a, bc) };
+		assert(!AreEqual(determinant, 0.f) && "Matrix has no inverse");
+		const float invDeterminant{ 1.f / determinant };
+
+		const Vector3 x{ Vector3{ bc.x, ca.x, ab.x } * invDeterminant };
+		const Vector3 y{ Vector3{ bc.y, ca.y, ab.y } * invDeterminant };
+		const Vector3 z{ Vector3{ bc.z, ca.z, ab.z } * invDeterminant };
+
+		data[0] = { x, 0 };
+		data[1] = { y, 0 };
+		data[2] = { z, 0 };
+		data[3] = { -(x * t.x + y * t.y + z * t.z), 1 };
+
+		return *this;
+	}
+
+	Matrix Matrix::Inverse(const Matrix& m)
+	{
+		Matrix out{ m };
+		out.Inverse();
+
+		return out;
+	}
+
 	Vector3 Matrix::GetAxisX() const
 	{
 		return data[0];
@@ -0,0 +1,96 @@
+#include "PlaneBlock.h"
+
+#include "DataTypes.h"
+#include "SIMD.h"
+
+namespace dae {
+
+	namespace
+	{
+		// Same operations in the same order as IntersectPlane, so every lane matches the scalar test
+		DAE_AVX2_EXACT_FUNCTION float Intersect_AVX2(const PlaneBlock& block, const Ray& ray, uint32_t& lane)
+		{
+			const __m256 normalX{ _mm256_load_ps(block.normalX) };
+			const __m256 normalY{ _mm256_load_ps(block.normalY) };
+			const __m256 normalZ{ _mm256_load_ps(block.normalZ) };
+
+			const __m256 dotProduct{ _mm256_add_ps(_mm256_add_ps(
+				_mm256_mul_ps(_mm256_set1_ps(ray.direction.x), normalX),
+				_mm256_mul_ps(_mm256_set1_ps(ray.direction.y), normalY)),
+				_mm256_mul_ps(_mm256_set1_ps(ray.direction.z), normalZ)) };
+			__m256 valid{ _mm256_cmp_ps(dotProduct, _mm256_setzero_ps(), _CMP_LT_OQ) };
+			if (_mm256_movemask_ps(valid) == 0)
+				return FLT_MAX;
+
+			const __m256 offsetX{ _mm256_sub_ps(_mm256_load_ps(block.originX), _mm256_set1_ps(ray.origin.x)) };
+			const __m256 offsetY{ _mm256_sub_ps(_mm256_load_ps(block.originY), _mm256_set1_ps(ray.origin.y)) };
+			const __m256 offsetZ{ _mm256_sub_ps(_mm256_load_ps(block.originZ), _mm256_set1_ps(ray.origin.z)) };
+			const __m256 distance{ _mm256_add_ps(_mm256_add_ps(
+				_mm256_mul_ps(offsetX, normalX),
+				_mm256_mul_ps(offsetY, normalY)),
+				_mm256_mul_ps(offsetZ, normalZ)) };
+
+			const __m256 t{ _mm256_div_ps(distance, dotProduct) };
+			valid = _mm256_and_ps(valid, _mm256_and_ps(
+				_mm256_cmp_ps(t, _mm256_set1_ps(ray.min), _CMP_GE_OQ),
+				_mm256_cmp_ps(t, _mm256_set1_ps(ray.max), _CMP_LE_OQ)));
+
+			return SIMD::NearestLane(t, valid, lane);
+		}
+
+		float Intersect_Scalar(const PlaneBlock& block, const Ray& ray, uint32_t& lane)
+		{
+			float nearestT{ FLT_MAX };
+			for (uint32_t i{}; i < PlaneBlock::Width; ++i)
+			{
+				const Vector3 normal{ block.normalX[i], block.normalY[i], block.normalZ[i] };
+				const float dotProduct{ Vector3::Dot(ray.direction, normal) };
+				if (dotProduct >= 0.f)
+					continue;
+
+				const Vector3 offset{ block.originX[i] - ray.origin.x, block.originY[i] - ray.origin.y, block.originZ[i] - ray.origin.z };
+				const float t{ Vector3::Dot(offset, normal) / dotProduct };
+				if (t >= ray.min && t <= ray.max && t < nearestT)
+				{
+					nearestT = t;
+					lane = i;
+				}
+			}
+			return nearestT;
+		}
+	}
+
+	void PlaneBlockList::Build(const std::vector<Plane>& planes)
+	{
+		Clear();
+		m_Blocks.resize((planes.size() + PlaneBlock::Width - 1) / PlaneBlock::Width);
+
+		for (size_t i{}; i < planes.size(); ++i)
+		{
+			const Plane& plane{ planes[i] };
+			const size_t lane{ i % PlaneBlock::Width };
+
+			PlaneBlock& block{ m_Blocks[i / PlaneBlock::Width] };
+			block.originX[lane] = plane.origin.x;
+			block.originY[lane] = plane.origin.y;
+			block.originZ[lane] = plane.origin.z;
+			block.normalX[lane] = plane.normal.x;
+			block.normalY[lane] = plane.normal.y;
+			block.normalZ[lane] = plane.normal.z;
+			block.materialIndex[lane] = plane.materialIndex;
+		}
+	}
+
+	void PlaneBlockList::Clear()
+	{
+		m_Blocks.clear();
+	}
+
+	float PlaneBlockList::Intersect(const PlaneBlock& block, const Ray& ray, uint32_t& lane)
+	{
+		if (SIMD::HasAVX2())
+			return Intersect_AVX2(block, ray, lane);
+
+		return Intersect_Scalar(block, ray, lane);
+	}
+}
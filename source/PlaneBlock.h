@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace dae
+{
+	struct Ray;
+	struct Plane;
+
+	// 8 planes stored SoA, every ray tests all of them in a single AVX2 pass (224 bytes)
+	// Unused lanes keep a zero normal, a ray is never in front of it
+	struct alignas(32) PlaneBlock
+	{
+		static constexpr uint32_t Width{ 8 };
+
+		float originX[Width]{};
+		float originY[Width]{};
+		float originZ[Width]{};
+		float normalX[Width]{};
+		float normalY[Width]{};
+		float normalZ[Width]{};
+
+		unsigned char materialIndex[Width]{};
+	};
+
+	//The planes of the scene packed in their original order, plane i is lane i % 8 of block i / 8
+	//Planes are unbounded, so they stay out of the top-level BVH and every ray streams through all blocks
+	class PlaneBlockList final
+	{
+	public:
+		void Build(const std::vector<Plane>& planes);
+		void Clear();
+
+		bool IsBuilt() const { return !m_Blocks.empty(); }
+		const std::vector<PlaneBlock>& GetBlocks() const { return m_Blocks; }
+
+		/**
+		 * \brief Ray against all 8 planes of the block at once, falls back to one lane at a time without AVX2
+		 * Only the front side of a plane is hit, like GeometryUtils::IntersectPlane
+		 * \param lane receives the lane of the nearest hit
+		 * \return distance to the nearest hit between ray.min and ray.max, FLT_MAX when no lane was hit
+		 */
+		static float Intersect(const PlaneBlock& block, const Ray& ray, uint32_t& lane);
+
+	private:
+		std::vector<PlaneBlock> m_Blocks{};
+	};
+}
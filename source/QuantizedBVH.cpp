@@ -0,0 +1,88 @@
+#include "QuantizedBVH.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace dae {
+
+	namespace
+	{
+		// Rounds down for the min side, rounds up for the max side, then fixes up float rounding so the decoded box never shrinks
+		void QuantizeBounds(const Vector3& min, const Vector3& max, const Vector3& frameMin, const Vector3& frameStep, uint8_t* quantized)
+		{
+			for (int axis{}; axis < 3; ++axis)
+			{
+				if (frameStep[axis] <= 0.f)
+				{
+					quantized[axis] = 0;
+					quantized[axis + 3] = 0;
+					continue;
+				}
+
+				int low{ static_cast<int>(std::floor((min[axis] - frameMin[axis]) / frameStep[axis])) };
+				int high{ static_cast<int>(std::ceil((max[axis] - frameMin[axis]) / frameStep[axis])) };
+				low = std::clamp(low, 0, 255);
+				high = std::clamp(high, 0, 255);
+
+				while (low > 0 && frameMin[axis] + low * frameStep[axis] > min[axis])
+					--low;
+				while (high < 255 && frameMin[axis] + high * frameStep[axis] < max[axis])
+					++high;
+
+				quantized[axis] = static_cast<uint8_t>(low);
+				quantized[axis + 3] = static_cast<uint8_t>(high);
+			}
+		}
+	}
+
+	void QuantizedBVH::Build(const BVH& bvh)
+	{
+		Clear();
+		if (!bvh.HasNodes())
+			return;
+
+		// Same topology & node order as the binary tree, only the encoding changes
+		m_Nodes.resize(bvh.GetNodes().size());
+		m_RootBounds = bvh.GetBounds();
+
+		QuantizeNode(bvh, 0, m_RootBounds.min, m_RootBounds.max);
+	}
+
+	void QuantizedBVH::Clear()
+	{
+		m_Nodes.clear();
+		m_RootBounds = {};
+	}
+
+	void QuantizedBVH::QuantizeNode(const BVH& bvh, uint32_t nodeIndex, const Vector3& frameMin, const Vector3& frameMax)
+	{
+		// The nodes were allocated up front, so this reference survives the recursion
+		const BVHNode& node{ bvh.GetNodes()[nodeIndex] };
+		QuantizedBVHNode& quantizedNode{ m_Nodes[nodeIndex] };
+
+		if (node.IsLeaf())
+		{
+			quantizedNode.leftFirst = node.leftFirst | QuantizedBVHNode::LeafFlag;
+			std::memcpy(quantizedNode.childBounds, &node.primitiveCount, sizeof(node.primitiveCount));
+			return;
+		}
+
+		quantizedNode.leftFirst = node.leftFirst;
+
+		// Every child is encoded in the decoded box of its parent, not the original one, so errors never add up
+		const Vector3 frameStep{ QuantizedBVHNode::GetFrameStep(frameMin, frameMax) };
+		for (uint32_t child{}; child < 2; ++child)
+		{
+			const BVHNode& childNode{ bvh.GetNodes()[node.leftFirst + child] };
+			QuantizeBounds(childNode.minAABB, childNode.maxAABB, frameMin, frameStep, quantizedNode.childBounds[child]);
+		}
+
+		for (uint32_t child{}; child < 2; ++child)
+		{
+			Vector3 childMin{};
+			Vector3 childMax{};
+			QuantizedBVHNode::DecodeBounds(quantizedNode.childBounds[child], frameMin, frameStep, childMin, childMax);
+			QuantizeNode(bvh, node.leftFirst + child, childMin, childMax);
+		}
+	}
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "BVH.h"
+
+namespace dae
+{
+	// 16 bytes instead of 32, the child boxes are stored as 8-bit steps inside the box of their parent
+	struct QuantizedBVHNode
+	{
+		static constexpr uint32_t LeafFlag{ 0x80000000u };
+		static constexpr float Steps{ 255.f };
+
+		// Interior: min xyz then max xyz of the left & right child, relative to the (dequantized) box of this node
+		// Leaf: unused as bounds, the first 4 bytes hold the primitive count
+		uint8_t childBounds[2][6]{};
+		uint32_t leftFirst{}; // Interior: index of the left child (right child = left + 1), Leaf: first entry in the primitive index list | LeafFlag
+
+		bool IsLeaf() const { return (leftFirst & LeafFlag) != 0; }
+		uint32_t GetIndex() const { return leftFirst & ~LeafFlag; }
+		uint32_t GetPrimitiveCount() const
+		{
+			uint32_t primitiveCount{};
+			std::memcpy(&primitiveCount, childBounds, sizeof(primitiveCount));
+			return primitiveCount;
+		}
+
+		// The same expression is used to build & traverse, so the decoded boxes match exactly
+		static void DecodeBounds(const uint8_t* quantized, const Vector3& frameMin, const Vector3& frameStep, Vector3& min, Vector3& max)
+		{
+			min = { frameMin.x + quantized[0] * frameStep.x, frameMin.y + quantized[1] * frameStep.y, frameMin.z + quantized[2] * frameStep.z };
+			max = { frameMin.x + quantized[3] * frameStep.x, frameMin.y + quantized[4] * frameStep.y, frameMin.z + quantized[5] * frameStep.z };
+		}
+
+		// Slightly bigger than extent / 255, so the last step still reaches the max of the frame after float rounding
+		static Vector3 GetFrameStep(const Vector3& frameMin, const Vector3& frameMax)
+		{
+			return (frameMax - frameMin) * (1.0001f / Steps);
+		}
+	};
+
+	//Compressed copy of a binary BVH, only the root box is stored in full precision, leaves index the primitive order of that binary BVH
+	//The decoded boxes are conservative: they always contain the original node
+	class QuantizedBVH final
+	{
+	public:
+		void Build(const BVH& bvh);
+		void Clear();
+
+		bool IsBuilt() const { return !m_Nodes.empty(); }
+
+		const std::vector<QuantizedBVHNode>& GetNodes() const { return m_Nodes; }
+		const AABB& GetRootBounds() const { return m_RootBounds; }
+		size_t GetMemoryUsage() const { return m_Nodes.size() * sizeof(QuantizedBVHNode); }
+
+	private:
+		void QuantizeNode(const BVH& bvh, uint32_t nodeIndex, const Vector3& frameMin, const Vector3& frameMax);
+
+		std::vector<QuantizedBVHNode> m_Nodes{};
+		AABB m_RootBounds{};
+	};
+}
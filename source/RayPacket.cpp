@@ -0,0 +1,196 @@
+#include "RayPacket.h"
+
+#include <algorithm>
+#include <bit>
+
+#include "Camera.h"
+#include "DataTypes.h"
+#include "Matrix.h"
+#include "SIMD.h"
+
+namespace dae {
+
+	namespace
+	{
+		// Camera ray through a point of the screen in pixel coordinates, the same formula as Renderer::RenderPixel
+		Vector3 GetViewDirection(const Camera& camera, float rx, float ry, uint32_t width, uint32_t height, float aspectRatio, float fov)
+		{
+			const float cx{ (2 * rx / float(width) - 1) * aspectRatio * fov };
+			const float cy{ (1 - 2 * (ry / float(height))) * fov };
+			return cx * camera.right + cy * camera.up + 1.0f * camera.forward;
+		}
+
+		uint64_t IntersectAABB_Scalar(const RayPacket& packet, const Vector3& minAABB, const Vector3& maxAABB, uint64_t rayMask)
+		{
+			const Vector3 minOffset{ minAABB - packet.origin };
+			const Vector3 maxOffset{ maxAABB - packet.origin };
+
+			uint64_t hitMask{};
+			for (uint64_t remaining{ rayMask }; remaining != 0; remaining &= remaining - 1)
+			{
+				const uint32_t i{ static_cast<uint32_t>(std::countr_zero(remaining)) };
+
+				const float tx1{ minOffset.x * packet.invDirectionX[i] };
+				const float tx2{ maxOffset.x * packet.invDirectionX[i] };
+				const float ty1{ minOffset.y * packet.invDirectionY[i] };
+				const float ty2{ maxOffset.y * packet.invDirectionY[i] };
+				const float tz1{ minOffset.z * packet.invDirectionZ[i] };
+				const float tz2{ maxOffset.z * packet.invDirectionZ[i] };
+
+				const float tNear{ std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::max(std::min(tz1, tz2), packet.min)) };
+				const float tFar{ std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::min(std::max(tz1, tz2), packet.max[i])) };
+
+				if (tNear <= tFar)
+					hitMask |= uint64_t{ 1 } << i;
+			}
+			return hitMask;
+		}
+
+		DAE_AVX2_FUNCTION uint64_t IntersectAABB_AVX2(const RayPacket& packet, const Vector3& minAABB, const Vector3& maxAABB, uint64_t rayMask)
+		{
+			// The origin is shared, so the offsets to the box planes are the same for every ray
+			const __m256 minOffsetX{ _mm256_set1_ps(minAABB.x - packet.origin.x) };
+			const __m256 minOffsetY{ _mm256_set1_ps(minAABB.y - packet.origin.y) };
+			const __m256 minOffsetZ{ _mm256_set1_ps(minAABB.z - packet.origin.z) };
+			const __m256 maxOffsetX{ _mm256_set1_ps(maxAABB.x - packet.origin.x) };
+			const __m256 maxOffsetY{ _mm256_set1_ps(maxAABB.y - packet.origin.y) };
+			const __m256 maxOffsetZ{ _mm256_set1_ps(maxAABB.z - packet.origin.z) };
+			const __m256 tMin{ _mm256_set1_ps(packet.min) };
+
+			uint64_t hitMask{};
+			for (uint32_t first{}; first < RayPacket::RayCount; first += 8)
+			{
+				const uint64_t laneMask{ (rayMask >> first) & 0xFF };
+				if (laneMask == 0)
+					continue;
+
+				const __m256 invDirectionX{ _mm256_load_ps(packet.invDirectionX + first) };
+				const __m256 invDirectionY{ _mm256_load_ps(packet.invDirectionY + first) };
+				const __m256 invDirectionZ{ _mm256_load_ps(packet.invDirectionZ + first) };
+
+				const __m256 tx1{ _mm256_mul_ps(minOffsetX, invDirectionX) };
+				const __m256 tx2{ _mm256_mul_ps(maxOffsetX, invDirectionX) };
+				const __m256 ty1{ _mm256_mul_ps(minOffsetY, invDirectionY) };
+				const __m256 ty2{ _mm256_mul_ps(maxOffsetY, invDirectionY) };
+				const __m256 tz1{ _mm256_mul_ps(minOffsetZ, invDirectionZ) };
+				const __m256 tz2{ _mm256_mul_ps(maxOffsetZ, invDirectionZ) };
+
+				const __m256 tNear{ _mm256_max_ps(
+					_mm256_max_ps(_mm256_min_ps(tx1, tx2), _mm256_min_ps(ty1, ty2)),
+					_mm256_max_ps(_mm256_min_ps(tz1, tz2), tMin)) };
+				const __m256 tFar{ _mm256_min_ps(
+					_mm256_min_ps(_mm256_max_ps(tx1, tx2), _mm256_max_ps(ty1, ty2)),
+					_mm256_min_ps(_mm256_max_ps(tz1, tz2), _mm256_load_ps(packet.max + first))) };
+
+				const uint64_t laneHits{ static_cast<uint64_t>(_mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ))) };
+				hitMask |= (laneHits & laneMask) << first;
+			}
+			return hitMask;
+		}
+	}
+
+	void Frustum::Build(const Vector3* pCorners)
+	{
+		const Vector3 center{ pCorners[0] + pCorners[1] + pCorners[2] + pCorners[3] };
+		for (uint32_t i{}; i < 4; ++i)
+		{
+			normals[i] = Vector3::Cross(pCorners[i], pCorners[(i + 1) % 4]);
+
+			// The winding flips with mirroring transforms, the center ray is always inside
+			if (Vector3::Dot(normals[i], center) < 0.f)
+				normals[i] = -normals[i];
+		}
+	}
+
+	bool Frustum::Overlaps(const Vector3& origin, const Vector3& minAABB, const Vector3& maxAABB) const
+	{
+		for (const Vector3& normal : normals)
+		{
+			// The corner furthest along the normal, when even that one is outside the whole box is
+			const Vector3 corner{
+				normal.x >= 0.f ? maxAABB.x : minAABB.x,
+				normal.y >= 0.f ? maxAABB.y : minAABB.y,
+				normal.z >= 0.f ? maxAABB.z : minAABB.z };
+
+			if (Vector3::Dot(normal, corner - origin) < 0.f)
+				return false;
+		}
+		return true;
+	}
+
+	void RayPacket::SetPrimaryRays(const Camera& camera, uint32_t firstX, uint32_t firstY, uint32_t width, uint32_t height, float aspectRatio, float fov)
+	{
+		origin = camera.origin;
+		activeMask = 0;
+
+		for (uint32_t y{}; y < Size; ++y)
+		{
+			for (uint32_t x{}; x < Size; ++x)
+			{
+				const uint32_t px{ firstX + x };
+				const uint32_t py{ firstY + y };
+				const uint32_t index{ y * Size + x };
+
+				SetDirection(index, GetViewDirection(camera, px + 0.5f, py + 0.5f, width, height, aspectRatio, fov).Normalized());
+				max[index] = FLT_MAX;
+
+				if (px < width && py < height)
+					activeMask |= uint64_t{ 1 } << index;
+			}
+		}
+
+		// Through the outer edges of the corner pixels, so the ray centers are half a pixel inside the frustum
+		const float left{ static_cast<float>(firstX) };
+		const float right{ static_cast<float>(firstX + Size) };
+		const float top{ static_cast<float>(firstY) };
+		const float bottom{ static_cast<float>(firstY + Size) };
+		corners[0] = GetViewDirection(camera, left, top, width, height, aspectRatio, fov);
+		corners[1] = GetViewDirection(camera, right, top, width, height, aspectRatio, fov);
+		corners[2] = GetViewDirection(camera, right, bottom, width, height, aspectRatio, fov);
+		corners[3] = GetViewDirection(camera, left, bottom, width, height, aspectRatio, fov);
+		frustum.Build(corners);
+	}
+
+	RayPacket RayPacket::Transform(const Matrix& matrix) const
+	{
+		RayPacket result{};
+		result.origin = matrix.TransformPoint(origin);
+		result.min = min;
+		result.activeMask = activeMask;
+
+		for (uint64_t remaining{ activeMask }; remaining != 0; remaining &= remaining - 1)
+		{
+			const uint32_t i{ static_cast<uint32_t>(std::countr_zero(remaining)) };
+			result.SetDirection(i, matrix.TransformVector(directionX[i], directionY[i], directionZ[i]));
+			result.max[i] = max[i];
+		}
+
+		for (uint32_t i{}; i < 4; ++i)
+		{
+			result.corners[i] = matrix.TransformVector(corners[i]);
+		}
+		result.frustum.Build(result.corners);
+		return result;
+	}
+
+	Ray RayPacket::GetRay(uint32_t index) const
+	{
+		return Ray{ origin, Vector3{ directionX[index], directionY[index], directionZ[index] }, min, max[index] };
+	}
+
+	uint64_t RayPacket::IntersectAABB(const Vector3& minAABB, const Vector3& maxAABB, uint64_t rayMask) const
+	{
+		static const auto pIntersectAABB{ SIMD::HasAVX2() ? &IntersectAABB_AVX2 : &IntersectAABB_Scalar };
+		return pIntersectAABB(*this, minAABB, maxAABB, rayMask);
+	}
+
+	void RayPacket::SetDirection(uint32_t index, const Vector3& direction)
+	{
+		directionX[index] = direction.x;
+		directionY[index] = direction.y;
+		directionZ[index] = direction.z;
+		invDirectionX[index] = SafeReciprocal(direction.x);
+		invDirectionY[index] = SafeReciprocal(direction.y);
+		invDirectionZ[index] = SafeReciprocal(direction.z);
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <cfloat>
+#include <cstdint>
+
+#include "Vector3.h"
+
+namespace dae
+{
+	struct Camera;
+	struct Matrix;
+	struct Ray;
+
+	//The 4 side planes of the pyramid that holds every ray of a packet, they all go through the shared origin
+	struct Frustum
+	{
+		// Point inwards, a point p is inside a plane when Dot(normal, p - origin) >= 0
+		Vector3 normals[4]{};
+
+		//Built from the directions through the 4 corners of the tile, in the order top-left, top-right, bottom-right, bottom-left
+		void Build(const Vector3* pCorners);
+		//False when the box is completely outside one of the planes, boxes near the edges can still pass without touching the pyramid
+		bool Overlaps(const Vector3& origin, const Vector3& minAABB, const Vector3& maxAABB) const;
+	};
+
+	//8x8 primary rays of a screen tile, they share their origin so the packet can be culled as a whole with its frustum
+	//The directions are stored SoA so 8 rays get slab tested against a box at once
+	struct alignas(32) RayPacket
+	{
+		static constexpr uint32_t Size{ 8 };
+		static constexpr uint32_t RayCount{ Size * Size };
+
+		Vector3 origin{};
+		float min{ 0.0001f };
+
+		float directionX[RayCount]{};
+		float directionY[RayCount]{};
+		float directionZ[RayCount]{};
+		float invDirectionX[RayCount]{};
+		float invDirectionY[RayCount]{};
+		float invDirectionZ[RayCount]{};
+		// Shrunk to the closest hit of every ray, like Ray::max
+		float max[RayCount]{};
+
+		// Bit i is set when ray i (row-major in the tile) lies inside the image
+		uint64_t activeMask{};
+
+		// Directions through the tile corners, kept to rebuild the frustum when the packet is transformed
+		Vector3 corners[4]{};
+		Frustum frustum{};
+
+		/**
+		 * \brief Fills in the camera rays of the tile whose top-left pixel is (firstX, firstY), same directions as Renderer::RenderPixel
+		 * Rays of pixels outside the image are left out of activeMask
+		 */
+		void SetPrimaryRays(const Camera& camera, uint32_t firstX, uint32_t firstY, uint32_t width, uint32_t height, float aspectRatio, float fov);
+
+		//Same packet with the origin & directions brought into the space of the matrix, the directions are not renormalized
+		RayPacket Transform(const Matrix& matrix) const;
+
+		Ray GetRay(uint32_t index) const;
+
+		//Rays of rayMask whose slab test against the box passes between min and their max, 8 at a time with AVX2 when the CPU has it
+		uint64_t IntersectAABB(const Vector3& minAABB, const Vector3& maxAABB, uint64_t rayMask) const;
+
+	private:
+		void SetDirection(uint32_t index, const Vector3& direction);
+	};
+}
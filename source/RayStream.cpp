@@ -0,0 +1,103 @@
+#include "RayStream.h"
+
+#include <algorithm>
+
+#include "ppl.h"
+#include "Scene.h"
+#include "Sorting.h"
+
+namespace dae {
+
+	void ShadowRayStream::Reset(uint32_t pixelCount, uint32_t lightCount)
+	{
+		m_LightCount = lightCount;
+
+		const size_t slotCount{ size_t{ pixelCount } * lightCount };
+		m_Rays.resize(slotCount);
+		m_HasRay.assign(slotCount, 0);
+		m_Occluded.assign(slotCount, 0);
+
+		m_Order.clear();
+		m_Keys.clear();
+	}
+
+	void ShadowRayStream::SetRay(uint32_t pixelIndex, uint32_t lightIndex, const Ray& ray)
+	{
+		const uint32_t slot{ pixelIndex * m_LightCount + lightIndex };
+		m_Rays[slot] = ray;
+		m_HasRay[slot] = 1;
+	}
+
+	void ShadowRayStream::Trace(const Scene& scene, bool parallel)
+	{
+		const uint32_t slotCount{ static_cast<uint32_t>(m_Rays.size()) };
+
+		m_Order.clear();
+		AABB originBounds{};
+		for (uint32_t slot{}; slot < slotCount; ++slot)
+		{
+			if (!m_HasRay[slot])
+				continue;
+
+			m_Order.push_back(slot);
+			originBounds.Grow(m_Rays[slot].origin);
+		}
+
+		const uint32_t rayCount{ static_cast<uint32_t>(m_Order.size()) };
+		if (rayCount == 0)
+			return;
+
+		// Octant in the top 3 bits, so rays of one batch enter the BVH nodes from the same side, then the origin Morton code within the octant
+		const Vector3 extent{ originBounds.max - originBounds.min };
+		const float maxExtent{ std::max(extent.x, std::max(extent.y, extent.z)) };
+		const float scale{ maxExtent > 0.f ? 1.f / maxExtent : 0.f };
+
+		m_Keys.resize(rayCount);
+		const auto computeKey{ [&](uint32_t i)
+			{
+				const Ray& ray{ m_Rays[m_Order[i]] };
+				const uint32_t octant{ (ray.direction.x < 0.f ? 4u : 0u) | (ray.direction.y < 0.f ? 2u : 0u) | (ray.direction.z < 0.f ? 1u : 0u) };
+				const Vector3 offset{ ray.origin - originBounds.min };
+				m_Keys[i] = octant << 29 | Sorting::GetMortonCode(offset.x * scale, offset.y * scale, offset.z * scale) >> 1;
+			} };
+
+		if (parallel)
+		{
+			concurrency::parallel_for(0u, rayCount, computeKey);
+		}
+		else
+		{
+			for (uint32_t i{}; i < rayCount; ++i)
+			{
+				computeKey(i);
+			}
+		}
+
+		Sorting::RadixSort(m_Keys, m_Order, 32, parallel);
+
+		const uint32_t batchCount{ (rayCount + BatchSize - 1) / BatchSize };
+		const auto traceBatch{ [&](uint32_t batch)
+			{
+				std::vector<Scene::OccluderHint> lastOccluders(m_LightCount);
+
+				const uint32_t end{ std::min(rayCount, (batch + 1) * BatchSize) };
+				for (uint32_t i{ batch * BatchSize }; i < end; ++i)
+				{
+					const uint32_t slot{ m_Order[i] };
+					m_Occluded[slot] = scene.IsOccluded(m_Rays[slot], lastOccluders[slot % m_LightCount]) ? 1 : 0;
+				}
+			} };
+
+		if (parallel)
+		{
+			concurrency::parallel_for(0u, batchCount, traceBatch);
+		}
+		else
+		{
+			for (uint32_t batch{}; batch < batchCount; ++batch)
+			{
+				traceBatch(batch);
+			}
+		}
+	}
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "DataTypes.h"
+
+namespace dae
+{
+	class Scene;
+
+	//The shadow rays of a whole frame, queued per pixel & light and traced as one stream afterwards
+	//Before tracing they are sorted by the octant of their direction and the Morton code of their origin,
+	//so rays traced one after another walk the same BVH nodes no matter which pixel they came from
+	class ShadowRayStream final
+	{
+	public:
+		//Makes room for one ray per pixel & light, every slot starts out empty
+		void Reset(uint32_t pixelCount, uint32_t lightCount);
+
+		//Different threads can fill in different slots at the same time
+		void SetRay(uint32_t pixelIndex, uint32_t lightIndex, const Ray& ray);
+
+		//Sorts the queued rays and traces them in batches, parallel spreads the batches over the threads
+		void Trace(const Scene& scene, bool parallel = true);
+
+		//Valid after Trace for slots that got a ray
+		bool IsOccluded(uint32_t pixelIndex, uint32_t lightIndex) const { return m_Occluded[pixelIndex * m_LightCount + lightIndex] != 0; }
+
+		uint32_t GetRayCount() const { return static_cast<uint32_t>(m_Order.size()); }
+
+		//Rays in one batch share their last occluders, one batch is traced by one thread
+		static constexpr uint32_t BatchSize{ 1024 };
+
+	private:
+		uint32_t m_LightCount{};
+
+		// Indexed by pixelIndex * lightCount + lightIndex
+		std::vector<Ray> m_Rays{};
+		std::vector<uint8_t> m_HasRay{};
+		std::vector<uint8_t> m_Occluded{};
+
+		// Slots that got a ray, in the order they are traced, and their sort keys
+		std::vector<uint32_t> m_Order{};
+		std::vector<uint32_t> m_Keys{};
+	};
+}
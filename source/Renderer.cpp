@@ -29,7 +29,8 @@ Renderer::Renderer(SDL_Window * pWindow) :
 
 void Renderer::Render(Scene* pScene) const
 {
-	Camera& camera = pScene->GetCamera();
+	// Update may already be moving the scene's camera for the next frame
+	const Camera& camera = pScene->GetFrameCamera();
 
 	const float aspectRatio = {m_Width / static_cast<float>(m_Height)};
 
@@ -38,9 +39,13 @@ void Renderer::Render(Scene* pScene) const
 	const float fov = tan( fovAngle / 2.f );
 
 	auto& materials = pScene->GetMaterials();
-	auto& lights = pScene->GetLights();
+	auto& lights = pScene->GetFrameLights();
 
 	const uint32_t numPixels = m_Width * m_Height;
+	// Partial tiles along the right & bottom edge leave their outside rays inactive
+	const uint32_t numTilesX = (m_Width + RayPacket::Size - 1) / RayPacket::Size;
+	const uint32_t numTilesY = (m_Height + RayPacket::Size - 1) / RayPacket::Size;
+	const uint32_t numTiles = numTilesX * numTilesY;
 
 #if defined(ASYNC)
 	//ASYNC EXE
@@ -79,16 +84,58 @@ void Renderer::Render(Scene* pScene) const
 
 #elif defined(PARALLEL_FOR)
 	//PARALLEL-FOR
-	concurrency::parallel_for(0u, numPixels, [=, this](int i)
-		{
-			RenderPixel(pScene, i, fov, aspectRatio, camera, lights, materials);
-		});
+	if (m_CurrentTracingMode == TracingMode::Wavefront)
+	{
+		RenderWavefront(pScene, fov, aspectRatio, camera, lights, materials);
+	}
+	else if (m_CurrentTracingMode == TracingMode::Packets)
+	{
+		concurrency::parallel_for(0u, numTiles, [=, this](int i)
+			{
+				RenderTile(pScene, i, fov, aspectRatio, camera, lights, materials);
+			});
+	}
+	else if (m_CurrentTracingMode == TracingMode::DeferredPackets)
+	{
+		concurrency::parallel_for(0u, numTiles, [=, this](int i)
+			{
+				RenderTileDeferred(pScene, i, fov, aspectRatio, camera, lights, materials);
+			});
+	}
+	else
+	{
+		concurrency::parallel_for(0u, numPixels, [=, this](int i)
+			{
+				RenderPixel(pScene, i, fov, aspectRatio, camera, lights, materials);
+			});
+	}
 
 #else
 
-	for (uint32_t i{0}; i < numPixels; ++i)
+	if (m_CurrentTracingMode == TracingMode::Wavefront)
+	{
+		RenderWavefront(pScene, fov, aspectRatio, camera, lights, materials);
+	}
+	else if (m_CurrentTracingMode == TracingMode::Packets)
 	{
-		RenderPixel(pScene, i, fov, aspectRatio, pScene->GetCamera(), lights, materials);
+		for (uint32_t i{ 0 }; i < numTiles; ++i)
+		{
+			RenderTile(pScene, i, fov, aspectRatio, camera, lights, materials);
+		}
+	}
+	else if (m_CurrentTracingMode == TracingMode::DeferredPackets)
+	{
+		for (uint32_t i{ 0 }; i < numTiles; ++i)
+		{
+			RenderTileDeferred(pScene, i, fov, aspectRatio, camera, lights, materials);
+		}
+	}
+	else
+	{
+		for (uint32_t i{0}; i < numPixels; ++i)
+		{
+			RenderPixel(pScene, i, fov, aspectRatio, camera, lights, materials);
+		}
 	}
 #endif
 	//@END
@@ -96,7 +143,7 @@ void Renderer::Render(Scene* pScene) const
 	SDL_UpdateWindowSurface(m_pWindow);
 }
 
-void Renderer::RenderPixel(Scene* pscene, uint32_t pixelIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials) const
+void Renderer::RenderPixel(Scene* pscene, uint32_t pixelIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material>& materials) const
 {
 	const int px = pixelIndex % m_Width;
     const int py = pixelIndex / m_Width ;
@@ -112,16 +159,235 @@ void Renderer::RenderPixel(Scene* pscene, uint32_t pixelIndex, float fov, float
 	
 	Ray viewRay{ camera.origin, normalRayDir };
 
-	ColorRGB finalColor{};
-
 	HitRecord closestHit{};
 
 	pscene->GetClosestHit(viewRay, closestHit);
 
+	ShadePixel(pscene, px, py, viewRay, closestHit, lights, materials);
+}
+
+void Renderer::RenderTile(Scene* pScene, uint32_t tileIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material>& materials) const
+{
+	const uint32_t numTilesX = (m_Width + RayPacket::Size - 1) / RayPacket::Size;
+	const uint32_t firstX = tileIndex % numTilesX * RayPacket::Size;
+	const uint32_t firstY = tileIndex / numTilesX * RayPacket::Size;
+
+	RayPacket packet{};
+	packet.SetPrimaryRays(camera, firstX, firstY, m_Width, m_Height, aspectRatio, fov);
+
+	HitRecord closestHits[RayPacket::RayCount]{};
+	pScene->GetClosestHits(packet, closestHits);
+
+	for (uint64_t remaining{ packet.activeMask }; remaining != 0; remaining &= remaining - 1)
+	{
+		const uint32_t i{ static_cast<uint32_t>(std::countr_zero(remaining)) };
+		const Ray viewRay{ packet.origin, { packet.directionX[i], packet.directionY[i], packet.directionZ[i] } };
+		ShadePixel(pScene, firstX + i % RayPacket::Size, firstY + i / RayPacket::Size, viewRay, closestHits[i], lights, materials);
+	}
+}
+
+template<typename MaterialType>
+void Renderer::ShadeBatch(Scene* pScene, const MaterialType& material, const ShadingQueue& queue, const ShadingBatch& batch, const std::vector<Light>& lights, ColorRGB* pColors) const
+{
+	thread_local std::vector<Scene::OccluderHint> lastOccluders{};
+	lastOccluders.resize(lights.size());
+
+	// Light by light, so the shadow rays of one pass all head for the same light
+	for (uint32_t i{}; i < lights.size(); ++i)
+	{
+		for (uint32_t entry{ batch.first }; entry < batch.first + batch.count; ++entry)
+		{
+			const HitRecord hitRecord{ queue.GetHitRecord(batch, entry) };
+
+			Vector3 directionToLight{};
+			float observedArea{};
+			if (!GetVisibleLight(pScene, lights[i], hitRecord, lastOccluders[i], directionToLight, observedArea))
+				continue;
+
+			const ColorRGB radiance = LightUtils::GetRadiance(lights[i], hitRecord.origin);
+			const ColorRGB BRDF = material.Shade(hitRecord, directionToLight, queue.GetViewDirection(entry));
+			pColors[queue.rayIndex[entry]] += GetLighting(observedArea, radiance, BRDF);
+		}
+	}
+}
+
+//Cook-Torrence gathers the visible samples of a light and evaluates their BRDF 8 at a time
+template<>
+void Renderer::ShadeBatch(Scene* pScene, const Material_CookTorrence& material, const ShadingQueue& queue, const ShadingBatch& batch, const std::vector<Light>& lights, ColorRGB* pColors) const
+{
+	thread_local std::vector<Scene::OccluderHint> lastOccluders{};
+	lastOccluders.resize(lights.size());
+
+	BRDF::SampleBlock samples{};
+	uint32_t sampleEntries[BRDF::SampleBlock::Width]{};
+	float sampleObservedAreas[BRDF::SampleBlock::Width]{};
+	ColorRGB sampleRadiances[BRDF::SampleBlock::Width]{};
+	uint32_t sampleCount{};
+
+	// Lanes past sampleCount still hold older samples, their results are ignored
+	const auto shadeSamples{ [&]()
+		{
+			ColorRGB BRDFs[BRDF::SampleBlock::Width];
+			BRDF::CookTorrence_x8(material.GetConstants(), samples, BRDFs);
+			for (uint32_t lane{}; lane < sampleCount; ++lane)
+			{
+				pColors[queue.rayIndex[sampleEntries[lane]]] += GetLighting(sampleObservedAreas[lane], sampleRadiances[lane], BRDFs[lane]);
+			}
+			sampleCount = 0;
+		} };
+
+	for (uint32_t i{}; i < lights.size(); ++i)
+	{
+		for (uint32_t entry{ batch.first }; entry < batch.first + batch.count; ++entry)
+		{
+			const HitRecord hitRecord{ queue.GetHitRecord(batch, entry) };
+
+			Vector3 directionToLight{};
+			float observedArea{};
+			if (!GetVisibleLight(pScene, lights[i], hitRecord, lastOccluders[i], directionToLight, observedArea))
+				continue;
+
+			const uint32_t lane{ sampleCount++ };
+			samples.normalX[lane] = queue.normalX[entry];
+			samples.normalY[lane] = queue.normalY[entry];
+			samples.normalZ[lane] = queue.normalZ[entry];
+			samples.viewX[lane] = queue.viewX[entry];
+			samples.viewY[lane] = queue.viewY[entry];
+			samples.viewZ[lane] = queue.viewZ[entry];
+			samples.lightX[lane] = directionToLight.x;
+			samples.lightY[lane] = directionToLight.y;
+			samples.lightZ[lane] = directionToLight.z;
+			sampleEntries[lane] = entry;
+			sampleObservedAreas[lane] = observedArea;
+			sampleRadiances[lane] = LightUtils::GetRadiance(lights[i], hitRecord.origin);
+
+			if (sampleCount == BRDF::SampleBlock::Width)
+				shadeSamples();
+		}
+
+		// Every pixel adds up its lights in order, so a light is finished before the next one starts
+		if (sampleCount > 0)
+			shadeSamples();
+	}
+}
+
+bool Renderer::GetVisibleLight(Scene* pScene, const Light& light, const HitRecord& hitRecord, Scene::OccluderHint& lastOccluder, Vector3& directionToLight, float& observedArea) const
+{
+	directionToLight = LightUtils::GetDirectionToLight(light, hitRecord.origin);
+	const float mag{ directionToLight.Normalize() };
+	observedArea = Vector3::Dot(hitRecord.normal, directionToLight);
+	if (observedArea < 0.f)
+		return false;
+
+	return !m_ShadowsActive || !pScene->IsOccluded(Ray{ hitRecord.origin, directionToLight, 0.0001f, mag }, lastOccluder);
+}
+
+void Renderer::RenderTileDeferred(Scene* pScene, uint32_t tileIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material>& materials) const
+{
+	const uint32_t numTilesX = (m_Width + RayPacket::Size - 1) / RayPacket::Size;
+	const uint32_t firstX = tileIndex % numTilesX * RayPacket::Size;
+	const uint32_t firstY = tileIndex / numTilesX * RayPacket::Size;
+
+	RayPacket packet{};
+	packet.SetPrimaryRays(camera, firstX, firstY, m_Width, m_Height, aspectRatio, fov);
+
+	HitRecord closestHits[RayPacket::RayCount]{};
+	pScene->GetClosestHits(packet, closestHits);
+
+	ShadingQueue queue{};
+	queue.Build(packet, closestHits);
+
+	// The material type is only looked up once per batch, the batch itself runs with one fixed kernel
+	ColorRGB colors[RayPacket::RayCount]{};
+	for (uint32_t i{}; i < queue.batchCount; ++i)
+	{
+		const ShadingBatch& batch{ queue.batches[i] };
+		std::visit([&](const auto& material)
+			{
+				ShadeBatch(pScene, material, queue, batch, lights, colors);
+			}, materials[batch.materialIndex]);
+	}
+
+	for (uint64_t remaining{ packet.activeMask }; remaining != 0; remaining &= remaining - 1)
+	{
+		const uint32_t i{ static_cast<uint32_t>(std::countr_zero(remaining)) };
+		WritePixel(firstX + i % RayPacket::Size, firstY + i / RayPacket::Size, colors[i]);
+	}
+}
+
+void Renderer::RenderWavefront(Scene* pScene, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material>& materials) const
+{
+	const uint32_t numPixels = m_Width * m_Height;
+	const uint32_t numTilesX = (m_Width + RayPacket::Size - 1) / RayPacket::Size;
+	const uint32_t numTilesY = (m_Height + RayPacket::Size - 1) / RayPacket::Size;
+	const uint32_t numLights = static_cast<uint32_t>(lights.size());
+
+	m_FrameHits.resize(numPixels);
+	m_FrameViewDirections.resize(numPixels);
+
+	//Primary rays, the hits are scattered to their pixels
+	concurrency::parallel_for(0u, numTilesX * numTilesY, [&, this](uint32_t tileIndex)
+		{
+			const uint32_t firstX = tileIndex % numTilesX * RayPacket::Size;
+			const uint32_t firstY = tileIndex / numTilesX * RayPacket::Size;
+
+			RayPacket packet{};
+			packet.SetPrimaryRays(camera, firstX, firstY, m_Width, m_Height, aspectRatio, fov);
+
+			HitRecord closestHits[RayPacket::RayCount]{};
+			pScene->GetClosestHits(packet, closestHits);
+
+			for (uint64_t remaining{ packet.activeMask }; remaining != 0; remaining &= remaining - 1)
+			{
+				const uint32_t i{ static_cast<uint32_t>(std::countr_zero(remaining)) };
+				const uint32_t pixelIndex = firstX + i % RayPacket::Size + (firstY + i / RayPacket::Size) * m_Width;
+				m_FrameHits[pixelIndex] = closestHits[i];
+				m_FrameViewDirections[pixelIndex] = { packet.directionX[i], packet.directionY[i], packet.directionZ[i] };
+			}
+		});
+
+	//Shadow rays, queued with the same test ShadePixel uses to skip lights behind the surface
+	if (m_ShadowsActive)
+	{
+		m_FrameShadowRays.Reset(numPixels, numLights);
+		concurrency::parallel_for(0u, numPixels, [&, this](uint32_t pixelIndex)
+			{
+				const HitRecord& closestHit = m_FrameHits[pixelIndex];
+				if (!closestHit.didHit)
+					return;
+
+				for (uint32_t i{}; i < numLights; ++i)
+				{
+					Vector3 directionToLight = LightUtils::GetDirectionToLight(lights[i], closestHit.origin);
+					float mag{ directionToLight.Magnitude() };
+					directionToLight.Normalize();
+
+					if (Vector3::Dot(closestHit.normal, directionToLight) >= 0.f)
+						m_FrameShadowRays.SetRay(pixelIndex, i, Ray{ closestHit.origin, directionToLight, 0.0001f, mag });
+				}
+			});
+		m_FrameShadowRays.Trace(*pScene);
+	}
+
+	//Shading
+	concurrency::parallel_for(0u, numPixels, [&, this](uint32_t pixelIndex)
+		{
+			const Ray viewRay{ camera.origin, m_FrameViewDirections[pixelIndex] };
+			ShadePixel(pScene, pixelIndex % m_Width, pixelIndex / m_Width, viewRay, m_FrameHits[pixelIndex], lights, materials, &m_FrameShadowRays);
+		});
+}
+
+void Renderer::ShadePixel(Scene* pScene, uint32_t px, uint32_t py, const Ray& viewRay, const HitRecord& closestHit, const std::vector<Light>& lights, const std::vector<Material>& materials, const ShadowRayStream* pShadowRays) const
+{
+	ColorRGB finalColor{};
 
 	if (closestHit.didHit)
 	{
-		auto material{ materials[closestHit.materialIndex] };
+		const Material& material{ materials[closestHit.materialIndex] };
+
+		// Each thread renders a run of neighbouring pixels, so the leaf that blocked the last ray towards a light likely blocks this one too
+		thread_local std::vector<Scene::OccluderHint> lastOccluders{};
+		lastOccluders.resize(lights.size());
 
 		for (unsigned long i{}; i < lights.size(); ++i)
 		{
@@ -134,38 +400,47 @@ void Renderer::RenderPixel(Scene* pscene, uint32_t pixelIndex, float fov, float
 			float LambertVal{ Vector3::Dot(directionToLight, closestHit.normal) };
 			Ray rayToLight = Ray{ closestHit.origin, directionToLight, 0.0001f, mag };
 			
-			if (observedArea >= 0.f && (!m_ShadowsActive || !pscene->DoesHit(rayToLight)))
+			if (observedArea >= 0.f && (!m_ShadowsActive || !(pShadowRays
+				? pShadowRays->IsOccluded(px + py * m_Width, i)
+				: pScene->IsOccluded(rayToLight, lastOccluders[i]))))
 			{
 				ColorRGB radiance = LightUtils::GetRadiance(lights[i], closestHit.origin);
-				ColorRGB BRDF = material->Shade(closestHit, directionToLight, -viewRay.direction);
+				ColorRGB BRDF = Shade(material, closestHit, directionToLight, -viewRay.direction);
 
-				switch (m_CurrentLightingMode)
-				{
-				case LightingMode::ObservedArea:
-					finalColor += ColorRGB(1.f, 1.f, 1.f) * observedArea;
-					break;
-				case LightingMode::Radiance:
-					finalColor += radiance;
-					break;
-				case LightingMode::BRDF:
-					finalColor += BRDF;
-					break;
-				case LightingMode::Combined:
-					finalColor += radiance * observedArea * BRDF;
-					break;
-				}
+				finalColor += GetLighting(observedArea, radiance, BRDF);
 			}
 			
 		}
 	}
 
+	WritePixel(px, py, finalColor);
+}
+
+ColorRGB Renderer::GetLighting(float observedArea, const ColorRGB& radiance, const ColorRGB& BRDF) const
+{
+	switch (m_CurrentLightingMode)
+	{
+	case LightingMode::ObservedArea:
+		return ColorRGB(1.f, 1.f, 1.f) * observedArea;
+	case LightingMode::Radiance:
+		return radiance;
+	case LightingMode::BRDF:
+		return BRDF;
+	case LightingMode::Combined:
+		return radiance * observedArea * BRDF;
+	}
+	return {};
+}
+
+void Renderer::WritePixel(uint32_t px, uint32_t py, ColorRGB color) const
+{
 	//Update Color in Buffer
-	finalColor.MaxToOne(); //Goes over 255 so starts over again reason why it's black
+	color.MaxToOne(); //Goes over 255 so starts over again reason why it's black
 
 	m_pBufferPixels[px + (py * m_Width)] = SDL_MapRGB(m_pBuffer->format,
-		static_cast<uint8_t>(finalColor.r * 255),
-		static_cast<uint8_t>(finalColor.g * 255),
-		static_cast<uint8_t>(finalColor.b * 255));
+		static_cast<uint8_t>(color.r * 255),
+		static_cast<uint8_t>(color.g * 255),
+		static_cast<uint8_t>(color.b * 255));
 }
 
 bool Renderer::SaveBufferToImage() const
@@ -190,4 +465,23 @@ void dae::Renderer::CycleLightingMode()
 		m_CurrentLightingMode = LightingMode::ObservedArea;
 		break;
 	}
+}
+
+void dae::Renderer::CycleTracingMode()
+{
+	switch (m_CurrentTracingMode)
+	{
+	case dae::Renderer::TracingMode::PerPixel:
+		m_CurrentTracingMode = TracingMode::Packets;
+		break;
+	case dae::Renderer::TracingMode::Packets:
+		m_CurrentTracingMode = TracingMode::DeferredPackets;
+		break;
+	case dae::Renderer::TracingMode::DeferredPackets:
+		m_CurrentTracingMode = TracingMode::Wavefront;
+		break;
+	case dae::Renderer::TracingMode::Wavefront:
+		m_CurrentTracingMode = TracingMode::PerPixel;
+		break;
+	}
 }
\ No newline at end of file
@@ -5,6 +5,9 @@
 #include "Utils.h"
 #include "Material.h"
 #include "Camera.h"
+#include "RayStream.h"
+#include "Scene.h"
+#include "ShadingQueue.h"
 
 struct SDL_Window;
 struct SDL_Surface;
@@ -12,8 +15,6 @@ struct SDL_Surface;
 
 namespace dae
 {
-	class Scene;
-
 	class Renderer final
 	{
 	public:
@@ -26,11 +27,18 @@ namespace dae
 		Renderer& operator=(Renderer&&) noexcept = delete;
 
 		void Render(Scene* pScene) const;
-		void RenderPixel(Scene* pscene, uint32_t pixelIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials) const;
+		void RenderPixel(Scene* pscene, uint32_t pixelIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material>& materials) const;
+		//Traces the primary rays of an 8x8 tile as one packet, then shades its pixels one by one like RenderPixel
+		void RenderTile(Scene* pScene, uint32_t tileIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material>& materials) const;
+		//Traces an 8x8 tile as one packet like RenderTile, then queues its hits per material and shades every material as one batch
+		void RenderTileDeferred(Scene* pScene, uint32_t tileIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material>& materials) const;
+		//Traces the whole frame stage by stage: all primary rays as packets, then every shadow ray as one sorted stream, then the shading
+		void RenderWavefront(Scene* pScene, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material>& materials) const;
 		bool SaveBufferToImage() const;
 
 		void CycleLightingMode();
 		void ToggleShadows() { m_ShadowsActive = !m_ShadowsActive; }
+		void CycleTracingMode();
 
 	private:
 		SDL_Window* m_pWindow{};
@@ -41,6 +49,17 @@ namespace dae
 		int m_Width{};
 		int m_Height{};
 
+		//pShadowRays holds the already traced shadow rays of the frame, without it they are traced here
+		void ShadePixel(Scene* pScene, uint32_t px, uint32_t py, const Ray& viewRay, const HitRecord& closestHit, const std::vector<Light>& lights, const std::vector<Material>& materials, const ShadowRayStream* pShadowRays = nullptr) const;
+		//Adds the light of every light to the entries of one batch of the queue, pColors is indexed by the ray index of the entries
+		template<typename MaterialType>
+		void ShadeBatch(Scene* pScene, const MaterialType& material, const ShadingQueue& queue, const ShadingBatch& batch, const std::vector<Light>& lights, ColorRGB* pColors) const;
+		//Direction towards a light that reaches the hit & the observed area, false when the surface faces away or (with shadows on) something blocks it
+		bool GetVisibleLight(Scene* pScene, const Light& light, const HitRecord& hitRecord, Scene::OccluderHint& lastOccluder, Vector3& directionToLight, float& observedArea) const;
+		//What one visible light adds to a pixel in the current lighting mode
+		ColorRGB GetLighting(float observedArea, const ColorRGB& radiance, const ColorRGB& BRDF) const;
+		void WritePixel(uint32_t px, uint32_t py, ColorRGB color) const;
+
 		enum class LightingMode
 		{
 			ObservedArea,
@@ -49,7 +68,25 @@ namespace dae
 			Combined
 		};
 
+		enum class TracingMode
+		{
+			// One primary ray per pixel, shaded right away
+			PerPixel,
+			// 8x8 primary ray packets per tile, shaded right away
+			Packets,
+			// 8x8 primary ray packets per tile, shaded material by material
+			DeferredPackets,
+			// Every stage over the whole frame before the next one starts
+			Wavefront
+		};
+
 		LightingMode m_CurrentLightingMode{ LightingMode::Combined };
+		TracingMode m_CurrentTracingMode{ TracingMode::Packets };
 		bool m_ShadowsActive{ true };
+
+		//Per pixel results of the wavefront stages, kept between frames so they are only allocated once
+		mutable std::vector<HitRecord> m_FrameHits{};
+		mutable std::vector<Vector3> m_FrameViewDirections{};
+		mutable ShadowRayStream m_FrameShadowRays{};
 	};
 }
@@ -0,0 +1,74 @@
+#pragma once
+#include <bit>
+#include <cfloat>
+#include <cstdint>
+#include <immintrin.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+// MSVC lets every function use AVX2 intrinsics, the caller is responsible for checking HasAVX2 first
+// It never fuses separate multiply & add intrinsics, so both macros are the same there
+#define DAE_AVX2_FUNCTION
+#define DAE_AVX2_EXACT_FUNCTION
+#else
+#define DAE_AVX2_FUNCTION __attribute__((target("avx2,fma")))
+// Without FMA, so a kernel rounds exactly like the scalar code it replaces instead of letting the compiler fuse multiply-adds
+#define DAE_AVX2_EXACT_FUNCTION __attribute__((target("avx2")))
+#endif
+
+namespace dae
+{
+	namespace SIMD
+	{
+		//AVX2 + FMA support of the CPU we are running on, checked once
+		inline bool HasAVX2()
+		{
+#if defined(_MSC_VER) && !defined(__clang__)
+			static const bool hasAVX2{ []
+				{
+					int info[4]{};
+					__cpuid(info, 1);
+					const bool hasFMA{ (info[2] & (1 << 12)) != 0 };
+					const bool hasOSXSAVE{ (info[2] & (1 << 27)) != 0 };
+					const bool hasAVX{ (info[2] & (1 << 28)) != 0 };
+					if (!hasFMA || !hasOSXSAVE || !hasAVX)
+						return false;
+
+					// The OS has to save the YMM registers on a context switch
+					if ((_xgetbv(0) & 0x6) != 0x6)
+						return false;
+
+					__cpuidex(info, 7, 0);
+					return (info[1] & (1 << 5)) != 0;
+				}() };
+#else
+			static const bool hasAVX2{ __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") };
+#endif
+			return hasAVX2;
+		}
+
+		//Starts loading the cache line holding the address into every cache level, for data that is needed a few steps later
+		inline void Prefetch(const void* pAddress)
+		{
+			_mm_prefetch(static_cast<const char*>(pAddress), _MM_HINT_T0);
+		}
+
+		//Nearest of the valid lanes of an 8-wide distance test, on a tie the lowest lane wins like it does in a scalar loop
+		//Returns FLT_MAX and leaves lane untouched when no lane is valid
+		DAE_AVX2_EXACT_FUNCTION inline float NearestLane(__m256 distances, __m256 valid, uint32_t& lane)
+		{
+			const uint32_t validMask{ static_cast<uint32_t>(_mm256_movemask_ps(valid)) };
+			if (validMask == 0)
+				return FLT_MAX;
+
+			const __m256 candidates{ _mm256_blendv_ps(_mm256_set1_ps(FLT_MAX), distances, valid) };
+			__m256 nearest{ _mm256_min_ps(candidates, _mm256_permute2f128_ps(candidates, candidates, 1)) };
+			nearest = _mm256_min_ps(nearest, _mm256_shuffle_ps(nearest, nearest, _MM_SHUFFLE(1, 0, 3, 2)));
+			nearest = _mm256_min_ps(nearest, _mm256_shuffle_ps(nearest, nearest, _MM_SHUFFLE(2, 3, 0, 1)));
+
+			const uint32_t nearestMask{ static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(candidates, nearest, _CMP_EQ_OQ))) & validMask };
+			lane = static_cast<uint32_t>(std::countr_zero(nearestMask));
+			return _mm256_cvtss_f32(nearest);
+		}
+	}
+}
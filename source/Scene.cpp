@@ -2,111 +2,620 @@
 #include "Utils.h"
 #include "Material.h"
 
+#include <random>
+
 namespace dae {
 
 #pragma region Base Scene
 	//Initialize Scene with Default Solid Color Material (RED)
 	Scene::Scene() :
-		m_Materials({ new Material_SolidColor({1,0,0}) })
+		m_Materials({ Material_SolidColor({1,0,0}) })
 	{
 		m_SphereGeometries.reserve(32);
 		m_PlaneGeometries.reserve(32);
 		m_TriangleMeshGeometries.reserve(32);
 		m_Lights.reserve(32);
-	}
 
-	Scene::~Scene()
-	{
-		for (auto& pMaterial : m_Materials)
+		for (FrameState& frame : m_Frames)
 		{
-			delete pMaterial;
-			pMaterial = nullptr;
+			frame.sphereBVH.SetLeafSize(SphereBlock::Width);
+			frame.sphereBVH.SetLeafAlignment(SphereBlock::Width);
 		}
-
-		m_Materials.clear();
 	}
 
 	void dae::Scene::GetClosestHit(const Ray& ray, HitRecord& closestHit) const
 	{
+		const FrameState& frame{ GetRenderFrame() };
+
+		// Every candidate clips the ray, the hit record is only filled in for the one that is left at the end
+		HitCandidate closest{ closestHit.t };
+		Ray closestRay{ ray };
+		closestRay.max = std::min(ray.max, closestHit.t);
+
+		const auto addCandidate{ [&](float t, ObjectType type, uint32_t index, uint32_t primitiveIndex = 0)
+			{
+				if (t >= closest.t)
+					return;
+
+				closest = { t, { type, index }, primitiveIndex };
+				closestRay.max = t;
+			} };
+
 		//W1
 		//check planes
-		const size_t planeGeometriesSize{ m_PlaneGeometries.size() };
-		for (size_t i{}; i < planeGeometriesSize; ++i)
+		const std::vector<PlaneBlock>& planeBlocks{ frame.planeBlocks.GetBlocks() };
+		for (uint32_t i{}; i < planeBlocks.size(); ++i)
 		{
-			HitRecord hitInfo{};
-			GeometryUtils::HitTest_Plane(m_PlaneGeometries[i], ray, hitInfo);
-			if (hitInfo.t < closestHit.t)
-			{
-				closestHit = hitInfo;
-			}
+			uint32_t lane{};
+			const float t{ PlaneBlockList::Intersect(planeBlocks[i], closestRay, lane) };
+			addCandidate(t, ObjectType::Plane, i * PlaneBlock::Width + lane);
 		}
 
-		// Check the spheres
-		const size_t sphereGeometriesSize{ m_SphereGeometries.size() };
-		for (size_t i{}; i < sphereGeometriesSize; ++i)
+		if (m_UseTopLevelBVH && frame.topLevelBVH.IsBuilt())
 		{
-			HitRecord hitInfo{};
-			GeometryUtils::HitTest_Sphere(m_SphereGeometries[i], ray, hitInfo);
-			if (hitInfo.t < closestHit.t)
+			// Start out clipped to the closest plane, so objects behind it are never visited
+			const std::vector<uint32_t>& objectIndices{ frame.topLevelBVH.GetPrimitiveIndices() };
+			GeometryUtils::TraverseBVH(frame.topLevelBVH, closestRay, false, [&](uint32_t firstReference, uint32_t referenceCount, Ray& currentRay)
+				{
+					bool didHit{ false };
+					for (uint32_t i{ firstReference }; i < firstReference + referenceCount; ++i)
+					{
+						const ObjectReference& object{ frame.objects[objectIndices[i]] };
+
+						uint32_t primitiveIndex{};
+						const float t{ Intersect_Object(object, currentRay, primitiveIndex) };
+						if (t >= closest.t)
+							continue;
+
+						closest = { t, object, primitiveIndex };
+						currentRay.max = t;
+						didHit = true;
+					}
+					return didHit;
+				});
+		}
+		else
+		{
+			// Check the spheres
+			if (frame.sphereBlocks.IsBuilt())
+			{
+				const std::vector<SphereBlock>& blocks{ frame.sphereBlocks.GetBlocks() };
+				for (uint32_t i{}; i < blocks.size(); ++i)
+				{
+					uint32_t lane{};
+					const float t{ SphereBlockList::Intersect(blocks[i], closestRay, lane) };
+					addCandidate(t, ObjectType::Spheres, 0, i * SphereBlock::Width + lane);
+				}
+			}
+			else
+			{
+				for (uint32_t i{}; i < frame.spheres.size(); ++i)
+				{
+					addCandidate(GeometryUtils::IntersectSphere(frame.spheres[i], closestRay), ObjectType::Sphere, i);
+				}
+			}
+
+			// Check the triangles
+			for (uint32_t i{}; i < frame.triangles.size(); ++i)
+			{
+				const Triangle& triangle{ frame.triangles[i] };
+				addCandidate(GeometryUtils::IntersectTriangle(triangle.v0, triangle.v1 - triangle.v0, triangle.v2 - triangle.v0, triangle.cullMode, closestRay), ObjectType::Triangle, i);
+			}
+
+			// Check the triangle meshes
+			for (uint32_t i{}; i < m_TriangleMeshGeometries.size(); ++i)
 			{
-				closestHit = hitInfo;
+				uint32_t triangleIndex{};
+				const float t{ GeometryUtils::ClosestHit_TriangleMesh(m_TriangleMeshGeometries[i], frame.meshInstances[i], closestRay, triangleIndex) };
+				addCandidate(t, ObjectType::TriangleMesh, i, triangleIndex);
 			}
 		}
 
-		// Check the triangles
-		const size_t trianglesSize{ m_Triangles.size() };
-		for (size_t i{}; i < trianglesSize; ++i)
+		if (closest.t < closestHit.t)
+			GetHitRecord(closest, ray, closestHit);
+	}
+
+	void Scene::GetClosestHits(RayPacket& packet, HitRecord* pHitRecords) const
+	{
+		const FrameState& frame{ GetRenderFrame() };
+		if (!m_UseTopLevelBVH || !frame.topLevelBVH.IsBuilt())
 		{
-			HitRecord hitInfoTriangle{};
-			GeometryUtils::HitTest_Triangle(m_Triangles[i], ray, hitInfoTriangle);
-			if (hitInfoTriangle.t < closestHit.t)
+			for (uint64_t remaining{ packet.activeMask }; remaining != 0; remaining &= remaining - 1)
 			{
-				closestHit = hitInfoTriangle;
+				const uint32_t i{ static_cast<uint32_t>(std::countr_zero(remaining)) };
+				GetClosestHit(packet.GetRay(i), pHitRecords[i]);
 			}
+			return;
 		}
 
-		// Check the triangles
-		const size_t trianglesGeometriesSize{ m_TriangleMeshGeometries.size() };
-		for (size_t i{}; i < trianglesGeometriesSize; ++i)
+		// Planes are unbounded, so every ray tests them on its own
+		HitCandidate candidates[RayPacket::RayCount]{};
+		for (uint64_t remaining{ packet.activeMask }; remaining != 0; remaining &= remaining - 1)
 		{
-			HitRecord hitInfoTriangle{};
-			GeometryUtils::HitTest_TriangleMesh(m_TriangleMeshGeometries[i], ray, hitInfoTriangle);
-			if (hitInfoTriangle.t < closestHit.t)
+			const uint32_t i{ static_cast<uint32_t>(std::countr_zero(remaining)) };
+			candidates[i].t = pHitRecords[i].t;
+
+			Ray ray{ packet.GetRay(i) };
+			ray.max = std::min(ray.max, candidates[i].t);
+			const std::vector<PlaneBlock>& planeBlocks{ frame.planeBlocks.GetBlocks() };
+			for (uint32_t j{}; j < planeBlocks.size(); ++j)
 			{
-				closestHit = hitInfoTriangle;
+				uint32_t lane{};
+				const float t{ PlaneBlockList::Intersect(planeBlocks[j], ray, lane) };
+				if (t < candidates[i].t)
+				{
+					candidates[i] = { t, { ObjectType::Plane, j * PlaneBlock::Width + lane } };
+					ray.max = t;
+				}
 			}
+			packet.max[i] = std::min(packet.max[i], candidates[i].t);
+		}
+
+		const std::vector<uint32_t>& objectIndices{ frame.topLevelBVH.GetPrimitiveIndices() };
+		GeometryUtils::TraverseBVHPacket(frame.topLevelBVH, packet, packet.activeMask, [&](uint32_t firstReference, uint32_t referenceCount, uint64_t rayMask, RayPacket& currentPacket)
+			{
+				for (uint32_t i{ firstReference }; i < firstReference + referenceCount; ++i)
+				{
+					HitTest_ObjectPacket(frame.objects[objectIndices[i]], currentPacket, rayMask, candidates);
+				}
+			});
+
+		for (uint64_t remaining{ packet.activeMask }; remaining != 0; remaining &= remaining - 1)
+		{
+			const uint32_t i{ static_cast<uint32_t>(std::countr_zero(remaining)) };
+			if (candidates[i].t < pHitRecords[i].t)
+				GetHitRecord(candidates[i], packet.GetRay(i), pHitRecords[i]);
 		}
 	}
 
 	bool Scene::DoesHit(const Ray& ray) const
 	{
-		for (const Plane& plane : m_PlaneGeometries)
+		OccluderHint lastOccluder{};
+		return IsOccluded(ray, lastOccluder);
+	}
+
+	bool Scene::IsOccluded(const Ray& ray, OccluderHint& lastOccluder) const
+	{
+		const FrameState& frame{ GetRenderFrame() };
+
+		for (const PlaneBlock& block : frame.planeBlocks.GetBlocks())
 		{
-			if (GeometryUtils::HitTest_Plane(plane, ray))
+			uint32_t lane{};
+			if (PlaneBlockList::Intersect(block, ray, lane) != FLT_MAX)
 				return true;
 		}
 
-		for (const Sphere& sphere : m_SphereGeometries)
+		// Neighbouring shadow rays towards the same light are mostly blocked by the same leaf, one leaf costs less than a walk down to it
+		// A miss mostly means the rays left that shadow, so the leaf is dropped until the next blocker instead of being tested by every lit ray
+		if (IsOccluded_Hint(lastOccluder, ray))
+			return true;
+		lastOccluder = {};
+
+		if (m_UseTopLevelBVH && frame.topLevelBVH.IsBuilt())
 		{
-			if (GeometryUtils::HitTest_Sphere(sphere, ray))
-				return true;
+			const std::vector<uint32_t>& objectIndices{ frame.topLevelBVH.GetPrimitiveIndices() };
+			return GeometryUtils::TraverseBVHOcclusion(frame.topLevelBVH, ray, [&](uint32_t firstReference, uint32_t referenceCount, const Ray& currentRay)
+				{
+					for (uint32_t i{ firstReference }; i < firstReference + referenceCount; ++i)
+					{
+						if (IsOccluded_Object(frame.objects[objectIndices[i]], currentRay, lastOccluder))
+							return true;
+					}
+					return false;
+				});
 		}
 
-		for (const Triangle& triangle : m_Triangles)
+		const std::vector<SphereBlock>& sphereBlocks{ frame.sphereBlocks.GetBlocks() };
+		for (uint32_t i{}; i < sphereBlocks.size(); ++i)
 		{
-			if (GeometryUtils::HitTest_Triangle(triangle, ray))
+			if (!GeometryUtils::IsOccluded_SphereBlock(sphereBlocks[i], ray))
+				continue;
+
+			lastOccluder = { { ObjectType::Spheres, i } };
+			return true;
+		}
+
+		if (!frame.sphereBlocks.IsBuilt())
+		{
+			for (uint32_t i{}; i < frame.spheres.size(); ++i)
+			{
+				if (!GeometryUtils::IsOccluded_Sphere(frame.spheres[i], ray))
+					continue;
+
+				lastOccluder = { { ObjectType::Sphere, i } };
 				return true;
+			}
 		}
 
-		for (const TriangleMesh& triangleMesh : m_TriangleMeshGeometries)
+		for (uint32_t i{}; i < frame.triangles.size(); ++i)
 		{
-			if (GeometryUtils::HitTest_TriangleMesh(triangleMesh, ray))
+			if (!GeometryUtils::IsOccluded_Triangle(frame.triangles[i], ray))
+				continue;
+
+			lastOccluder = { { ObjectType::Triangle, i } };
+			return true;
+		}
+
+		for (uint32_t i{}; i < m_TriangleMeshGeometries.size(); ++i)
+		{
+			if (IsOccluded_Object({ ObjectType::TriangleMesh, i }, ray, lastOccluder))
 				return true;
 		}
 
 		return false;
 	}
 
+	void Scene::UpdateAccelerationStructures()
+	{
+		BuildNextFrame();
+		SwapFrames();
+	}
+
+	void Scene::BuildNextFrame()
+	{
+		// Written while the render frame is being traced, so nothing in here may touch it
+		FrameState& frame{ m_Frames[m_RenderFrame ^ 1] };
+		frame.camera = m_Camera;
+		frame.lights = m_Lights;
+		frame.triangles = m_Triangles;
+
+		frame.planeBlocks.Build(m_PlaneGeometries);
+
+		frame.objects.clear();
+		frame.objectBounds.clear();
+
+		m_SphereBounds.clear();
+		for (const Sphere& sphere : m_SphereGeometries)
+		{
+			const Vector3 extent{ sphere.radius, sphere.radius, sphere.radius };
+			m_SphereBounds.push_back({ sphere.origin - extent, sphere.origin + extent });
+		}
+
+		if (m_UseSphereBlocks && !m_SphereBounds.empty())
+		{
+			// The blocks follow the leaves, so they get repacked after every refit as well
+			frame.sphereBVH.Update(m_SphereBounds);
+			frame.sphereBlocks.Build(frame.sphereBVH, m_SphereGeometries);
+
+			frame.objects.push_back({ ObjectType::Spheres, 0 });
+			frame.objectBounds.push_back(frame.sphereBVH.GetBounds());
+		}
+		else
+		{
+			frame.sphereBVH.Clear();
+			frame.sphereBlocks.Clear();
+			frame.spheres = m_SphereGeometries;
+
+			for (uint32_t i{}; i < m_SphereBounds.size(); ++i)
+			{
+				frame.objects.push_back({ ObjectType::Sphere, i });
+				frame.objectBounds.push_back(m_SphereBounds[i]);
+			}
+		}
+
+		for (uint32_t i{}; i < frame.triangles.size(); ++i)
+		{
+			const Triangle& triangle{ frame.triangles[i] };
+
+			AABB bounds{};
+			bounds.Grow(triangle.v0);
+			bounds.Grow(triangle.v1);
+			bounds.Grow(triangle.v2);
+
+			frame.objects.push_back({ ObjectType::Triangle, i });
+			frame.objectBounds.push_back(bounds);
+		}
+
+		frame.meshInstances.clear();
+		for (uint32_t i{}; i < m_TriangleMeshGeometries.size(); ++i)
+		{
+			const TriangleMesh& triangleMesh{ m_TriangleMeshGeometries[i] };
+			const MeshInstance& instance{ frame.meshInstances.emplace_back(triangleMesh.GetInstance()) };
+			if (!triangleMesh.bvh.IsBuilt())
+				continue;
+
+			frame.objects.push_back({ ObjectType::TriangleMesh, i });
+			frame.objectBounds.push_back({ instance.transformedMinAABB, instance.transformedMaxAABB });
+		}
+
+		// Objects only move a little from frame to frame, so refitting is enough most of the time
+		frame.topLevelBVH.Update(frame.objectBounds);
+	}
+
+	float Scene::Intersect_Object(const ObjectReference& object, const Ray& ray, uint32_t& primitiveIndex) const
+	{
+		// Planes are tested through their blocks and never end up in the top level BVH
+		const FrameState& frame{ GetRenderFrame() };
+		switch (object.type)
+		{
+		case ObjectType::Sphere:
+			return GeometryUtils::IntersectSphere(frame.spheres[object.index], ray);
+		case ObjectType::Spheres:
+			return Intersect_Spheres(ray, primitiveIndex);
+		case ObjectType::Triangle:
+		{
+			const Triangle& triangle{ frame.triangles[object.index] };
+			return GeometryUtils::IntersectTriangle(triangle.v0, triangle.v1 - triangle.v0, triangle.v2 - triangle.v0, triangle.cullMode, ray);
+		}
+		case ObjectType::TriangleMesh:
+			return GeometryUtils::ClosestHit_TriangleMesh(m_TriangleMeshGeometries[object.index], frame.meshInstances[object.index], ray, primitiveIndex);
+		default:
+			break;
+		}
+		return FLT_MAX;
+	}
+
+	bool Scene::IsOccluded_Object(const ObjectReference& object, const Ray& ray, OccluderHint& occluder) const
+	{
+		const FrameState& frame{ GetRenderFrame() };
+		bool isOccluded{ false };
+		OccluderHint leaf{ object };
+		switch (object.type)
+		{
+		case ObjectType::Sphere:
+			isOccluded = GeometryUtils::IsOccluded_Sphere(frame.spheres[object.index], ray);
+			break;
+		case ObjectType::Spheres:
+			isOccluded = IsOccluded_Spheres(ray, leaf.object.index);
+			break;
+		case ObjectType::Triangle:
+			isOccluded = GeometryUtils::IsOccluded_Triangle(frame.triangles[object.index], ray);
+			break;
+		case ObjectType::TriangleMesh:
+			isOccluded = GeometryUtils::IsOccluded_TriangleMesh(m_TriangleMeshGeometries[object.index], frame.meshInstances[object.index], ray,
+				leaf.firstReference, leaf.referenceCount);
+			break;
+		default:
+			break;
+		}
+
+		if (isOccluded)
+			occluder = leaf;
+		return isOccluded;
+	}
+
+	bool Scene::IsOccluded_Hint(const OccluderHint& occluder, const Ray& ray) const
+	{
+		const FrameState& frame{ GetRenderFrame() };
+		const uint32_t index{ occluder.object.index };
+		switch (occluder.object.type)
+		{
+		case ObjectType::Sphere:
+			return !frame.sphereBlocks.IsBuilt() && index < frame.spheres.size() && GeometryUtils::IsOccluded_Sphere(frame.spheres[index], ray);
+		case ObjectType::Spheres:
+			return index < frame.sphereBlocks.GetBlocks().size() && GeometryUtils::IsOccluded_SphereBlock(frame.sphereBlocks.GetBlocks()[index], ray);
+		case ObjectType::Triangle:
+			return index < frame.triangles.size() && GeometryUtils::IsOccluded_Triangle(frame.triangles[index], ray);
+		case ObjectType::TriangleMesh:
+		{
+			// Meshes without a BVH leave the leaf empty
+			if (index >= m_TriangleMeshGeometries.size() || occluder.referenceCount == 0)
+				return false;
+
+			const TriangleMesh& mesh{ m_TriangleMeshGeometries[index] };
+			if (occluder.firstReference + occluder.referenceCount > mesh.bvh.GetReferenceCount())
+				return false;
+
+			const Ray objectRay{ GeometryUtils::TransformRayToObjectSpace(frame.meshInstances[index], ray) };
+			return GeometryUtils::IsOccluded_MeshLeaf(mesh, occluder.firstReference, occluder.referenceCount, objectRay);
+		}
+		default:
+			break;
+		}
+		return false;
+	}
+
+	void Scene::HitTest_ObjectPacket(const ObjectReference& object, RayPacket& packet, uint64_t rayMask, HitCandidate* pCandidates) const
+	{
+		const FrameState& frame{ GetRenderFrame() };
+		if (object.type == ObjectType::TriangleMesh)
+		{
+			uint32_t triangleIndices[RayPacket::RayCount];
+			const uint64_t hitMask{ GeometryUtils::HitTest_TriangleMeshPacket(m_TriangleMeshGeometries[object.index], frame.meshInstances[object.index], packet, rayMask, triangleIndices) };
+			for (uint64_t remaining{ hitMask }; remaining != 0; remaining &= remaining - 1)
+			{
+				const uint32_t i{ static_cast<uint32_t>(std::countr_zero(remaining)) };
+				pCandidates[i] = { packet.max[i], object, triangleIndices[i] };
+			}
+			return;
+		}
+
+		if (object.type == ObjectType::Spheres)
+		{
+			const std::vector<SphereBlock>& blocks{ frame.sphereBlocks.GetBlocks() };
+			GeometryUtils::TraverseBVHPacket(frame.sphereBVH, packet, rayMask, [&](uint32_t firstReference, uint32_t referenceCount, uint64_t leafRays, RayPacket& currentPacket)
+				{
+					const uint32_t firstBlock{ frame.sphereBlocks.GetLeafBlockIndex(firstReference) };
+					for (uint64_t remaining{ leafRays }; remaining != 0; remaining &= remaining - 1)
+					{
+						const uint32_t i{ static_cast<uint32_t>(std::countr_zero(remaining)) };
+
+						Ray ray{ currentPacket.GetRay(i) };
+						for (uint32_t blockIndex{ firstBlock }; blockIndex < firstBlock + (referenceCount + SphereBlock::Width - 1) / SphereBlock::Width; ++blockIndex)
+						{
+							uint32_t lane{};
+							const float t{ SphereBlockList::Intersect(blocks[blockIndex], ray, lane) };
+							if (t >= pCandidates[i].t)
+								continue;
+
+							pCandidates[i] = { t, object, blockIndex * SphereBlock::Width + lane };
+							ray.max = t;
+						}
+						currentPacket.max[i] = ray.max;
+					}
+				});
+			return;
+		}
+
+		// Single spheres & triangles are cheap enough to test ray by ray
+		for (uint64_t remaining{ rayMask }; remaining != 0; remaining &= remaining - 1)
+		{
+			const uint32_t i{ static_cast<uint32_t>(std::countr_zero(remaining)) };
+
+			uint32_t primitiveIndex{};
+			const float t{ Intersect_Object(object, packet.GetRay(i), primitiveIndex) };
+			if (t < pCandidates[i].t)
+			{
+				pCandidates[i] = { t, object, primitiveIndex };
+				packet.max[i] = t;
+			}
+		}
+	}
+
+	float Scene::Intersect_Spheres(const Ray& ray, uint32_t& primitiveIndex) const
+	{
+		const FrameState& frame{ GetRenderFrame() };
+		const std::vector<SphereBlock>& blocks{ frame.sphereBlocks.GetBlocks() };
+
+		float closestT{ FLT_MAX };
+		Ray closestRay{ ray };
+		GeometryUtils::TraverseBVH(frame.sphereBVH, closestRay, false, [&](uint32_t firstReference, uint32_t referenceCount, Ray& currentRay)
+			{
+				bool didHit{ false };
+				const uint32_t firstBlock{ frame.sphereBlocks.GetLeafBlockIndex(firstReference) };
+				for (uint32_t blockIndex{ firstBlock }; blockIndex < firstBlock + (referenceCount + SphereBlock::Width - 1) / SphereBlock::Width; ++blockIndex)
+				{
+					uint32_t lane{};
+					const float t{ SphereBlockList::Intersect(blocks[blockIndex], currentRay, lane) };
+					if (t >= closestT)
+						continue;
+
+					closestT = t;
+					primitiveIndex = blockIndex * SphereBlock::Width + lane;
+					currentRay.max = t;
+					didHit = true;
+				}
+				return didHit;
+			});
+		return closestT;
+	}
+
+	bool Scene::IsOccluded_Spheres(const Ray& ray, uint32_t& blockIndex) const
+	{
+		const FrameState& frame{ GetRenderFrame() };
+		return GeometryUtils::TraverseBVHOcclusion(frame.sphereBVH, ray, [&](uint32_t firstReference, uint32_t referenceCount, const Ray& currentRay)
+			{
+				const uint32_t firstBlock{ frame.sphereBlocks.GetLeafBlockIndex(firstReference) };
+				const SphereBlock* pBlock{ &frame.sphereBlocks.GetBlocks()[firstBlock] };
+				for (uint32_t i{}; i < referenceCount; i += SphereBlock::Width, ++pBlock)
+				{
+					if (!GeometryUtils::IsOccluded_SphereBlock(*pBlock, currentRay))
+						continue;
+
+					blockIndex = firstBlock + i / SphereBlock::Width;
+					return true;
+				}
+				return false;
+			});
+	}
+
+	void Scene::GetHitRecord(const HitCandidate& candidate, const Ray& ray, HitRecord& hitRecord) const
+	{
+		hitRecord.t = candidate.t;
+		hitRecord.didHit = true;
+		hitRecord.origin = ray.origin + candidate.t * ray.direction;
+
+		const FrameState& frame{ GetRenderFrame() };
+		const uint32_t index{ candidate.object.index };
+		switch (candidate.object.type)
+		{
+		case ObjectType::Plane:
+		{
+			const PlaneBlock& block{ frame.planeBlocks.GetBlocks()[index / PlaneBlock::Width] };
+			const uint32_t lane{ index % PlaneBlock::Width };
+			hitRecord.normal = { block.normalX[lane], block.normalY[lane], block.normalZ[lane] };
+			hitRecord.materialIndex = block.materialIndex[lane];
+			break;
+		}
+		case ObjectType::Sphere:
+			hitRecord.normal = (hitRecord.origin - frame.spheres[index].origin).Normalized();
+			hitRecord.materialIndex = frame.spheres[index].materialIndex;
+			break;
+		case ObjectType::Spheres:
+		{
+			const SphereBlock& block{ frame.sphereBlocks.GetBlocks()[candidate.primitiveIndex / SphereBlock::Width] };
+			const uint32_t lane{ candidate.primitiveIndex % SphereBlock::Width };
+			const Vector3 sphereOrigin{ block.originX[lane], block.originY[lane], block.originZ[lane] };
+			hitRecord.normal = (hitRecord.origin - sphereOrigin).Normalized();
+			hitRecord.materialIndex = block.materialIndex[lane];
+			break;
+		}
+		case ObjectType::Triangle:
+			hitRecord.normal = frame.triangles[index].normal;
+			hitRecord.materialIndex = frame.triangles[index].materialIndex;
+			break;
+		case ObjectType::TriangleMesh:
+			GeometryUtils::GetHitRecord_MeshTriangle(m_TriangleMeshGeometries[index], frame.meshInstances[index], candidate.primitiveIndex, ray, candidate.t, hitRecord);
+			break;
+		}
+	}
+
+	void Scene::SetSphereBlocksEnabled(bool enabled)
+	{
+		m_UseSphereBlocks = enabled;
+		UpdateAccelerationStructures();
+	}
+
+	void Scene::SetMeshBVHEnabled(bool enabled)
+	{
+		for (TriangleMesh& triangleMesh : m_TriangleMeshGeometries)
+		{
+			triangleMesh.useBVH = enabled;
+		}
+	}
+
+	void Scene::SetSIMDTrianglesEnabled(bool enabled)
+	{
+		for (TriangleMesh& triangleMesh : m_TriangleMeshGeometries)
+		{
+			triangleMesh.useSIMDTriangles = enabled;
+			// The blocks need bigger, aligned leaves, so the BVH gets rebuilt
+			triangleMesh.UpdateGeometry();
+		}
+	}
+
+	void Scene::SetCompactMeshStorageEnabled(bool enabled)
+	{
+		for (TriangleMesh& triangleMesh : m_TriangleMeshGeometries)
+		{
+			triangleMesh.useCompactStorage = enabled;
+			triangleMesh.UpdateGeometry();
+			// The quantized vertices can grow the bounds a little
+			triangleMesh.UpdateTransforms();
+		}
+		UpdateAccelerationStructures();
+	}
+
+	void Scene::SetBVHLayout(BVHLayout layout)
+	{
+		for (TriangleMesh& triangleMesh : m_TriangleMeshGeometries)
+		{
+			triangleMesh.bvhLayout = layout;
+			triangleMesh.UpdateGeometry();
+		}
+	}
+
+	void Scene::SetBVHBuildMode(BVHBuildMode mode)
+	{
+		for (TriangleMesh& triangleMesh : m_TriangleMeshGeometries)
+		{
+			// Released so UpdateGeometry does a full build instead of refitting the old tree, compact meshes still decode with the primitive order
+			triangleMesh.bvh.SetBuildMode(mode);
+			triangleMesh.bvh.ReleaseNodes();
+			triangleMesh.UpdateGeometry();
+		}
+	}
+
+	void Scene::SetBVHNodeOrder(BVHNodeOrder order)
+	{
+		for (TriangleMesh& triangleMesh : m_TriangleMeshGeometries)
+		{
+			triangleMesh.bvh.SetNodeOrder(order);
+			triangleMesh.bvh.ReleaseNodes();
+			triangleMesh.UpdateGeometry();
+		}
+	}
+
 #pragma region Scene Helpers
 	Sphere* Scene::AddSphere(const Vector3& origin, float radius, unsigned char materialIndex)
 	{
@@ -164,9 +673,9 @@ namespace dae {
 		return &m_Lights.back();
 	}
 
-	unsigned char Scene::AddMaterial(Material* pMaterial)
+	unsigned char Scene::AddMaterial(const Material& material)
 	{
-		m_Materials.push_back(pMaterial);
+		m_Materials.push_back(material);
 		return static_cast<unsigned char>(m_Materials.size() - 1);
 	}
 #pragma endregion
@@ -177,10 +686,10 @@ namespace dae {
 	{
 		//default: Material id0 >> SolidColor Material (RED)
 		constexpr unsigned char matId_Solid_Red = 0;
-		const unsigned char matId_Solid_Blue = AddMaterial(new Material_SolidColor{ colors::Blue });
-		const unsigned char matId_Solid_Yellow = AddMaterial(new Material_SolidColor{ colors::Yellow });
-		const unsigned char matId_Solid_Green = AddMaterial(new Material_SolidColor{ colors::Green });
-		const unsigned char matId_Solid_Magenta = AddMaterial(new Material_SolidColor{ colors::Magenta });
+		const unsigned char matId_Solid_Blue = AddMaterial(Material_SolidColor{ colors::Blue });
+		const unsigned char matId_Solid_Yellow = AddMaterial(Material_SolidColor{ colors::Yellow });
+		const unsigned char matId_Solid_Green = AddMaterial(Material_SolidColor{ colors::Green });
+		const unsigned char matId_Solid_Magenta = AddMaterial(Material_SolidColor{ colors::Magenta });
 
 		//Spheres
 		AddSphere({ -25.f, 0.f, 100.f }, 50.f, matId_Solid_Red);
@@ -203,10 +712,10 @@ namespace dae {
 		m_Camera.fovAngle = 45.f;
 		// default : Material id0 >> SolidColor Material ( RED )
 		constexpr unsigned char matId_Solid_Red = 0;
-		const unsigned char matId_Solid_Blue = AddMaterial(new Material_SolidColor{ colors::Blue });
-		const unsigned char matId_Solid_Yellow = AddMaterial(new Material_SolidColor{ colors::Yellow });
-		const unsigned char matId_Solid_Green = AddMaterial(new Material_SolidColor{ colors::Green });
-		const unsigned char matId_Solid_Magenta = AddMaterial(new Material_SolidColor{ colors::Magenta });
+		const unsigned char matId_Solid_Blue = AddMaterial(Material_SolidColor{ colors::Blue });
+		const unsigned char matId_Solid_Yellow = AddMaterial(Material_SolidColor{ colors::Yellow });
+		const unsigned char matId_Solid_Green = AddMaterial(Material_SolidColor{ colors::Green });
+		const unsigned char matId_Solid_Magenta = AddMaterial(Material_SolidColor{ colors::Magenta });
 		// Plane
 		AddPlane({ -5.f ,0.f ,0.f }, { 1.f , 0.f , 0.f }, matId_Solid_Green);
 		AddPlane({ 5.f , 0.f , 0.f }, { -1.f , 0.f , 0.f }, matId_Solid_Green);
@@ -236,14 +745,14 @@ namespace dae {
 		const ColorRGB ballPlasticColor = ColorRGB{ .75f, .75f, .75f };
 		const ColorRGB ballMetalColor = ColorRGB{ .972f, .960f, .915f };
 
-		const auto matWhiteRoughPlastic = AddMaterial(new Material_CookTorrence(ballPlasticColor, 0.f, 1.f));
-		const auto matWhiteMediumPlastic = AddMaterial(new Material_CookTorrence(ballPlasticColor, 0.f, .6f));
-		const auto matWhiteSmoothPlastic = AddMaterial(new Material_CookTorrence(ballPlasticColor, 0.f, .1f));
-		const auto matSilverRoughMetal = AddMaterial(new Material_CookTorrence(ballMetalColor, 1.f, 1.f));
-		const auto matSilverMediumMetal = AddMaterial(new Material_CookTorrence(ballMetalColor, 1.f, .6f));
-		const auto matSilverSmoothMetal = AddMaterial(new Material_CookTorrence(ballMetalColor, 1.f, .1f));
+		const auto matWhiteRoughPlastic = AddMaterial(Material_CookTorrence(ballPlasticColor, 0.f, 1.f));
+		const auto matWhiteMediumPlastic = AddMaterial(Material_CookTorrence(ballPlasticColor, 0.f, .6f));
+		const auto matWhiteSmoothPlastic = AddMaterial(Material_CookTorrence(ballPlasticColor, 0.f, .1f));
+		const auto matSilverRoughMetal = AddMaterial(Material_CookTorrence(ballMetalColor, 1.f, 1.f));
+		const auto matSilverMediumMetal = AddMaterial(Material_CookTorrence(ballMetalColor, 1.f, .6f));
+		const auto matSilverSmoothMetal = AddMaterial(Material_CookTorrence(ballMetalColor, 1.f, .1f));
 
-		const auto matWall = AddMaterial(new Material_Lambert(wallColor, 1.f));
+		const auto matWall = AddMaterial(Material_Lambert(wallColor, 1.f));
 
 		//Spheres
 		AddSphere({ -1.75f, 3.f, .0f }, .75f, matWhiteRoughPlastic);
@@ -273,8 +782,8 @@ namespace dae {
 		m_Camera.origin = { 0.f ,1.f , -5.f };
 		m_Camera.fovAngle = 45.f;
 
-		const auto matLambert_GrayBlue = AddMaterial(new Material_Lambert({ .49f, 0.57f, 0.57f }, 1.0f));
-		const auto matLambert_White = AddMaterial(new Material_Lambert(colors::White, 1.0f));
+		const auto matLambert_GrayBlue = AddMaterial(Material_Lambert({ .49f, 0.57f, 0.57f }, 1.0f));
+		const auto matLambert_White = AddMaterial(Material_Lambert(colors::White, 1.0f));
 
 		//Planes
 		AddPlane(Vector3{ 0.f, 0.f, 10.f }, Vector3{ 0.f,0.f,-1.f }, matLambert_GrayBlue); //BACK
@@ -302,8 +811,8 @@ namespace dae {
 		m_Camera.fovAngle = 45.0f;
 
 		// Materials
-		const auto matLambert_GrayBlue = AddMaterial(new Material_Lambert({ .49f, .57f, .57f }, 1.f));
-		const auto matLambert_White = AddMaterial(new Material_Lambert(ColorRGB(colors::White), 1.f));
+		const auto matLambert_GrayBlue = AddMaterial(Material_Lambert({ .49f, .57f, .57f }, 1.f));
+		const auto matLambert_White = AddMaterial(Material_Lambert(ColorRGB(colors::White), 1.f));
 
 		// Planes
 		AddPlane({ 0.f, 0.f, 10.f }, { 0.f, 0.f, -1.f }, matLambert_GrayBlue);  // BACK
@@ -358,16 +867,16 @@ namespace dae {
 		m_Camera.fovAngle = 45.0f;
 
 		// Materials
-		const auto matCt_GrayRoughMetal = AddMaterial(new Material_CookTorrence({ 0.972f, 0.96f, 0.915f }, 1.f, 1.f));
-		const auto matCt_GrayMediumMetal = AddMaterial(new Material_CookTorrence({ 0.972f, 0.96f, 0.915f }, 1.f, 0.6f));
-		const auto matCt_GraySmoothMetal = AddMaterial(new Material_CookTorrence({ 0.972f, 0.96f, 0.915f }, 1.f, 0.1f));
+		const auto matCt_GrayRoughMetal = AddMaterial(Material_CookTorrence({ 0.972f, 0.96f, 0.915f }, 1.f, 1.f));
+		const auto matCt_GrayMediumMetal = AddMaterial(Material_CookTorrence({ 0.972f, 0.96f, 0.915f }, 1.f, 0.6f));
+		const auto matCt_GraySmoothMetal = AddMaterial(Material_CookTorrence({ 0.972f, 0.96f, 0.915f }, 1.f, 0.1f));
 
-		const auto matCt_GrayRoughPlastic = AddMaterial(new Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 1.f));
-		const auto matCt_GrayMediumPlastic = AddMaterial(new Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 0.6f));
-		const auto matCt_GraySmoothPlastic = AddMaterial(new Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 0.1f));
+		const auto matCt_GrayRoughPlastic = AddMaterial(Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 1.f));
+		const auto matCt_GrayMediumPlastic = AddMaterial(Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 0.6f));
+		const auto matCt_GraySmoothPlastic = AddMaterial(Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 0.1f));
 
-		const auto matLambert_GrayBlue = AddMaterial(new Material_Lambert({ 0.49f, 0.57f, 0.57f }, 1.f));
-		const auto matLambert_White = AddMaterial(new Material_Lambert(colors::White, 1.f));
+		const auto matLambert_GrayBlue = AddMaterial(Material_Lambert({ 0.49f, 0.57f, 0.57f }, 1.f));
+		const auto matLambert_White = AddMaterial(Material_Lambert(colors::White, 1.f));
 
 		// Planes
 		AddPlane({ 0.f, 0.f, 10.f }, { 0.f, 0.f, -1.f }, matLambert_GrayBlue);	// BACK
@@ -436,16 +945,16 @@ namespace dae {
 		m_Camera.fovAngle = 45.0f;
 
 		// Materials
-		const auto matCt_GrayRoughMetal = AddMaterial(new Material_CookTorrence({ 0.972f, 0.96f, 0.915f }, 1.f, 1.f));
-		const auto matCt_GrayMediumMetal = AddMaterial(new Material_CookTorrence({ 0.972f, 0.96f, 0.915f }, 1.f, 0.6f));
-		const auto matCt_GraySmoothMetal = AddMaterial(new Material_CookTorrence({ 0.972f, 0.96f, 0.915f }, 1.f, 0.1f));
+		const auto matCt_GrayRoughMetal = AddMaterial(Material_CookTorrence({ 0.972f, 0.96f, 0.915f }, 1.f, 1.f));
+		const auto matCt_GrayMediumMetal = AddMaterial(Material_CookTorrence({ 0.972f, 0.96f, 0.915f }, 1.f, 0.6f));
+		const auto matCt_GraySmoothMetal = AddMaterial(Material_CookTorrence({ 0.972f, 0.96f, 0.915f }, 1.f, 0.1f));
 
-		const auto matCt_GrayRoughPlastic = AddMaterial(new Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 1.f));
-		const auto matCt_GrayMediumPlastic = AddMaterial(new Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 0.6f));
-		const auto matCt_GraySmoothPlastic = AddMaterial(new Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 0.1f));
+		const auto matCt_GrayRoughPlastic = AddMaterial(Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 1.f));
+		const auto matCt_GrayMediumPlastic = AddMaterial(Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 0.6f));
+		const auto matCt_GraySmoothPlastic = AddMaterial(Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 0.1f));
 
-		const auto matLambert_GrayBlue = AddMaterial(new Material_Lambert({ 0.49f, 0.57f, 0.57f }, 1.f));
-		const auto matLambert_White = AddMaterial(new Material_Lambert(colors::White, 1.f));
+		const auto matLambert_GrayBlue = AddMaterial(Material_Lambert({ 0.49f, 0.57f, 0.57f }, 1.f));
+		const auto matLambert_White = AddMaterial(Material_Lambert(colors::White, 1.f));
 
 		// Planes
 		AddPlane({ 0.f, 0.f, 10.f }, { 0.f, 0.f, -1.f }, matLambert_GrayBlue);	// BACK
@@ -478,5 +987,98 @@ namespace dae {
 		pMesh->RotateY(yawAngle);
 		pMesh->UpdateTransforms();
 	}
-}
 #pragma endregion
+
+#pragma region SCENE STRESS
+	void Scene_SphereField::Initialize()
+	{
+		sceneName = "Sphere Field";
+		m_Camera.origin = { 0.f, 6.f, -12.f };
+		m_Camera.fovAngle = 60.0f;
+
+		// Materials
+		const unsigned char materials[]
+		{
+			AddMaterial(Material_CookTorrence({ 0.972f, 0.96f, 0.915f }, 1.f, 0.6f)),
+			AddMaterial(Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 0.6f)),
+			AddMaterial(Material_Lambert({ 0.49f, 0.57f, 0.57f }, 1.f)),
+			AddMaterial(Material_Lambert(colors::White, 1.f))
+		};
+
+		// Planes
+		AddPlane({ 0.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, materials[2]);	// BOTTOM
+
+		// Spheres
+		const float spacing{ 1.f };
+		const float halfSize{ (m_SphereCountPerSide - 1) * spacing / 2.f };
+		m_SphereGeometries.reserve(m_SphereCountPerSide * m_SphereCountPerSide);
+		for (uint32_t z{}; z < m_SphereCountPerSide; ++z)
+		{
+			for (uint32_t x{}; x < m_SphereCountPerSide; ++x)
+			{
+				AddSphere({ x * spacing - halfSize, 0.4f, z * spacing }, 0.4f, materials[(x + z) % 4]);
+			}
+		}
+
+		// Lights
+		AddPointLight({ 0.f, 20.f, halfSize }, 400.f, { 1.f, .61f, .45f });
+		AddPointLight({ -halfSize, 10.f, -5.f }, 200.f, { 1.f, .8f, .45f });
+		AddPointLight({ halfSize, 10.f, -5.f }, 200.f, { 0.34f, .47f, .68f });
+	}
+
+	void Scene_StretchedTriangles::Initialize()
+	{
+		sceneName = "Stretched Triangles";
+		m_Camera.origin = { 0.f, 3.f, -9.f };
+		m_Camera.fovAngle = 45.0f;
+
+		// Materials
+		const auto matLambert_GrayBlue = AddMaterial(Material_Lambert({ 0.49f, 0.57f, 0.57f }, 1.f));
+		const auto matLambertPhong_Blue = AddMaterial(Material_LambertPhong(colors::Blue, 1.f, 1.f, 60.f));
+
+		// Planes
+		AddPlane({ 0.f, 0.f, 10.f }, { 0.f, 0.f, -1.f }, matLambert_GrayBlue);	// BACK
+		AddPlane({ 0.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, matLambert_GrayBlue);	// BOTTOM
+
+		// Tilted panels cut into long thin strips, like the roof & wall meshes exported from architectural models
+		// Every strip runs diagonally through the scene, so its box covers a big part of the panel
+		constexpr uint32_t panelCount{ 6 };
+		std::mt19937 randomEngine{ 1234 };
+		std::uniform_real_distribution<float> unit{ -1.f, 1.f };
+
+		TriangleMesh* pMesh{ AddTriangleMesh(TriangleCullMode::NoCulling, matLambertPhong_Blue) };
+		pMesh->positions.reserve(m_TriangleCount * 2);
+		pMesh->indices.reserve(m_TriangleCount * 3);
+
+		const uint32_t stripCount{ std::max(1u, m_TriangleCount / (panelCount * 2)) };
+		for (uint32_t panel{}; panel < panelCount; ++panel)
+		{
+			const Vector3 center{ unit(randomEngine) * 2.5f, 3.f + unit(randomEngine) * 1.5f, 5.f + unit(randomEngine) * 3.f };
+			const Vector3 length{ Vector3{ unit(randomEngine), unit(randomEngine), unit(randomEngine) }.Normalized() * 8.f };
+			const Vector3 across{ Vector3::Cross(length, std::abs(length.y) < 7.9f ? Vector3::UnitY : Vector3::UnitX).Normalized() * 4.f };
+
+			for (uint32_t strip{}; strip < stripCount; ++strip)
+			{
+				const Vector3 stripStart{ center - length * 0.5f + across * (static_cast<float>(strip) / stripCount - 0.5f) };
+				const Vector3 stripWidth{ across / static_cast<float>(stripCount) };
+
+				const int startIndex{ static_cast<int>(pMesh->positions.size()) };
+				pMesh->positions.emplace_back(stripStart);
+				pMesh->positions.emplace_back(stripStart + length);
+				pMesh->positions.emplace_back(stripStart + stripWidth);
+				pMesh->positions.emplace_back(stripStart + length + stripWidth);
+				pMesh->indices.insert(pMesh->indices.end(), { startIndex, startIndex + 1, startIndex + 2, startIndex + 2, startIndex + 1, startIndex + 3 });
+			}
+		}
+
+		pMesh->CalculateNormals();
+		pMesh->UpdateAABB();
+		pMesh->UpdateTransforms();
+
+		// Lights
+		AddPointLight({ 0.f, 5.f, 5.f }, 50.f, { 1.f, .61f, .45f }); // BACKLIGHT
+		AddPointLight({ -2.5f, 5.f, -5.f }, 70.f, { 1.f, .8f, .45f }); // FRONT LIGHT LEFT
+		AddPointLight({ 2.5f, 2.5f, -5.f }, 50.f, { 0.34f, .47f, .68f });
+	}
+#pragma endregion
+}
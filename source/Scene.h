@@ -5,6 +5,7 @@
 #include "Math.h"
 #include "DataTypes.h"
 #include "Camera.h"
+#include "Material.h"
 
 namespace dae
 {
@@ -12,17 +13,17 @@ namespace dae
 
 	
 	class Timer;
-	class Material;
 	struct Plane;
 	struct Sphere;
 	struct Light;
+	struct RayPacket;
 
 	//Scene Base Class
 	class Scene
 	{
 	public:
 		Scene();
-		virtual ~Scene();
+		virtual ~Scene() = default;
 
 		Scene(const Scene&) = delete;
 		Scene(Scene&&) noexcept = delete;
@@ -35,14 +36,51 @@ namespace dae
 			m_Camera.Update(pTimer);
 		}
 
+		//Compiles the render-only copy of the geometry the queries run against (SoA planes & spheres, top-level BVH over the bounded objects)
+		//and makes it the frame that gets rendered, call after Initialize and after every Update
+		void UpdateAccelerationStructures();
+		//UpdateAccelerationStructures in two halves, so the next Update can run on another thread while the current frame renders
+		//BuildNextFrame only writes the frame that is not rendered, Update must not touch mesh geometry then (placement only)
+		void BuildNextFrame();
+		//Makes the frame BuildNextFrame compiled the rendered one, call while neither Render nor the update is running
+		void SwapFrames() { m_RenderFrame ^= 1; }
+
 		Camera& GetCamera() { return m_Camera; }
+		//The camera & lights of the rendered frame, Update keeps changing GetCamera in the meantime
+		const Camera& GetFrameCamera() const { return GetRenderFrame().camera; }
+		const std::vector<Light>& GetFrameLights() const { return GetRenderFrame().lights; }
 		void GetClosestHit(const Ray& ray, HitRecord& closestHit) const;
+		//Closest hit of every active ray of a primary-ray packet, pHitRecords has one record per ray of the packet
+		void GetClosestHits(RayPacket& packet, HitRecord* pHitRecords) const;
 		bool DoesHit(const Ray& ray) const;
+		//Callers keep one per light and only pass it back, defined after the class
+		struct OccluderHint;
+		//Shadow ray query, stops at the first blocker and never fills in a hit record
+		//lastOccluder is the leaf that blocked the previous ray towards the same light, it gets tested right after the planes and is replaced on every hit
+		bool IsOccluded(const Ray& ray, OccluderHint& lastOccluder) const;
 
 		const std::vector<Plane>& GetPlaneGeometries() const { return m_PlaneGeometries; }
 		const std::vector<Sphere>& GetSphereGeometries() const { return m_SphereGeometries; }
+		const std::vector<TriangleMesh>& GetTriangleMeshGeometries() const { return m_TriangleMeshGeometries; }
 		const std::vector<Light>& GetLights() const { return m_Lights; }
-		const std::vector<Material*> GetMaterials() const { return m_Materials; }
+		const std::vector<Material>& GetMaterials() const { return m_Materials; }
+
+		//Switches every triangle mesh between BVH traversal and testing all of its triangles
+		void SetMeshBVHEnabled(bool enabled);
+		//Switches BVH leaves between the 8-wide AVX2 triangle test and testing one triangle at a time, CPUs without AVX2 always use the latter
+		void SetSIMDTrianglesEnabled(bool enabled);
+		//Switches every triangle mesh between full precision leaves and 16-bit vertices, indices & normals decoded while tracing
+		void SetCompactMeshStorageEnabled(bool enabled);
+		//Switches the node layout every triangle mesh is traversed with, Wide8 builds the 8-wide BVH on top of the binary one
+		void SetBVHLayout(BVHLayout layout);
+		//Rebuilds the BVH of every triangle mesh with the given build mode
+		void SetBVHBuildMode(BVHBuildMode mode);
+		//Rebuilds the BVH of every triangle mesh with its nodes laid out in the given order
+		void SetBVHNodeOrder(BVHNodeOrder order);
+		//Switches between the top-level BVH and testing every object of the scene
+		void SetTopLevelBVHEnabled(bool enabled) { m_UseTopLevelBVH = enabled; }
+		//Switches between tracing the spheres 8 at a time from their own BVH and putting every sphere in the top-level BVH
+		void SetSphereBlocksEnabled(bool enabled);
 
 	protected:
 		std::string	sceneName;
@@ -51,7 +89,7 @@ namespace dae
 		std::vector<Sphere> m_SphereGeometries{};
 		std::vector<TriangleMesh> m_TriangleMeshGeometries{};
 		std::vector<Light> m_Lights{};
-		std::vector<Material*> m_Materials{};
+		std::vector<Material> m_Materials{};
 
 		//Temp
 		std::vector<Triangle> m_Triangles{};
@@ -64,7 +102,92 @@ namespace dae
 
 		Light* AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color);
 		Light* AddDirectionalLight(const Vector3& direction, float intensity, const ColorRGB& color);
-		unsigned char AddMaterial(Material* pMaterial);
+		unsigned char AddMaterial(const Material& material);
+
+	private:
+		//Bounded objects the top-level BVH is built over, planes are infinite and stay in their own list
+		enum class ObjectType : uint8_t
+		{
+			// Only referenced by hit candidates, never part of the top-level BVH
+			Plane,
+			Sphere,
+			// All spheres at once, traced through m_SphereBVH
+			Spheres,
+			Triangle,
+			TriangleMesh
+		};
+
+		struct ObjectReference
+		{
+			ObjectType type{};
+			uint32_t index{};
+		};
+
+		//The closest hit of a query so far, only the distance & what was hit
+		//Position, normal & material are evaluated once for the final one by GetHitRecord
+		struct HitCandidate
+		{
+			float t{ FLT_MAX };
+			ObjectReference object{};
+			// Triangle of a mesh, or block * SphereBlock::Width + lane for the sphere blocks
+			uint32_t primitiveIndex{};
+		};
+
+		//Everything the queries read that Update & UpdateAccelerationStructures write, one copy renders while the other one is compiled
+		//Mesh geometry is shared by both, only the placement of the meshes is copied
+		struct FrameState
+		{
+			Camera camera{};
+			std::vector<Light> lights{};
+
+			//Every plane in SoA blocks of 8, in the order of m_PlaneGeometries
+			PlaneBlockList planeBlocks{};
+
+			//The spheres in SoA blocks of 8, packed in the leaf order of their own BVH whose leaves hold up to a block each
+			BVH sphereBVH{};
+			SphereBlockList sphereBlocks{};
+			//Copy of m_SphereGeometries when the spheres are not in blocks
+			std::vector<Sphere> spheres{};
+
+			std::vector<Triangle> triangles{};
+			//One per mesh of m_TriangleMeshGeometries
+			std::vector<MeshInstance> meshInstances{};
+
+			BVH topLevelBVH{};
+			std::vector<ObjectReference> objects{};
+			std::vector<AABB> objectBounds{};
+		};
+
+		const FrameState& GetRenderFrame() const { return m_Frames[m_RenderFrame]; }
+
+		//Distance to the closest hit of the object between ray.min and ray.max, FLT_MAX on a miss
+		float Intersect_Object(const ObjectReference& object, const Ray& ray, uint32_t& primitiveIndex) const;
+		//Fills in the leaf that blocked the ray
+		bool IsOccluded_Object(const ObjectReference& object, const Ray& ray, OccluderHint& occluder) const;
+		bool IsOccluded_Hint(const OccluderHint& occluder, const Ray& ray) const;
+		void HitTest_ObjectPacket(const ObjectReference& object, RayPacket& packet, uint64_t rayMask, HitCandidate* pCandidates) const;
+		float Intersect_Spheres(const Ray& ray, uint32_t& primitiveIndex) const;
+		bool IsOccluded_Spheres(const Ray& ray, uint32_t& blockIndex) const;
+		void GetHitRecord(const HitCandidate& candidate, const Ray& ray, HitRecord& hitRecord) const;
+
+		FrameState m_Frames[2]{};
+		uint32_t m_RenderFrame{};
+
+		bool m_UseTopLevelBVH{ true };
+		bool m_UseSphereBlocks{ true };
+		//Scratch for BuildNextFrame
+		std::vector<AABB> m_SphereBounds{};
+	};
+
+	//One sphere or triangle, a block of the sphere blocks, or a leaf of a mesh BVH
+	//Only a guess, an index that went stale still tests a real primitive of the render frame or is skipped
+	struct Scene::OccluderHint
+	{
+		// Plane while nothing was blocked yet, the planes are tested anyway
+		ObjectReference object{ ObjectType::Plane, 0 };
+		// Leaf of a mesh BVH
+		uint32_t firstReference{};
+		uint32_t referenceCount{};
 	};
 
 	//+++++++++++++++++++++++++++++++++++++++++
@@ -183,4 +306,40 @@ namespace dae
 		TriangleMesh* pMesh{ nullptr };
 
 	};
+
+	//Stress Scene: a large grid of spheres on a floor, to measure how the cost per ray scales with the object count
+	class Scene_SphereField final : public Scene
+	{
+	public:
+		Scene_SphereField(uint32_t sphereCountPerSide = 64) : m_SphereCountPerSide(sphereCountPerSide) {}
+		~Scene_SphereField() override = default;
+
+		Scene_SphereField(const Scene_SphereField&) = delete;
+		Scene_SphereField(Scene_SphereField&&) noexcept = delete;
+		Scene_SphereField& operator=(const Scene_SphereField&) = delete;
+		Scene_SphereField& operator=(Scene_SphereField&&) noexcept = delete;
+
+		void Initialize() override;
+
+	private:
+		uint32_t m_SphereCountPerSide;
+	};
+
+	//Stress Scene: long thin triangles at random angles, their boxes overlap a lot when only objects are split
+	class Scene_StretchedTriangles final : public Scene
+	{
+	public:
+		Scene_StretchedTriangles(uint32_t triangleCount = 4000) : m_TriangleCount(triangleCount) {}
+		~Scene_StretchedTriangles() override = default;
+
+		Scene_StretchedTriangles(const Scene_StretchedTriangles&) = delete;
+		Scene_StretchedTriangles(Scene_StretchedTriangles&&) noexcept = delete;
+		Scene_StretchedTriangles& operator=(const Scene_StretchedTriangles&) = delete;
+		Scene_StretchedTriangles& operator=(Scene_StretchedTriangles&&) noexcept = delete;
+
+		void Initialize() override;
+
+	private:
+		uint32_t m_TriangleCount;
+	};
 }
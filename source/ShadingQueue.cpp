@@ -0,0 +1,66 @@
+#include "ShadingQueue.h"
+
+#include <algorithm>
+#include <bit>
+#include <iterator>
+
+namespace dae {
+
+	void ShadingQueue::Build(const RayPacket& packet, const HitRecord* pHits)
+	{
+		constexpr uint8_t NoBatch{ 0xFF };
+		uint8_t batchOfMaterial[256];
+		std::fill(std::begin(batchOfMaterial), std::end(batchOfMaterial), NoBatch);
+
+		//Count the hits per material, a material gets its batch at its first hit
+		batchCount = 0;
+		entryCount = 0;
+		for (uint64_t remaining{ packet.activeMask }; remaining != 0; remaining &= remaining - 1)
+		{
+			const HitRecord& hit{ pHits[std::countr_zero(remaining)] };
+			if (!hit.didHit)
+				continue;
+
+			uint8_t& batchIndex{ batchOfMaterial[hit.materialIndex] };
+			if (batchIndex == NoBatch)
+			{
+				batchIndex = static_cast<uint8_t>(batchCount);
+				batches[batchCount++] = { 0, 0, hit.materialIndex };
+			}
+			++batches[batchIndex].count;
+			++entryCount;
+		}
+
+		uint32_t first{};
+		for (uint32_t i{}; i < batchCount; ++i)
+		{
+			batches[i].first = first;
+			first += batches[i].count;
+			batches[i].count = 0;
+		}
+
+		//Scatter, the counts are rebuilt while the batches fill up
+		for (uint64_t remaining{ packet.activeMask }; remaining != 0; remaining &= remaining - 1)
+		{
+			const uint32_t i{ static_cast<uint32_t>(std::countr_zero(remaining)) };
+			const HitRecord& hit{ pHits[i] };
+			if (!hit.didHit)
+				continue;
+
+			ShadingBatch& batch{ batches[batchOfMaterial[hit.materialIndex]] };
+			const uint32_t entry{ batch.first + batch.count++ };
+
+			originX[entry] = hit.origin.x;
+			originY[entry] = hit.origin.y;
+			originZ[entry] = hit.origin.z;
+			normalX[entry] = hit.normal.x;
+			normalY[entry] = hit.normal.y;
+			normalZ[entry] = hit.normal.z;
+			viewX[entry] = -packet.directionX[i];
+			viewY[entry] = -packet.directionY[i];
+			viewZ[entry] = -packet.directionZ[i];
+			t[entry] = hit.t;
+			rayIndex[entry] = static_cast<uint8_t>(i);
+		}
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+
+#include "DataTypes.h"
+#include "RayPacket.h"
+
+namespace dae
+{
+	//Run of queue entries that all use the same material
+	struct ShadingBatch
+	{
+		uint32_t first{};
+		uint32_t count{};
+		unsigned char materialIndex{};
+	};
+
+	//Compact G-buffer of the hits of one 8x8 tile, bucketed by material so every material is shaded in one homogeneous batch
+	//The entries are stored SoA, inside a batch they keep the row-major order of their pixels
+	struct alignas(32) ShadingQueue
+	{
+		static constexpr uint32_t Capacity{ RayPacket::RayCount };
+
+		float originX[Capacity]{};
+		float originY[Capacity]{};
+		float originZ[Capacity]{};
+		float normalX[Capacity]{};
+		float normalY[Capacity]{};
+		float normalZ[Capacity]{};
+		// Towards the camera, the v every material shades with
+		float viewX[Capacity]{};
+		float viewY[Capacity]{};
+		float viewZ[Capacity]{};
+		float t[Capacity]{};
+		// Ray of the packet the entry came from (row-major in the tile)
+		uint8_t rayIndex[Capacity]{};
+
+		// In order of the first pixel that uses the material
+		ShadingBatch batches[Capacity]{};
+		uint32_t batchCount{};
+		uint32_t entryCount{};
+
+		//Queues the hits of the active rays of the packet with a counting sort on their material, misses are left out
+		void Build(const RayPacket& packet, const HitRecord* pHits);
+
+		HitRecord GetHitRecord(const ShadingBatch& batch, uint32_t entry) const
+		{
+			return { { originX[entry], originY[entry], originZ[entry] }, { normalX[entry], normalY[entry], normalZ[entry] }, t[entry], true, batch.materialIndex };
+		}
+
+		Vector3 GetViewDirection(uint32_t entry) const { return { viewX[entry], viewY[entry], viewZ[entry] }; }
+	};
+}
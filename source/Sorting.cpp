@@ -0,0 +1,91 @@
+#include "Sorting.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "ppl.h"
+
+namespace dae {
+
+	namespace
+	{
+		// Spreads the lower 10 bits out so there are 2 zero bits between each of them
+		uint32_t ExpandBits(uint32_t value)
+		{
+			value = (value * 0x00010001u) & 0xFF0000FFu;
+			value = (value * 0x00000101u) & 0x0F00F00Fu;
+			value = (value * 0x00000011u) & 0xC30C30C3u;
+			value = (value * 0x00000005u) & 0x49249249u;
+			return value;
+		}
+	}
+
+	uint32_t Sorting::GetMortonCode(float x, float y, float z)
+	{
+		const auto quantize{ [](float value) { return static_cast<uint32_t>(std::clamp(value * 1024.f, 0.f, 1023.f)); } };
+		return ExpandBits(quantize(x)) * 4 + ExpandBits(quantize(y)) * 2 + ExpandBits(quantize(z));
+	}
+
+	void Sorting::RadixSort(std::vector<uint32_t>& keys, std::vector<uint32_t>& values, uint32_t keyBits, bool parallel)
+	{
+		constexpr uint32_t DigitBits{ 8 };
+		constexpr uint32_t DigitCount{ 1 << DigitBits };
+
+		const uint32_t count{ static_cast<uint32_t>(keys.size()) };
+		const uint32_t chunkCount{ parallel ? std::min(count, std::max(1u, std::thread::hardware_concurrency()) * 4) : 1u };
+
+		std::vector<uint32_t> sortedKeys(count);
+		std::vector<uint32_t> sortedValues(count);
+		std::vector<uint32_t> offsets(size_t{ chunkCount } * DigitCount);
+
+		const auto getChunkRange{ [&](uint32_t chunk, uint32_t& begin, uint32_t& end)
+			{
+				begin = static_cast<uint32_t>(uint64_t{ count } * chunk / chunkCount);
+				end = static_cast<uint32_t>(uint64_t{ count } * (chunk + 1) / chunkCount);
+			} };
+
+		for (uint32_t shift{}; shift < keyBits; shift += DigitBits)
+		{
+			std::fill(offsets.begin(), offsets.end(), 0);
+			concurrency::parallel_for(0u, chunkCount, [&](uint32_t chunk)
+				{
+					uint32_t begin{}, end{};
+					getChunkRange(chunk, begin, end);
+					uint32_t* chunkOffsets{ &offsets[size_t{ chunk } * DigitCount] };
+					for (uint32_t i{ begin }; i < end; ++i)
+					{
+						++chunkOffsets[(keys[i] >> shift) & (DigitCount - 1)];
+					}
+				});
+
+			// Exclusive prefix sum, digit major, so chunk c writes a digit right after chunk c - 1 did
+			uint32_t sum{};
+			for (uint32_t digit{}; digit < DigitCount; ++digit)
+			{
+				for (uint32_t chunk{}; chunk < chunkCount; ++chunk)
+				{
+					uint32_t& offset{ offsets[size_t{ chunk } * DigitCount + digit] };
+					const uint32_t digitCount{ offset };
+					offset = sum;
+					sum += digitCount;
+				}
+			}
+
+			concurrency::parallel_for(0u, chunkCount, [&](uint32_t chunk)
+				{
+					uint32_t begin{}, end{};
+					getChunkRange(chunk, begin, end);
+					uint32_t* chunkOffsets{ &offsets[size_t{ chunk } * DigitCount] };
+					for (uint32_t i{ begin }; i < end; ++i)
+					{
+						const uint32_t destination{ chunkOffsets[(keys[i] >> shift) & (DigitCount - 1)]++ };
+						sortedKeys[destination] = keys[i];
+						sortedValues[destination] = values[i];
+					}
+				});
+
+			keys.swap(sortedKeys);
+			values.swap(sortedValues);
+		}
+	}
+}
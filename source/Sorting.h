@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace dae
+{
+	namespace Sorting
+	{
+		//30 bit Morton code of a point inside the unit cube, coordinates outside of it are clamped
+		uint32_t GetMortonCode(float x, float y, float z);
+
+		/**
+		 * \brief Stable LSD radix sort of the keys (and the values along with them), 8 bits per pass
+		 * Every chunk counts & scatters its own part, the prefix sums over all chunks keep the order stable
+		 * \param keyBits only the lowest keyBits bits of the keys are sorted on
+		 */
+		void RadixSort(std::vector<uint32_t>& keys, std::vector<uint32_t>& values, uint32_t keyBits, bool parallel);
+	}
+}
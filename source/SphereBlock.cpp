@@ -0,0 +1,115 @@
+#include "SphereBlock.h"
+
+#include <cassert>
+#include <cmath>
+
+#include "DataTypes.h"
+#include "SIMD.h"
+
+namespace dae {
+
+	namespace
+	{
+		// With a normalized direction a = 1, so t = -b -+ sqrt(b * b - c) where b is half the usual one
+		DAE_AVX2_EXACT_FUNCTION float Intersect_AVX2(const SphereBlock& block, const Ray& ray, uint32_t& lane)
+		{
+			const __m256 offsetX{ _mm256_sub_ps(_mm256_set1_ps(ray.origin.x), _mm256_load_ps(block.originX)) };
+			const __m256 offsetY{ _mm256_sub_ps(_mm256_set1_ps(ray.origin.y), _mm256_load_ps(block.originY)) };
+			const __m256 offsetZ{ _mm256_sub_ps(_mm256_set1_ps(ray.origin.z), _mm256_load_ps(block.originZ)) };
+
+			const __m256 b{ _mm256_add_ps(_mm256_add_ps(
+				_mm256_mul_ps(_mm256_set1_ps(ray.direction.x), offsetX),
+				_mm256_mul_ps(_mm256_set1_ps(ray.direction.y), offsetY)),
+				_mm256_mul_ps(_mm256_set1_ps(ray.direction.z), offsetZ)) };
+			const __m256 c{ _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(
+				_mm256_mul_ps(offsetX, offsetX),
+				_mm256_mul_ps(offsetY, offsetY)),
+				_mm256_mul_ps(offsetZ, offsetZ)),
+				_mm256_load_ps(block.radiusSquared)) };
+
+			const __m256 discriminant{ _mm256_sub_ps(_mm256_mul_ps(b, b), c) };
+			__m256 valid{ _mm256_cmp_ps(discriminant, _mm256_setzero_ps(), _CMP_GT_OQ) };
+			if (_mm256_movemask_ps(valid) == 0)
+				return FLT_MAX;
+
+			// The far side is only used by lanes whose near side lies before ray.min (the ray starts inside the sphere)
+			const __m256 rayMin{ _mm256_set1_ps(ray.min) };
+			const __m256 sqrtDiscriminant{ _mm256_sqrt_ps(discriminant) };
+			const __m256 nearT{ _mm256_sub_ps(_mm256_sub_ps(_mm256_setzero_ps(), b), sqrtDiscriminant) };
+			const __m256 farT{ _mm256_add_ps(_mm256_sub_ps(_mm256_setzero_ps(), b), sqrtDiscriminant) };
+			const __m256 t{ _mm256_blendv_ps(nearT, farT, _mm256_cmp_ps(nearT, rayMin, _CMP_LT_OQ)) };
+
+			valid = _mm256_and_ps(valid, _mm256_and_ps(
+				_mm256_cmp_ps(t, rayMin, _CMP_GE_OQ),
+				_mm256_cmp_ps(t, _mm256_set1_ps(ray.max), _CMP_LE_OQ)));
+
+			return SIMD::NearestLane(t, valid, lane);
+		}
+
+		float Intersect_Scalar(const SphereBlock& block, const Ray& ray, uint32_t& lane)
+		{
+			float nearestT{ FLT_MAX };
+			for (uint32_t i{}; i < SphereBlock::Width; ++i)
+			{
+				const Vector3 offset{ ray.origin.x - block.originX[i], ray.origin.y - block.originY[i], ray.origin.z - block.originZ[i] };
+				const float b{ Vector3::Dot(ray.direction, offset) };
+				const float c{ Vector3::Dot(offset, offset) - block.radiusSquared[i] };
+
+				const float discriminant{ b * b - c };
+				if (discriminant <= 0.f)
+					continue;
+
+				const float sqrtDiscriminant{ sqrtf(discriminant) };
+				float t{ -b - sqrtDiscriminant };
+				if (t < ray.min)
+					t = -b + sqrtDiscriminant;
+
+				if (t >= ray.min && t <= ray.max && t < nearestT)
+				{
+					nearestT = t;
+					lane = i;
+				}
+			}
+			return nearestT;
+		}
+	}
+
+	void SphereBlockList::Build(const BVH& bvh, const std::vector<Sphere>& spheres)
+	{
+		Clear();
+		if (!bvh.HasNodes())
+			return;
+
+		assert(bvh.GetLeafAlignment() == SphereBlock::Width && "Leaves have to start a block of their own");
+
+		// The aligned primitive order always fills whole blocks
+		const std::vector<uint32_t>& references{ bvh.GetPrimitiveIndices() };
+		m_Blocks.resize(references.size() / SphereBlock::Width);
+
+		for (size_t i{}; i < references.size(); ++i)
+		{
+			const Sphere& sphere{ spheres[references[i]] };
+
+			SphereBlock& block{ m_Blocks[i / SphereBlock::Width] };
+			const size_t lane{ i % SphereBlock::Width };
+			block.originX[lane] = sphere.origin.x;
+			block.originY[lane] = sphere.origin.y;
+			block.originZ[lane] = sphere.origin.z;
+			block.radiusSquared[lane] = sphere.radius * sphere.radius;
+			block.materialIndex[lane] = sphere.materialIndex;
+		}
+	}
+
+	void SphereBlockList::Clear()
+	{
+		m_Blocks.clear();
+	}
+
+	float SphereBlockList::Intersect(const SphereBlock& block, const Ray& ray, uint32_t& lane)
+	{
+		if (SIMD::HasAVX2())
+			return Intersect_AVX2(block, ray, lane);
+
+		return Intersect_Scalar(block, ray, lane);
+	}
+}
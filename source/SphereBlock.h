@@ -0,0 +1,54 @@
+#pragma once
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+#include "BVH.h"
+
+namespace dae
+{
+	struct Ray;
+	struct Sphere;
+
+	// 8 spheres of a BVH leaf stored SoA, one ray gets tested against all of them in a single AVX2 pass (160 bytes)
+	// Leaves are padded by repeating their last sphere, lanes of a default block get a negative squared radius so their discriminant is never positive
+	struct alignas(32) SphereBlock
+	{
+		static constexpr uint32_t Width{ 8 };
+
+		float originX[Width]{};
+		float originY[Width]{};
+		float originZ[Width]{};
+		float radiusSquared[Width]{ -FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+		unsigned char materialIndex[Width]{};
+	};
+
+	//The primitive order of a BVH cut into blocks of 8, block i holds references 8 * i up to 8 * i + 7
+	//The BVH has to be built with leaves aligned to the block width, so every leaf starts a block of its own
+	class SphereBlockList final
+	{
+	public:
+		void Build(const BVH& bvh, const std::vector<Sphere>& spheres);
+		void Clear();
+
+		bool IsBuilt() const { return !m_Blocks.empty(); }
+
+		//First block of the leaf whose references start at firstReference, the leaf has (referenceCount + 7) / 8 of them
+		const SphereBlock* GetLeafBlocks(uint32_t firstReference) const { return &m_Blocks[firstReference / SphereBlock::Width]; }
+		uint32_t GetLeafBlockIndex(uint32_t firstReference) const { return firstReference / SphereBlock::Width; }
+		//Every sphere is in at least one block (padded leaves repeat their last one), for testing all of them without the BVH
+		const std::vector<SphereBlock>& GetBlocks() const { return m_Blocks; }
+
+		/**
+		 * \brief Ray against all 8 spheres of the block at once, falls back to one lane at a time without AVX2
+		 * The ray direction has to be normalized, the quadratic is solved with a = 1
+		 * \param lane receives the lane of the nearest hit
+		 * \return distance to the nearest hit between ray.min and ray.max, FLT_MAX when no lane was hit
+		 */
+		static float Intersect(const SphereBlock& block, const Ray& ray, uint32_t& lane);
+
+	private:
+		std::vector<SphereBlock> m_Blocks{};
+	};
+}
@@ -0,0 +1,143 @@
+#include "TriangleBlock.h"
+
+#include <cassert>
+
+#include "DataTypes.h"
+#include "SIMD.h"
+
+namespace dae {
+
+	namespace
+	{
+		// Same operations in the same order as Vector3::Cross & Vector3::Dot, so every lane matches the scalar test
+		// Stretched triangles are badly conditioned, a fused multiply-add there moves the distance visibly
+		DAE_AVX2_EXACT_FUNCTION inline void Cross(__m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz, __m256& x, __m256& y, __m256& z)
+		{
+			x = _mm256_sub_ps(_mm256_mul_ps(ay, bz), _mm256_mul_ps(az, by));
+			y = _mm256_sub_ps(_mm256_mul_ps(az, bx), _mm256_mul_ps(ax, bz));
+			z = _mm256_sub_ps(_mm256_mul_ps(ax, by), _mm256_mul_ps(ay, bx));
+		}
+
+		DAE_AVX2_EXACT_FUNCTION inline __m256 Dot(__m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz)
+		{
+			return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, bx), _mm256_mul_ps(ay, by)), _mm256_mul_ps(az, bz));
+		}
+
+		// Lanes hit between ray.min and ray.max, t receives the distance of every lane
+		template<TriangleCullMode CullMode>
+		DAE_AVX2_EXACT_FUNCTION inline __m256 GetHitMask_AVX2(const TriangleBlock& block, const Ray& ray, __m256& t)
+		{
+			const __m256 directionX{ _mm256_set1_ps(ray.direction.x) };
+			const __m256 directionY{ _mm256_set1_ps(ray.direction.y) };
+			const __m256 directionZ{ _mm256_set1_ps(ray.direction.z) };
+
+			const __m256 edge1X{ _mm256_load_ps(block.edge1X) };
+			const __m256 edge1Y{ _mm256_load_ps(block.edge1Y) };
+			const __m256 edge1Z{ _mm256_load_ps(block.edge1Z) };
+			const __m256 edge2X{ _mm256_load_ps(block.edge2X) };
+			const __m256 edge2Y{ _mm256_load_ps(block.edge2Y) };
+			const __m256 edge2Z{ _mm256_load_ps(block.edge2Z) };
+
+			__m256 hX, hY, hZ;
+			Cross(directionX, directionY, directionZ, edge2X, edge2Y, edge2Z, hX, hY, hZ);
+			const __m256 a{ Dot(edge1X, edge1Y, edge1Z, hX, hY, hZ) };
+
+			// Only the sides that are not culled get compared, degenerate (and padding) lanes fail every test
+			__m256 valid{};
+			if constexpr (CullMode == TriangleCullMode::BackFaceCulling)
+				valid = _mm256_cmp_ps(a, _mm256_set1_ps(FLT_EPSILON), _CMP_GT_OQ);
+			else if constexpr (CullMode == TriangleCullMode::FrontFaceCulling)
+				valid = _mm256_cmp_ps(a, _mm256_set1_ps(-FLT_EPSILON), _CMP_LT_OQ);
+			else
+				valid = _mm256_or_ps(
+					_mm256_cmp_ps(a, _mm256_set1_ps(-FLT_EPSILON), _CMP_LT_OQ),
+					_mm256_cmp_ps(a, _mm256_set1_ps(FLT_EPSILON), _CMP_GT_OQ));
+
+			const __m256 zero{ _mm256_setzero_ps() };
+			const __m256 one{ _mm256_set1_ps(1.f) };
+			const __m256 f{ _mm256_div_ps(one, a) };
+
+			const __m256 sX{ _mm256_sub_ps(_mm256_set1_ps(ray.origin.x), _mm256_load_ps(block.v0X)) };
+			const __m256 sY{ _mm256_sub_ps(_mm256_set1_ps(ray.origin.y), _mm256_load_ps(block.v0Y)) };
+			const __m256 sZ{ _mm256_sub_ps(_mm256_set1_ps(ray.origin.z), _mm256_load_ps(block.v0Z)) };
+			const __m256 u{ _mm256_mul_ps(f, Dot(sX, sY, sZ, hX, hY, hZ)) };
+			valid = _mm256_andnot_ps(_mm256_or_ps(_mm256_cmp_ps(u, zero, _CMP_LT_OQ), _mm256_cmp_ps(u, one, _CMP_GT_OQ)), valid);
+
+			__m256 qX, qY, qZ;
+			Cross(sX, sY, sZ, edge1X, edge1Y, edge1Z, qX, qY, qZ);
+			const __m256 v{ _mm256_mul_ps(f, Dot(directionX, directionY, directionZ, qX, qY, qZ)) };
+			valid = _mm256_andnot_ps(_mm256_or_ps(_mm256_cmp_ps(v, zero, _CMP_LT_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_GT_OQ)), valid);
+
+			t = _mm256_mul_ps(f, Dot(edge2X, edge2Y, edge2Z, qX, qY, qZ));
+			return _mm256_and_ps(valid, _mm256_and_ps(
+				_mm256_cmp_ps(t, _mm256_set1_ps(ray.min), _CMP_GT_OQ),
+				_mm256_cmp_ps(t, _mm256_set1_ps(ray.max), _CMP_LT_OQ)));
+		}
+
+		template<TriangleCullMode CullMode>
+		DAE_AVX2_EXACT_FUNCTION float Intersect_AVX2(const TriangleBlock& block, const Ray& ray, uint32_t& lane)
+		{
+			__m256 t;
+			const __m256 valid{ GetHitMask_AVX2<CullMode>(block, ray, t) };
+			return SIMD::NearestLane(t, valid, lane);
+		}
+
+		DAE_AVX2_EXACT_FUNCTION bool IntersectAny_AVX2(const TriangleBlock& block, const Ray& ray)
+		{
+			__m256 t;
+			return _mm256_movemask_ps(GetHitMask_AVX2<TriangleCullMode::NoCulling>(block, ray, t)) != 0;
+		}
+	}
+
+	void TriangleBlockList::Build(const BVH& bvh, const std::vector<Vector3>& positions, const std::vector<int>& indices)
+	{
+		Clear();
+		assert(bvh.GetLeafAlignment() == TriangleBlock::Width && "Leaves have to start a block of their own");
+
+		// The aligned primitive order always fills whole blocks
+		const std::vector<uint32_t>& references{ bvh.GetPrimitiveIndices() };
+		m_Blocks.resize(references.size() / TriangleBlock::Width);
+
+		for (size_t i{}; i < references.size(); ++i)
+		{
+			const uint32_t triangleIndex{ references[i] };
+			const size_t firstIndex{ triangleIndex * size_t{ 3 } };
+			const Vector3& v0{ positions[indices[firstIndex]] };
+			const Vector3 edge1{ positions[indices[firstIndex + 1]] - v0 };
+			const Vector3 edge2{ positions[indices[firstIndex + 2]] - v0 };
+
+			TriangleBlock& block{ m_Blocks[i / TriangleBlock::Width] };
+			const size_t lane{ i % TriangleBlock::Width };
+			block.v0X[lane] = v0.x;
+			block.v0Y[lane] = v0.y;
+			block.v0Z[lane] = v0.z;
+			block.edge1X[lane] = edge1.x;
+			block.edge1Y[lane] = edge1.y;
+			block.edge1Z[lane] = edge1.z;
+			block.edge2X[lane] = edge2.x;
+			block.edge2Y[lane] = edge2.y;
+			block.edge2Z[lane] = edge2.z;
+			block.triangleIndex[lane] = triangleIndex;
+		}
+	}
+
+	void TriangleBlockList::Clear()
+	{
+		m_Blocks.clear();
+	}
+
+	template<TriangleCullMode CullMode>
+	float TriangleBlockList::Intersect(const TriangleBlock& block, const Ray& ray, uint32_t& lane)
+	{
+		return Intersect_AVX2<CullMode>(block, ray, lane);
+	}
+
+	template float TriangleBlockList::Intersect<TriangleCullMode::FrontFaceCulling>(const TriangleBlock& block, const Ray& ray, uint32_t& lane);
+	template float TriangleBlockList::Intersect<TriangleCullMode::BackFaceCulling>(const TriangleBlock& block, const Ray& ray, uint32_t& lane);
+	template float TriangleBlockList::Intersect<TriangleCullMode::NoCulling>(const TriangleBlock& block, const Ray& ray, uint32_t& lane);
+
+	bool TriangleBlockList::IntersectAny(const TriangleBlock& block, const Ray& ray)
+	{
+		return IntersectAny_AVX2(block, ray);
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "BVH.h"
+
+namespace dae
+{
+	struct Ray;
+	enum class TriangleCullMode;
+
+	// 8 triangles of a BVH leaf stored SoA, one ray gets tested against all of them in a single AVX2 pass (320 bytes, 5 cache lines)
+	// Lanes past the end of a leaf repeat its last triangle, the same hit twice never changes the result
+	struct alignas(32) TriangleBlock
+	{
+		static constexpr uint32_t Width{ 8 };
+
+		float v0X[Width]{};
+		float v0Y[Width]{};
+		float v0Z[Width]{};
+		float edge1X[Width]{}; // v1 - v0
+		float edge1Y[Width]{};
+		float edge1Z[Width]{};
+		float edge2X[Width]{}; // v2 - v0
+		float edge2Y[Width]{};
+		float edge2Z[Width]{};
+
+		uint32_t triangleIndex[Width]{}; // Into indices / 3 & normals, only looked up for the final hit
+	};
+
+	//The primitive order of a BVH cut into blocks of 8, block i holds references 8 * i up to 8 * i + 7
+	//The BVH has to be built with leaves aligned to the block width, so every leaf starts a block of its own
+	class TriangleBlockList final
+	{
+	public:
+		void Build(const BVH& bvh, const std::vector<Vector3>& positions, const std::vector<int>& indices);
+		void Clear();
+
+		bool IsBuilt() const { return !m_Blocks.empty(); }
+
+		//First block of the leaf whose references start at firstReference, the leaf has (referenceCount + 7) / 8 of them
+		const TriangleBlock* GetLeafBlocks(uint32_t firstReference) const { return &m_Blocks[firstReference / TriangleBlock::Width]; }
+		size_t GetMemoryUsage() const { return m_Blocks.size() * sizeof(TriangleBlock); }
+
+		/**
+		 * \brief Möller-Trumbore against all 8 triangles of the block at once, AVX2 only (check SIMD::HasAVX2 first)
+		 * \tparam CullMode side every lane skips, compiled into the kernel so the mesh picks it once instead of masking per call
+		 * \param lane receives the lane of the nearest hit
+		 * \return distance to the nearest hit between ray.min and ray.max, FLT_MAX when no lane was hit
+		 */
+		template<TriangleCullMode CullMode>
+		static float Intersect(const TriangleBlock& block, const Ray& ray, uint32_t& lane);
+		//Any lane hit from either side between ray.min and ray.max, for shadow rays, skips finding the nearest lane
+		static bool IntersectAny(const TriangleBlock& block, const Ray& ray);
+
+	private:
+		std::vector<TriangleBlock> m_Blocks{};
+	};
+}
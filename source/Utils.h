@@ -3,6 +3,8 @@
 #include <fstream>
 #include "Math.h"
 #include "DataTypes.h"
+#include "RayPacket.h"
+#include "SIMD.h"
 #include <iostream>
 
 namespace dae
@@ -11,39 +13,44 @@ namespace dae
 	{
 #pragma region Sphere HitTest
 		//SPHERE HIT-TESTS
-		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		//Distance to the first hit between ray.min and ray.max, or FLT_MAX when the ray misses
+		inline float IntersectSphere(const Sphere& sphere, const Ray& ray)
 		{
-			float a{ Vector3::Dot(ray.direction, ray.direction) };
-			Vector3 oDiff{ ray.origin - sphere.origin };
-			float b{ 2 * Vector3::Dot(ray.direction, oDiff) };
-			float c{ Vector3::Dot(oDiff, oDiff) - sphere.radius * sphere.radius };
+			const float a{ Vector3::Dot(ray.direction, ray.direction) };
+			const Vector3 oDiff{ ray.origin - sphere.origin };
+			const float b{ 2 * Vector3::Dot(ray.direction, oDiff) };
+			const float c{ Vector3::Dot(oDiff, oDiff) - sphere.radius * sphere.radius };
 
-			//d is the discriminant of the equation
-			float d = b * b - 4 * a * c;
+			//d is the discriminant of the equation, we are only interested in full intersection (so discriminant > 0).
+			const float d{ b * b - 4 * a * c };
+			if (d <= 0)
+				return FLT_MAX;
 
-			//We are only interested in full intersection (so discriminant > 0).
-			if (d > 0)
-			{
-				//Use subtraction, except when t < tMin, then use addition for t.
-				float t = (-b - sqrtf(d)) / 2 / a;
+			//Use subtraction, except when t < tMin, then use addition for t.
+			const float sqrtD{ sqrtf(d) };
+			float t{ (-b - sqrtD) / 2 / a };
+			if (t < ray.min)
+				t = (-b + sqrtD) / 2 / a;
 
-				if (t < ray.min)
-				{
-					t = (-b + sqrtf(d)) / 2 / a;
-				}
+			if (t >= ray.min && t <= ray.max)
+				return t;
 
-				if (t >= ray.min && t <= ray.max)
-				{
-					hitRecord.t = t;
-					hitRecord.didHit = true;
-					hitRecord.origin = ray.origin + t * ray.direction;
-					hitRecord.materialIndex = sphere.materialIndex;
-					hitRecord.normal = (hitRecord.origin - sphere.origin).Normalized();
-					return true;
-				}
-			}
+			return FLT_MAX;
+		}
 
-			return false;
+		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			const float t{ IntersectSphere(sphere, ray) };
+			if (t == FLT_MAX)
+				return false;
+
+			if (ignoreHitRecord) return true;
+			hitRecord.t = t;
+			hitRecord.didHit = true;
+			hitRecord.origin = ray.origin + t * ray.direction;
+			hitRecord.materialIndex = sphere.materialIndex;
+			hitRecord.normal = (hitRecord.origin - sphere.origin).Normalized();
+			return true;
 		}
 
 		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray)
@@ -51,29 +58,47 @@ namespace dae
 			HitRecord temp{};
 			return HitTest_Sphere(sphere, ray, temp, true);
 		}
+
+		inline bool IsOccluded_Sphere(const Sphere& sphere, const Ray& ray)
+		{
+			return IntersectSphere(sphere, ray) != FLT_MAX;
+		}
+
+		inline bool IsOccluded_SphereBlock(const SphereBlock& block, const Ray& ray)
+		{
+			uint32_t lane{};
+			return SphereBlockList::Intersect(block, ray, lane) != FLT_MAX;
+		}
 #pragma endregion
 #pragma region Plane HitTest
 		//PLANE HIT-TESTS
-		inline bool HitTest_Plane(const Plane& plane, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		//Only the front side is hit, returns the distance or FLT_MAX like IntersectSphere
+		inline float IntersectPlane(const Plane& plane, const Ray& ray)
 		{
-			//todo W1
 			const float dotProduct{ Vector3::Dot(ray.direction, plane.normal) };
+			if (dotProduct >= 0)
+				return FLT_MAX;
 
-			if (dotProduct < 0)
-			{
-				float t = Vector3::Dot(plane.origin - ray.origin, plane.normal) / dotProduct;
+			const float t{ Vector3::Dot(plane.origin - ray.origin, plane.normal) / dotProduct };
+			if (t >= ray.min && t <= ray.max)
+				return t;
 
-				if (t >= ray.min && t <= ray.max)
-				{
-					hitRecord.t = t;
-					hitRecord.didHit = true;
-					hitRecord.materialIndex = plane.materialIndex;
-					hitRecord.normal = plane.normal;
-					hitRecord.origin = ray.origin + t * ray.direction;
-					return true;
-				}
-			}
-			return false;
+			return FLT_MAX;
+		}
+
+		inline bool HitTest_Plane(const Plane& plane, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			const float t{ IntersectPlane(plane, ray) };
+			if (t == FLT_MAX)
+				return false;
+
+			if (ignoreHitRecord) return true;
+			hitRecord.t = t;
+			hitRecord.didHit = true;
+			hitRecord.materialIndex = plane.materialIndex;
+			hitRecord.normal = plane.normal;
+			hitRecord.origin = ray.origin + t * ray.direction;
+			return true;
 		}
 
 		inline bool HitTest_Plane(const Plane& plane, const Ray& ray)
@@ -81,57 +106,89 @@ namespace dae
 			HitRecord temp{};
 			return HitTest_Plane(plane, ray, temp, true);
 		}
+
+		inline bool IsOccluded_Plane(const Plane& plane, const Ray& ray)
+		{
+			return IntersectPlane(plane, ray) != FLT_MAX;
+		}
 #pragma endregion
 #pragma region Triangle HitTest
 		//TRIANGLE HIT-TESTS
-		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		//Möller-Trumbore on a triangle given by its first vertex and the two edges leaving it
+		//Returns the distance to the hit, or FLT_MAX when the ray misses or the cull mode rejects the side it hits
+		//The cull mode is a template argument so the side test compiles down to a single compare
+		template<TriangleCullMode CullMode>
+		inline float IntersectTriangle(const Vector3& v0, const Vector3& edge1, const Vector3& edge2, const Ray& ray)
 		{
-			const Vector3 edge1{ triangle.v1 - triangle.v0 };
-			const Vector3 edge2{ triangle.v2 - triangle.v0 };
-			
 			const Vector3 h{ Vector3::Cross(ray.direction, edge2) };
 			const float a{ Vector3::Dot(edge1, h) };
 
-			if (a < -FLT_EPSILON)
+			// Degenerate triangles (and rays parallel to them) fail every test
+			if constexpr (CullMode == TriangleCullMode::BackFaceCulling)
 			{
-				if (!ignoreHitRecord && triangle.cullMode == TriangleCullMode::BackFaceCulling)
-					return false;
+				if (!(a > FLT_EPSILON))
+					return FLT_MAX;
 			}
-			else if (a > FLT_EPSILON)
+			else if constexpr (CullMode == TriangleCullMode::FrontFaceCulling)
 			{
-				if (!ignoreHitRecord && triangle.cullMode == TriangleCullMode::FrontFaceCulling)
-					return false;
+				if (!(a < -FLT_EPSILON))
+					return FLT_MAX;
 			}
 			else
 			{
-				return false;
+				if (!(a < -FLT_EPSILON || a > FLT_EPSILON))
+					return FLT_MAX;
 			}
 
 			const float f{ 1.0f / a };
-			const Vector3 s{ ray.origin - triangle.v0 };
+			const Vector3 s{ ray.origin - v0 };
 			const float u{ f * Vector3::Dot(s, h) };
 
 			if (u < 0.0f || u > 1.0f)
-				return false;
+				return FLT_MAX;
 
 			const Vector3 q{ Vector3::Cross(s, edge1) };
 			const float v{ f * Vector3::Dot(ray.direction, q) };
 
 			if (v < 0.0f || u + v > 1.0f)
-				return false;
+				return FLT_MAX;
 
 			const float t{ f * Vector3::Dot(edge2, q) };
 			if (t > ray.min && t < ray.max)
+				return t;
+
+			return FLT_MAX;
+		}
+
+		//For triangles that each carry their own cull mode, meshes pick their variant once instead
+		inline float IntersectTriangle(const Vector3& v0, const Vector3& edge1, const Vector3& edge2, TriangleCullMode cullMode, const Ray& ray)
+		{
+			switch (cullMode)
 			{
-				if (ignoreHitRecord) return true;
-				hitRecord.didHit = true;
-				hitRecord.materialIndex = triangle.materialIndex;
-				hitRecord.origin = ray.origin + (t * ray.direction);
-				hitRecord.normal = triangle.normal;
-				hitRecord.t = t;
-				return true;
+			case TriangleCullMode::FrontFaceCulling:
+				return IntersectTriangle<TriangleCullMode::FrontFaceCulling>(v0, edge1, edge2, ray);
+			case TriangleCullMode::BackFaceCulling:
+				return IntersectTriangle<TriangleCullMode::BackFaceCulling>(v0, edge1, edge2, ray);
+			default:
+				return IntersectTriangle<TriangleCullMode::NoCulling>(v0, edge1, edge2, ray);
 			}
-			return false;
+		}
+
+		//Shadow rays (ignoreHitRecord) are blocked by both sides of a triangle, whatever its cull mode
+		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			const TriangleCullMode cullMode{ ignoreHitRecord ? TriangleCullMode::NoCulling : triangle.cullMode };
+			const float t{ IntersectTriangle(triangle.v0, triangle.v1 - triangle.v0, triangle.v2 - triangle.v0, cullMode, ray) };
+			if (t == FLT_MAX)
+				return false;
+
+			if (ignoreHitRecord) return true;
+			hitRecord.didHit = true;
+			hitRecord.materialIndex = triangle.materialIndex;
+			hitRecord.origin = ray.origin + (t * ray.direction);
+			hitRecord.normal = triangle.normal;
+			hitRecord.t = t;
+			return true;
 		}
 
 		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray)
@@ -139,68 +196,755 @@ namespace dae
 			HitRecord temp{};
 			return HitTest_Triangle(triangle, ray, temp, true);
 		}
+
+		inline bool IsOccluded_Triangle(const Vector3& v0, const Vector3& v1, const Vector3& v2, const Ray& ray)
+		{
+			return IntersectTriangle<TriangleCullMode::NoCulling>(v0, v1 - v0, v2 - v0, ray) != FLT_MAX;
+		}
+
+		inline bool IsOccluded_Triangle(const Triangle& triangle, const Ray& ray)
+		{
+			return IsOccluded_Triangle(triangle.v0, triangle.v1, triangle.v2, ray);
+		}
 #pragma endregion
 #pragma region TriangeMesh HitTest
-		inline bool SlabTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray)
+		// Returns the distance to the entry point of the box, or FLT_MAX when the ray misses it
+		// The signs of the ray pick the near & far plane on each axis, its reciprocal direction is finite so axis-parallel rays never produce NaN
+		inline float SlabTest_AABB(const Vector3& minAABB, const Vector3& maxAABB, const Ray& ray)
+		{
+			const float txNear = ((ray.sign[0] ? maxAABB.x : minAABB.x) - ray.origin.x) * ray.invDirection.x;
+			const float txFar = ((ray.sign[0] ? minAABB.x : maxAABB.x) - ray.origin.x) * ray.invDirection.x;
+			const float tyNear = ((ray.sign[1] ? maxAABB.y : minAABB.y) - ray.origin.y) * ray.invDirection.y;
+			const float tyFar = ((ray.sign[1] ? minAABB.y : maxAABB.y) - ray.origin.y) * ray.invDirection.y;
+			const float tzNear = ((ray.sign[2] ? maxAABB.z : minAABB.z) - ray.origin.z) * ray.invDirection.z;
+			const float tzFar = ((ray.sign[2] ? minAABB.z : maxAABB.z) - ray.origin.z) * ray.invDirection.z;
+
+			const float tmin = std::max(std::max(txNear, tyNear), tzNear);
+			const float tmax = std::min(std::min(txFar, tyFar), tzFar);
+
+			if (tmax >= tmin && tmin < ray.max && tmax > ray.min)
+				return tmin;
+
+			return FLT_MAX;
+		}
+
+		inline bool SlabTest_TriangleMesh(const MeshInstance& instance, const Ray& ray)
 		{
-			// Perform slabtest on the mesh (acceleration structures)
+			return SlabTest_AABB(instance.transformedMinAABB, instance.transformedMaxAABB, ray) != FLT_MAX;
+		}
+
+		inline bool IsOccluded_MeshTriangle(const TriangleMesh& mesh, size_t triangleIndex, const Ray& ray)
+		{
+			const size_t firstIndex{ triangleIndex * 3 };
+			return IsOccluded_Triangle(mesh.positions[mesh.indices[firstIndex]], mesh.positions[mesh.indices[firstIndex + 1]], mesh.positions[mesh.indices[firstIndex + 2]], ray);
+		}
+
+		inline bool IsOccluded_TriangleRecord(const TriangleRecord& record, const Ray& ray)
+		{
+			return IntersectTriangle<TriangleCullMode::NoCulling>(record.v0, record.edge1, record.edge2, ray) != FLT_MAX;
+		}
+
+		//Closest triangle of one BVH leaf, 8 at a time when the mesh has its triangle blocks, decoded one at a time from compact storage
+		//Only the distance (in ray.max) and the triangle are kept, the hit record is filled in once the traversal is done
+		template<TriangleCullMode CullMode>
+		inline bool HitTest_MeshLeaf(const TriangleMesh& mesh, uint32_t firstReference, uint32_t referenceCount, Ray& ray, uint32_t& triangleIndex)
+		{
+			bool didHit{ false };
+
+			if (mesh.compactTriangles.IsBuilt())
+			{
+				for (uint32_t i{ firstReference }; i < firstReference + referenceCount; ++i)
+				{
+					Vector3 v0, v1, v2;
+					mesh.compactTriangles.GetTriangle(i, v0, v1, v2);
+					const float t{ IntersectTriangle<CullMode>(v0, v1 - v0, v2 - v0, ray) };
+					if (t == FLT_MAX)
+						continue;
+
+					triangleIndex = mesh.bvh.GetPrimitiveIndices()[i];
+					ray.max = t;
+					didHit = true;
+				}
+				return didHit;
+			}
 
-			float tx1 = (mesh.transformedMinAABB.x - ray.origin.x) / ray.direction.x;
-			float tx2 = (mesh.transformedMaxAABB.x - ray.origin.x) / ray.direction.x;
+			if (mesh.triangleBlocks.IsBuilt())
+			{
+				const TriangleBlock* pBlock{ mesh.triangleBlocks.GetLeafBlocks(firstReference) };
+				for (uint32_t i{}; i < referenceCount; i += TriangleBlock::Width, ++pBlock)
+				{
+					uint32_t lane{};
+					const float t{ TriangleBlockList::Intersect<CullMode>(*pBlock, ray, lane) };
+					if (t == FLT_MAX)
+						continue;
 
-			float tmin = std::min(tx1, tx2);
-			float tmax = std::max(tx1, tx2);
+					triangleIndex = pBlock->triangleIndex[lane];
+					ray.max = t;
+					didHit = true;
+				}
+				return didHit;
+			}
 
-			float ty1 = (mesh.transformedMinAABB.y - ray.origin.y) / ray.direction.y;
-			float ty2 = (mesh.transformedMaxAABB.y - ray.origin.y) / ray.direction.y;
+			for (uint32_t i{ firstReference }; i < firstReference + referenceCount; ++i)
+			{
+				const TriangleRecord& record{ mesh.triangleRecords[i] };
+				const float t{ IntersectTriangle<CullMode>(record.v0, record.edge1, record.edge2, ray) };
+				if (t == FLT_MAX)
+					continue;
 
-			tmin = std::max(tmin, std::min(ty1, ty2));
-			tmax = std::min(tmax, std::max(ty1, ty2));
+				triangleIndex = record.triangleIndex;
+				ray.max = t;
+				didHit = true;
+			}
+			return didHit;
+		}
 
-			float tz1 = (mesh.transformedMinAABB.z - ray.origin.z) / ray.direction.z;
-			float tz2 = (mesh.transformedMaxAABB.z - ray.origin.z) / ray.direction.z;
+		inline bool IsOccluded_MeshLeaf(const TriangleMesh& mesh, uint32_t firstReference, uint32_t referenceCount, const Ray& ray)
+		{
+			if (mesh.compactTriangles.IsBuilt())
+			{
+				for (uint32_t i{ firstReference }; i < firstReference + referenceCount; ++i)
+				{
+					Vector3 v0, v1, v2;
+					mesh.compactTriangles.GetTriangle(i, v0, v1, v2);
+					if (IsOccluded_Triangle(v0, v1, v2, ray))
+						return true;
+				}
+				return false;
+			}
 
-			tmin = std::max(tmin, std::min(tz1, tz2));
-			tmax = std::min(tmax, std::max(tz1, tz2));
+			if (mesh.triangleBlocks.IsBuilt())
+			{
+				const TriangleBlock* pBlock{ mesh.triangleBlocks.GetLeafBlocks(firstReference) };
+				for (uint32_t i{}; i < referenceCount; i += TriangleBlock::Width, ++pBlock)
+				{
+					if (TriangleBlockList::IntersectAny(*pBlock, ray))
+						return true;
+				}
+				return false;
+			}
 
-			return tmax > 0 && tmax >= tmin;
+			for (uint32_t i{ firstReference }; i < firstReference + referenceCount; ++i)
+			{
+				if (IsOccluded_TriangleRecord(mesh.triangleRecords[i], ray))
+					return true;
+			}
+			return false;
+		}
 
+		inline float SlabTest_BVHNode(const BVHNode& node, const Ray& ray)
+		{
+			return SlabTest_AABB(node.minAABB, node.maxAABB, ray);
 		}
 
-		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		/**
+		 * \brief Walks the BVH near-to-far and tests the primitives of every leaf the ray reaches
+		 * \param bvh hierarchy to traverse
+		 * \param ray ray to trace, its max gets shrunk by the primitive test on every hit
+		 * \param anyHit stop at the first hit instead of searching for the closest one
+		 * \param leafTest bool(uint32_t firstReference, uint32_t referenceCount, Ray& ray), tests the primitives of a leaf,
+		 *        returns true on a hit and sets ray.max to its distance. The references are positions in GetPrimitiveIndices(),
+		 *        so data stored in leaf order needs no indirection
+		 * \return true when any primitive was hit
+		 */
+		template<typename LeafTest>
+		bool TraverseBVH(const BVH& bvh, Ray& ray, bool anyHit, LeafTest&& leafTest)
 		{
-			if (!SlabTest_TriangleMesh(mesh, ray))
+			const BVHNodeList& nodes{ bvh.GetNodes() };
+
+			if (nodes.empty() || SlabTest_BVHNode(nodes[0], ray) == FLT_MAX)
 				return false;
 
-			// Loop through all triangles in the mesh, and check if they hit the ray.
-			Triangle triangle{};
-			const size_t trianglePositionsSize{ mesh.positions.size() };
-			const size_t meshIndicesSize{ mesh.indices.size() };
+			uint32_t stack[BVH::MaxDepth]{};
+			uint32_t stackSize{};
+			uint32_t nodeIndex{};
+			bool didHit{ false };
 
-			for (size_t i{}; i < meshIndicesSize; i += 3)
+			while (true)
 			{
-				triangle.v0 = mesh.transformedPositions[mesh.indices[i]];
-				triangle.v1 = mesh.transformedPositions[mesh.indices[i + 1]];
-				triangle.v2 = mesh.transformedPositions[mesh.indices[i + 2]];
-				triangle.normal = mesh.transformedNormals[i / 3];
-				triangle.cullMode = mesh.cullMode;
-				triangle.materialIndex = mesh.materialIndex;
-
-				HitRecord tempHitrecord{};
-				if (HitTest_Triangle(triangle, ray, tempHitrecord, ignoreHitRecord))
+				const BVHNode& node{ nodes[nodeIndex] };
+
+				if (node.IsLeaf())
 				{
-					if (ignoreHitRecord)
+					if (leafTest(node.leftFirst, node.primitiveCount, ray))
 					{
+						if (anyHit)
+							return true;
+
+						didHit = true;
+					}
+
+					if (stackSize == 0)
+						break;
+
+					nodeIndex = stack[--stackSize];
+					continue;
+				}
+
+				// Visit the nearest child first, the other one waits on the stack
+				uint32_t nearIndex{ node.leftFirst };
+				uint32_t farIndex{ node.leftFirst + 1 };
+				float nearDistance{ SlabTest_BVHNode(nodes[nearIndex], ray) };
+				float farDistance{ SlabTest_BVHNode(nodes[farIndex], ray) };
+
+				if (nearDistance > farDistance)
+				{
+					std::swap(nearIndex, farIndex);
+					std::swap(nearDistance, farDistance);
+				}
+
+				if (nearDistance == FLT_MAX)
+				{
+					if (stackSize == 0)
+						break;
+
+					nodeIndex = stack[--stackSize];
+					continue;
+				}
+
+				// The children of both get tested soon, start loading them while this pair is being handled
+				if (!nodes[nearIndex].IsLeaf())
+					SIMD::Prefetch(&nodes[nodes[nearIndex].leftFirst]);
+
+				nodeIndex = nearIndex;
+				if (farDistance != FLT_MAX)
+				{
+					if (!nodes[farIndex].IsLeaf())
+						SIMD::Prefetch(&nodes[nodes[farIndex].leftFirst]);
+
+					stack[stackSize++] = farIndex;
+				}
+			}
+
+			return didHit;
+		}
+
+		/**
+		 * \brief Occlusion query over the BVH, children are visited in memory order and the walk ends at the first hit
+		 * \param bvh hierarchy to traverse
+		 * \param ray ray to test, it is never shrunk
+		 * \param occlusionTest bool(uint32_t firstReference, uint32_t referenceCount, const Ray& ray), returns true when
+		 *        a primitive of the leaf blocks the ray, the references are the same as for TraverseBVH
+		 * \return true when any primitive blocks the ray
+		 */
+		template<typename OcclusionTest>
+		bool TraverseBVHOcclusion(const BVH& bvh, const Ray& ray, OcclusionTest&& occlusionTest)
+		{
+			const BVHNodeList& nodes{ bvh.GetNodes() };
+
+			if (nodes.empty() || SlabTest_BVHNode(nodes[0], ray) == FLT_MAX)
+				return false;
+
+			uint32_t stack[BVH::MaxDepth];
+			uint32_t stackSize{};
+			uint32_t nodeIndex{};
+
+			while (true)
+			{
+				const BVHNode& node{ nodes[nodeIndex] };
+
+				if (node.IsLeaf())
+				{
+					if (occlusionTest(node.leftFirst, node.primitiveCount, ray))
 						return true;
+
+					if (stackSize == 0)
+						return false;
+
+					nodeIndex = stack[--stackSize];
+					continue;
+				}
+
+				// Any blocker will do, so whichever child is hit first in memory gets visited first
+				const uint32_t leftIndex{ node.leftFirst };
+				const bool hitLeft{ SlabTest_BVHNode(nodes[leftIndex], ray) != FLT_MAX };
+				const bool hitRight{ SlabTest_BVHNode(nodes[leftIndex + 1], ray) != FLT_MAX };
+
+				if (hitLeft)
+				{
+					nodeIndex = leftIndex;
+					if (hitRight)
+						stack[stackSize++] = leftIndex + 1;
+				}
+				else if (hitRight)
+				{
+					nodeIndex = leftIndex + 1;
+				}
+				else
+				{
+					if (stackSize == 0)
+						return false;
+
+					nodeIndex = stack[--stackSize];
+				}
+			}
+		}
+
+		/**
+		 * \brief Walks the BVH with a whole packet, a node is skipped when it lies outside the packet frustum or none of the rays reach it
+		 * \param bvh hierarchy to traverse
+		 * \param packet rays to trace, the max of a ray gets shrunk by the leaf test on every hit
+		 * \param rayMask rays of the packet to trace
+		 * \param leafTest void(uint32_t firstReference, uint32_t referenceCount, uint64_t rayMask, RayPacket& packet), tests the rays
+		 *        that reached the leaf against its primitives and shrinks their max on a hit, the references are the same as for TraverseBVH
+		 */
+		template<typename LeafTest>
+		void TraverseBVHPacket(const BVH& bvh, RayPacket& packet, uint64_t rayMask, LeafTest&& leafTest)
+		{
+			struct StackEntry
+			{
+				uint32_t nodeIndex;
+				uint64_t rayMask;
+			};
+
+			const BVHNodeList& nodes{ bvh.GetNodes() };
+			if (nodes.empty() || rayMask == 0)
+				return;
+
+			// Both children get pushed, so there is at most one waiting sibling per level plus the pair on top
+			StackEntry stack[BVH::MaxDepth + 2];
+			uint32_t stackSize{};
+			stack[stackSize++] = { 0, rayMask };
+
+			while (stackSize > 0)
+			{
+				const StackEntry entry{ stack[--stackSize] };
+				const BVHNode& node{ nodes[entry.nodeIndex] };
+
+				if (!packet.frustum.Overlaps(packet.origin, node.minAABB, node.maxAABB))
+					continue;
+
+				// Rays that found a closer hit since the node was pushed drop out here as well
+				const uint64_t activeRays{ packet.IntersectAABB(node.minAABB, node.maxAABB, entry.rayMask) };
+				if (activeRays == 0)
+					continue;
+
+				if (node.IsLeaf())
+				{
+					leafTest(node.leftFirst, node.primitiveCount, activeRays, packet);
+					continue;
+				}
+
+				// The child closest to the shared origin gets popped first
+				uint32_t nearIndex{ node.leftFirst };
+				uint32_t farIndex{ node.leftFirst + 1 };
+				const float nearDistance{ ((nodes[nearIndex].minAABB + nodes[nearIndex].maxAABB) * 0.5f - packet.origin).SqrMagnitude() };
+				const float farDistance{ ((nodes[farIndex].minAABB + nodes[farIndex].maxAABB) * 0.5f - packet.origin).SqrMagnitude() };
+				if (nearDistance > farDistance)
+					std::swap(nearIndex, farIndex);
+
+				stack[stackSize++] = { farIndex, activeRays };
+				stack[stackSize++] = { nearIndex, activeRays };
+			}
+		}
+
+		/**
+		 * \brief Walks the 8-wide BVH, slab testing all children of a node at once and visiting the hit ones near-to-far
+		 * \param bvh hierarchy to traverse
+		 * \param ray ray to trace, its max gets shrunk by the primitive test on every hit
+		 * \param anyHit stop at the first hit instead of searching for the closest one
+		 * \param leafTest bool(uint32_t firstReference, uint32_t referenceCount, Ray& ray), tests the primitives of a leaf,
+		 *        returns true on a hit and sets ray.max to its distance. The references are positions in GetPrimitiveIndices(),
+		 *        so data stored in leaf order needs no indirection
+		 * \return true when any primitive was hit
+		 */
+		template<typename LeafTest>
+		bool TraverseWideBVH(const WideBVH& bvh, Ray& ray, bool anyHit, LeafTest&& leafTest)
+		{
+			const std::vector<WideBVHNode>& nodes{ bvh.GetNodes() };
+
+			if (nodes.empty())
+				return false;
+
+
+			// Every level can push up to 7 siblings, the entry distance is kept to skip nodes behind a hit found later
+			// Left uninitialized on purpose, clearing 4KB per ray costs more than the traversal of a small mesh
+			uint32_t stack[WideBVHNode::Width * BVH::MaxDepth];
+			float stackDistances[WideBVHNode::Width * BVH::MaxDepth];
+			stack[0] = 0;
+			stackDistances[0] = 0.f;
+			uint32_t stackSize{ 1 };
+			bool didHit{ false };
+
+			while (stackSize > 0)
+			{
+				--stackSize;
+				if (stackDistances[stackSize] > ray.max)
+					continue;
+
+				const WideBVHNode& node{ nodes[stack[stackSize]] };
+
+				alignas(32) float distances[WideBVHNode::Width];
+				uint32_t hitMask{ WideBVH::IntersectChildren(node, ray.origin, ray.invDirection, ray.min, ray.max, distances) };
+
+				// Insertion sort of the hit children on their entry distance, at most 8 of them, any hit keeps them in lane order
+				uint32_t order[WideBVHNode::Width]{};
+				uint32_t hitCount{};
+				for (uint32_t i{}; hitMask != 0; ++i, hitMask >>= 1)
+				{
+					if ((hitMask & 1) == 0 || node.child[i] == WideBVHNode::EmptySlot)
+						continue;
+
+					uint32_t j{ hitCount++ };
+					for (; !anyHit && j > 0 && distances[order[j - 1]] > distances[i]; --j)
+					{
+						order[j] = order[j - 1];
+					}
+					order[j] = i;
+				}
+
+				// Leaves are tested right away, interior children get pushed far-to-near so the nearest one pops first
+				for (uint32_t i{}; i < hitCount; ++i)
+				{
+					const uint32_t lane{ order[i] };
+					if (node.primitiveCount[lane] == 0)
+						continue;
+
+					if (leafTest(node.child[lane], node.primitiveCount[lane], ray))
+					{
+						if (anyHit)
+							return true;
+
+						didHit = true;
 					}
-					else if (tempHitrecord.t > 0.0f && tempHitrecord.t < hitRecord.t)
+				}
+
+				for (uint32_t i{ hitCount }; i-- > 0;)
+				{
+					const uint32_t lane{ order[i] };
+					if (node.primitiveCount[lane] != 0 || distances[lane] > ray.max)
+						continue;
+
+					stack[stackSize] = node.child[lane];
+					stackDistances[stackSize] = distances[lane];
+					++stackSize;
+				}
+			}
+
+			return didHit;
+		}
+
+		/**
+		 * \brief Same walk as TraverseBVH, the child boxes get decoded from the parent box that is carried on the stack
+		 * \param bvh hierarchy to traverse
+		 * \param ray ray to trace, its max gets shrunk by the primitive test on every hit
+		 * \param anyHit stop at the first hit instead of searching for the closest one
+		 * \param leafTest bool(uint32_t firstReference, uint32_t referenceCount, Ray& ray), tests the primitives of a leaf,
+		 *        returns true on a hit and sets ray.max to its distance. The references are positions in GetPrimitiveIndices(),
+		 *        so data stored in leaf order needs no indirection
+		 * \return true when any primitive was hit
+		 */
+		template<typename LeafTest>
+		bool TraverseQuantizedBVH(const QuantizedBVH& bvh, Ray& ray, bool anyHit, LeafTest&& leafTest)
+		{
+			struct StackEntry
+			{
+				uint32_t nodeIndex;
+				Vector3 frameMin;
+				Vector3 frameMax;
+			};
+
+			const std::vector<QuantizedBVHNode>& nodes{ bvh.GetNodes() };
+
+			if (nodes.empty() || SlabTest_AABB(bvh.GetRootBounds().min, bvh.GetRootBounds().max, ray) == FLT_MAX)
+				return false;
+
+			StackEntry stack[BVH::MaxDepth];
+			uint32_t stackSize{};
+			StackEntry current{ 0, bvh.GetRootBounds().min, bvh.GetRootBounds().max };
+			bool didHit{ false };
+
+			while (true)
+			{
+				const QuantizedBVHNode& node{ nodes[current.nodeIndex] };
+
+				if (node.IsLeaf())
+				{
+					if (leafTest(node.GetIndex(), node.GetPrimitiveCount(), ray))
+					{
+						if (anyHit)
+							return true;
+
+						didHit = true;
+					}
+
+					if (stackSize == 0)
+						break;
+
+					current = stack[--stackSize];
+					continue;
+				}
+
+				const Vector3 frameStep{ QuantizedBVHNode::GetFrameStep(current.frameMin, current.frameMax) };
+				Vector3 nearMin{};
+				Vector3 nearMax{};
+				Vector3 farMin{};
+				Vector3 farMax{};
+				QuantizedBVHNode::DecodeBounds(node.childBounds[0], current.frameMin, frameStep, nearMin, nearMax);
+				QuantizedBVHNode::DecodeBounds(node.childBounds[1], current.frameMin, frameStep, farMin, farMax);
+				StackEntry nearChild{ node.GetIndex(), nearMin, nearMax };
+				StackEntry farChild{ node.GetIndex() + 1, farMin, farMax };
+
+				float nearDistance{ SlabTest_AABB(nearChild.frameMin, nearChild.frameMax, ray) };
+				float farDistance{ SlabTest_AABB(farChild.frameMin, farChild.frameMax, ray) };
+
+				// Any hit only needs the order fixed when the first child was missed
+				if (nearDistance > farDistance && (!anyHit || nearDistance == FLT_MAX))
+				{
+					std::swap(nearChild, farChild);
+					std::swap(nearDistance, farDistance);
+				}
+
+				if (nearDistance == FLT_MAX)
+				{
+					if (stackSize == 0)
+						break;
+
+					current = stack[--stackSize];
+					continue;
+				}
+
+				if (!nodes[nearChild.nodeIndex].IsLeaf())
+					SIMD::Prefetch(&nodes[nodes[nearChild.nodeIndex].GetIndex()]);
+
+				current = nearChild;
+				if (farDistance != FLT_MAX)
+				{
+					if (!nodes[farChild.nodeIndex].IsLeaf())
+						SIMD::Prefetch(&nodes[nodes[farChild.nodeIndex].GetIndex()]);
+
+					stack[stackSize++] = farChild;
+				}
+			}
+
+			return didHit;
+		}
+
+		// The direction is not renormalized, so distances along the object space ray match the world space ones
+		inline Ray TransformRayToObjectSpace(const MeshInstance& instance, const Ray& ray)
+		{
+			return Ray{ instance.worldToObject.TransformPoint(ray.origin), instance.worldToObject.TransformVector(ray.direction), ray.min, ray.max };
+		}
+
+		/**
+		 * \brief Closest triangle of the mesh between ray.min and ray.max, through its BVH when it has one
+		 * Candidates only shrink the object space ray, nothing else is computed until the traversal is done
+		 * \tparam CullMode has to match mesh.cullMode, the overload without it picks the variant
+		 * \param instance where the mesh is placed in the frame that is traced
+		 * \param triangleIndex receives the triangle that was hit
+		 * \return distance to the hit (along the world space ray as well), FLT_MAX when nothing was hit
+		 */
+		template<TriangleCullMode CullMode>
+		inline float ClosestHit_TriangleMesh(const TriangleMesh& mesh, const MeshInstance& instance, const Ray& ray, uint32_t& triangleIndex)
+		{
+			if (mesh.useBVH && mesh.bvh.IsBuilt())
+			{
+				Ray objectRay{ TransformRayToObjectSpace(instance, ray) };
+				const auto triangleTest{ [&](uint32_t firstReference, uint32_t referenceCount, Ray& currentRay)
 					{
-						hitRecord = tempHitrecord;
+						return HitTest_MeshLeaf<CullMode>(mesh, firstReference, referenceCount, currentRay, triangleIndex);
+					} };
+
+				bool didHit{};
+				if (mesh.bvhLayout == BVHLayout::Wide8 && mesh.wideBVH.IsBuilt())
+					didHit = TraverseWideBVH(mesh.wideBVH, objectRay, false, triangleTest);
+				else if (mesh.bvhLayout == BVHLayout::Quantized && mesh.quantizedBVH.IsBuilt())
+					didHit = TraverseQuantizedBVH(mesh.quantizedBVH, objectRay, false, triangleTest);
+				else
+					didHit = TraverseBVH(mesh.bvh, objectRay, false, triangleTest);
+
+				return didHit ? objectRay.max : FLT_MAX;
+			}
+
+			if (!SlabTest_TriangleMesh(instance, ray))
+				return FLT_MAX;
+
+			// Loop through all triangles in the mesh, every hit clips the ray for the ones after it
+			Ray objectRay{ TransformRayToObjectSpace(instance, ray) };
+
+			// Compact meshes no longer have their indexed triangles, every reference is tested as one big leaf instead
+			if (mesh.compactTriangles.IsBuilt())
+				return HitTest_MeshLeaf<CullMode>(mesh, 0, static_cast<uint32_t>(mesh.bvh.GetReferenceCount()), objectRay, triangleIndex) ? objectRay.max : FLT_MAX;
+
+			const size_t triangleCount{ mesh.indices.size() / 3 };
+			bool didHit{ false };
+
+			for (size_t i{}; i < triangleCount; ++i)
+			{
+				const Vector3& v0{ mesh.positions[mesh.indices[i * 3]] };
+				const Vector3& v1{ mesh.positions[mesh.indices[i * 3 + 1]] };
+				const Vector3& v2{ mesh.positions[mesh.indices[i * 3 + 2]] };
+
+				const float t{ IntersectTriangle<CullMode>(v0, v1 - v0, v2 - v0, objectRay) };
+				if (t == FLT_MAX)
+					continue;
+
+				triangleIndex = static_cast<uint32_t>(i);
+				objectRay.max = t;
+				didHit = true;
+			}
+
+			return didHit ? objectRay.max : FLT_MAX;
+		}
+
+		inline float ClosestHit_TriangleMesh(const TriangleMesh& mesh, const MeshInstance& instance, const Ray& ray, uint32_t& triangleIndex)
+		{
+			switch (mesh.cullMode)
+			{
+			case TriangleCullMode::FrontFaceCulling:
+				return ClosestHit_TriangleMesh<TriangleCullMode::FrontFaceCulling>(mesh, instance, ray, triangleIndex);
+			case TriangleCullMode::BackFaceCulling:
+				return ClosestHit_TriangleMesh<TriangleCullMode::BackFaceCulling>(mesh, instance, ray, triangleIndex);
+			default:
+				return ClosestHit_TriangleMesh<TriangleCullMode::NoCulling>(mesh, instance, ray, triangleIndex);
+			}
+		}
+
+		//World space hit record of a triangle found by ClosestHit_TriangleMesh, ray is the world space ray that was traced
+		inline void GetHitRecord_MeshTriangle(const TriangleMesh& mesh, const MeshInstance& instance, uint32_t triangleIndex, const Ray& ray, float t, HitRecord& hitRecord)
+		{
+			hitRecord.t = t;
+			hitRecord.didHit = true;
+			hitRecord.materialIndex = mesh.materialIndex;
+			hitRecord.origin = ray.origin + t * ray.direction;
+			const Vector3 normal{ mesh.compactTriangles.IsBuilt() ? mesh.compactTriangles.GetNormal(triangleIndex) : mesh.normals[triangleIndex] };
+			hitRecord.normal = instance.rotationTransform.TransformVector(normal);
+		}
+
+		/**
+		 * \brief Traces the rays of rayMask through the mesh, packet.max holds the closest hit of every ray so far
+		 * \param pTriangleIndices receives the hit triangle of every ray whose closest hit is now in this mesh, packet.max gets its distance
+		 * \return the rays whose closest hit is now in this mesh
+		 */
+		template<TriangleCullMode CullMode>
+		inline uint64_t HitTest_TriangleMeshPacket(const TriangleMesh& mesh, const MeshInstance& instance, RayPacket& packet, uint64_t rayMask, uint32_t* pTriangleIndices)
+		{
+			if (!packet.frustum.Overlaps(packet.origin, instance.transformedMinAABB, instance.transformedMaxAABB))
+				return 0;
+
+			uint64_t hitMask{};
+
+			// Only the binary layout has a packet walk, the other ones trace the rays one at a time
+			if (!mesh.useBVH || !mesh.bvh.IsBuilt() || mesh.bvhLayout != BVHLayout::Binary)
+			{
+				for (uint64_t remaining{ rayMask }; remaining != 0; remaining &= remaining - 1)
+				{
+					const uint32_t i{ static_cast<uint32_t>(std::countr_zero(remaining)) };
+
+					const float t{ ClosestHit_TriangleMesh<CullMode>(mesh, instance, packet.GetRay(i), pTriangleIndices[i]) };
+					if (t == FLT_MAX)
+						continue;
+
+					packet.max[i] = t;
+					hitMask |= uint64_t{ 1 } << i;
+				}
+				return hitMask;
+			}
+
+			// The directions are not renormalized, so the distances of the object space packet are world space distances
+			RayPacket objectPacket{ packet.Transform(instance.worldToObject) };
+
+			TraverseBVHPacket(mesh.bvh, objectPacket, rayMask, [&](uint32_t firstReference, uint32_t referenceCount, uint64_t leafRays, RayPacket& currentPacket)
+				{
+					for (uint64_t remaining{ leafRays }; remaining != 0; remaining &= remaining - 1)
+					{
+						const uint32_t i{ static_cast<uint32_t>(std::countr_zero(remaining)) };
+
+						Ray objectRay{ currentPacket.GetRay(i) };
+						if (HitTest_MeshLeaf<CullMode>(mesh, firstReference, referenceCount, objectRay, pTriangleIndices[i]))
+						{
+							currentPacket.max[i] = objectRay.max;
+							hitMask |= uint64_t{ 1 } << i;
+						}
 					}
+				});
+
+			for (uint64_t remaining{ hitMask }; remaining != 0; remaining &= remaining - 1)
+			{
+				const uint32_t i{ static_cast<uint32_t>(std::countr_zero(remaining)) };
+				packet.max[i] = objectPacket.max[i];
+			}
+			return hitMask;
+		}
+
+		inline uint64_t HitTest_TriangleMeshPacket(const TriangleMesh& mesh, const MeshInstance& instance, RayPacket& packet, uint64_t rayMask, uint32_t* pTriangleIndices)
+		{
+			switch (mesh.cullMode)
+			{
+			case TriangleCullMode::FrontFaceCulling:
+				return HitTest_TriangleMeshPacket<TriangleCullMode::FrontFaceCulling>(mesh, instance, packet, rayMask, pTriangleIndices);
+			case TriangleCullMode::BackFaceCulling:
+				return HitTest_TriangleMeshPacket<TriangleCullMode::BackFaceCulling>(mesh, instance, packet, rayMask, pTriangleIndices);
+			default:
+				return HitTest_TriangleMeshPacket<TriangleCullMode::NoCulling>(mesh, instance, packet, rayMask, pTriangleIndices);
+			}
+		}
+
+		//firstReference & referenceCount receive the BVH leaf that blocked the ray, they are left alone when the mesh has no BVH
+		inline bool IsOccluded_TriangleMesh(const TriangleMesh& mesh, const MeshInstance& instance, const Ray& ray, uint32_t& firstReference, uint32_t& referenceCount)
+		{
+			if (!mesh.useBVH || !mesh.bvh.IsBuilt())
+			{
+				if (!SlabTest_TriangleMesh(instance, ray))
+					return false;
+
+				const Ray objectRay{ TransformRayToObjectSpace(instance, ray) };
+				if (mesh.compactTriangles.IsBuilt())
+					return IsOccluded_MeshLeaf(mesh, 0, static_cast<uint32_t>(mesh.bvh.GetReferenceCount()), objectRay);
 
+				const size_t triangleCount{ mesh.indices.size() / 3 };
+				for (size_t i{}; i < triangleCount; ++i)
+				{
+					if (IsOccluded_MeshTriangle(mesh, i, objectRay))
+						return true;
 				}
+				return false;
 			}
-			return hitRecord.didHit;
+
+			Ray objectRay{ TransformRayToObjectSpace(instance, ray) };
+			const auto triangleTest{ [&](uint32_t leafFirst, uint32_t leafCount, const Ray& currentRay)
+				{
+					if (!IsOccluded_MeshLeaf(mesh, leafFirst, leafCount, currentRay))
+						return false;
+
+					firstReference = leafFirst;
+					referenceCount = leafCount;
+					return true;
+				} };
+
+			if (mesh.bvhLayout == BVHLayout::Wide8 && mesh.wideBVH.IsBuilt())
+				return TraverseWideBVH(mesh.wideBVH, objectRay, true, triangleTest);
+			if (mesh.bvhLayout == BVHLayout::Quantized && mesh.quantizedBVH.IsBuilt())
+				return TraverseQuantizedBVH(mesh.quantizedBVH, objectRay, true, triangleTest);
+
+			return TraverseBVHOcclusion(mesh.bvh, objectRay, triangleTest);
+		}
+
+		inline bool IsOccluded_TriangleMesh(const TriangleMesh& mesh, const MeshInstance& instance, const Ray& ray)
+		{
+			uint32_t firstReference{};
+			uint32_t referenceCount{};
+			return IsOccluded_TriangleMesh(mesh, instance, ray, firstReference, referenceCount);
+		}
+
+		//Shadow rays (ignoreHitRecord) are blocked by both sides of the triangles, whatever the cull mode of the mesh
+		//Traces the mesh where it is placed now, the scene traces the placement of its render frame instead
+		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			const MeshInstance instance{ mesh.GetInstance() };
+			if (ignoreHitRecord)
+				return IsOccluded_TriangleMesh(mesh, instance, ray);
+
+			Ray closestRay{ ray };
+			closestRay.max = std::min(ray.max, hitRecord.t);
+
+			uint32_t triangleIndex{};
+			const float t{ ClosestHit_TriangleMesh(mesh, instance, closestRay, triangleIndex) };
+			if (t == FLT_MAX)
+				return false;
+
+			GetHitRecord_MeshTriangle(mesh, instance, triangleIndex, ray, t, hitRecord);
+			return true;
 		}
 
 		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray)
@@ -0,0 +1,154 @@
+#include "WideBVH.h"
+
+#include <algorithm>
+
+#include "SIMD.h"
+
+namespace dae {
+
+	namespace
+	{
+		uint32_t IntersectChildren_Scalar(const WideBVHNode& node, const Vector3& origin, const Vector3& invDirection, float tMin, float tMax, float* distances)
+		{
+			uint32_t hitMask{};
+			for (uint32_t i{}; i < WideBVHNode::Width; ++i)
+			{
+				const float tx1{ (node.minX[i] - origin.x) * invDirection.x };
+				const float tx2{ (node.maxX[i] - origin.x) * invDirection.x };
+				const float ty1{ (node.minY[i] - origin.y) * invDirection.y };
+				const float ty2{ (node.maxY[i] - origin.y) * invDirection.y };
+				const float tz1{ (node.minZ[i] - origin.z) * invDirection.z };
+				const float tz2{ (node.maxZ[i] - origin.z) * invDirection.z };
+
+				const float tNear{ std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::max(std::min(tz1, tz2), tMin)) };
+				const float tFar{ std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::min(std::max(tz1, tz2), tMax)) };
+
+				distances[i] = tNear;
+				if (tNear <= tFar)
+					hitMask |= 1u << i;
+			}
+			return hitMask;
+		}
+
+		DAE_AVX2_FUNCTION uint32_t IntersectChildren_AVX2(const WideBVHNode& node, const Vector3& origin, const Vector3& invDirection, float tMin, float tMax, float* distances)
+		{
+			const __m256 originX{ _mm256_set1_ps(origin.x) };
+			const __m256 originY{ _mm256_set1_ps(origin.y) };
+			const __m256 originZ{ _mm256_set1_ps(origin.z) };
+			const __m256 invDirectionX{ _mm256_set1_ps(invDirection.x) };
+			const __m256 invDirectionY{ _mm256_set1_ps(invDirection.y) };
+			const __m256 invDirectionZ{ _mm256_set1_ps(invDirection.z) };
+
+			const __m256 tx1{ _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.minX), originX), invDirectionX) };
+			const __m256 tx2{ _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.maxX), originX), invDirectionX) };
+			const __m256 ty1{ _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.minY), originY), invDirectionY) };
+			const __m256 ty2{ _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.maxY), originY), invDirectionY) };
+			const __m256 tz1{ _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.minZ), originZ), invDirectionZ) };
+			const __m256 tz2{ _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.maxZ), originZ), invDirectionZ) };
+
+			const __m256 tNear{ _mm256_max_ps(
+				_mm256_max_ps(_mm256_min_ps(tx1, tx2), _mm256_min_ps(ty1, ty2)),
+				_mm256_max_ps(_mm256_min_ps(tz1, tz2), _mm256_set1_ps(tMin))) };
+			const __m256 tFar{ _mm256_min_ps(
+				_mm256_min_ps(_mm256_max_ps(tx1, tx2), _mm256_max_ps(ty1, ty2)),
+				_mm256_min_ps(_mm256_max_ps(tz1, tz2), _mm256_set1_ps(tMax))) };
+
+			_mm256_storeu_ps(distances, tNear);
+			return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ)));
+		}
+	}
+
+	void WideBVH::Build(const BVH& bvh)
+	{
+		Clear();
+		if (!bvh.HasNodes())
+			return;
+
+		m_Nodes.reserve(bvh.GetNodes().size() / 4 + 1);
+		CollapseNode(bvh, 0);
+	}
+
+	void WideBVH::Clear()
+	{
+		m_Nodes.clear();
+	}
+
+	uint32_t WideBVH::IntersectChildren(const WideBVHNode& node, const Vector3& origin, const Vector3& invDirection, float tMin, float tMax, float* distances)
+	{
+		static const auto pIntersectChildren{ SIMD::HasAVX2() ? &IntersectChildren_AVX2 : &IntersectChildren_Scalar };
+		return pIntersectChildren(node, origin, invDirection, tMin, tMax, distances);
+	}
+
+	uint32_t WideBVH::CollapseNode(const BVH& bvh, uint32_t binaryNodeIndex)
+	{
+		const BVHNodeList& binaryNodes{ bvh.GetNodes() };
+
+		// Keep opening the interior child with the largest surface area until all 8 slots are used
+		uint32_t slots[WideBVHNode::Width]{};
+		uint32_t slotCount{};
+
+		if (binaryNodes[binaryNodeIndex].IsLeaf())
+		{
+			slots[slotCount++] = binaryNodeIndex;
+		}
+		else
+		{
+			slots[slotCount++] = binaryNodes[binaryNodeIndex].leftFirst;
+			slots[slotCount++] = binaryNodes[binaryNodeIndex].leftFirst + 1;
+		}
+
+		while (slotCount < WideBVHNode::Width)
+		{
+			int largestSlot{ -1 };
+			float largestArea{ -1.f };
+			for (uint32_t i{}; i < slotCount; ++i)
+			{
+				const BVHNode& node{ binaryNodes[slots[i]] };
+				if (node.IsLeaf())
+					continue;
+
+				const float area{ AABB{ node.minAABB, node.maxAABB }.SurfaceArea() };
+				if (area > largestArea)
+				{
+					largestArea = area;
+					largestSlot = static_cast<int>(i);
+				}
+			}
+
+			if (largestSlot < 0)
+				break;
+
+			const uint32_t leftChild{ binaryNodes[slots[largestSlot]].leftFirst };
+			slots[largestSlot] = leftChild;
+			slots[slotCount++] = leftChild + 1;
+		}
+
+		// Children get created after this node, so only hold on to its index while recursing
+		const uint32_t wideNodeIndex{ static_cast<uint32_t>(m_Nodes.size()) };
+		m_Nodes.emplace_back();
+
+		for (uint32_t i{}; i < WideBVHNode::Width; ++i)
+		{
+			if (i >= slotCount)
+			{
+				m_Nodes[wideNodeIndex].child[i] = WideBVHNode::EmptySlot;
+				continue;
+			}
+
+			const BVHNode& binaryNode{ binaryNodes[slots[i]] };
+			const uint32_t child{ binaryNode.IsLeaf() ? binaryNode.leftFirst : CollapseNode(bvh, slots[i]) };
+
+			WideBVHNode& wideNode{ m_Nodes[wideNodeIndex] };
+			wideNode.minX[i] = binaryNode.minAABB.x;
+			wideNode.minY[i] = binaryNode.minAABB.y;
+			wideNode.minZ[i] = binaryNode.minAABB.z;
+			wideNode.maxX[i] = binaryNode.maxAABB.x;
+			wideNode.maxY[i] = binaryNode.maxAABB.y;
+			wideNode.maxZ[i] = binaryNode.maxAABB.z;
+			wideNode.child[i] = child;
+			wideNode.primitiveCount[i] = binaryNode.primitiveCount;
+		}
+
+		return wideNodeIndex;
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "BVH.h"
+
+namespace dae
+{
+	// The bounds of all children are stored SoA, so one 8-wide slab test covers the whole node (256 bytes, 4 cache lines)
+	struct alignas(32) WideBVHNode
+	{
+		static constexpr uint32_t Width{ 8 };
+		static constexpr uint32_t EmptySlot{ UINT32_MAX };
+
+		float minX[Width]{};
+		float minY[Width]{};
+		float minZ[Width]{};
+		float maxX[Width]{};
+		float maxY[Width]{};
+		float maxZ[Width]{};
+
+		uint32_t child[Width]{}; // Interior: index of the child node, Leaf: first entry in the primitive index list, EmptySlot when unused
+		uint32_t primitiveCount[Width]{}; // 0 for interior children
+	};
+
+	//8-wide BVH, collapsed from a binary BVH, leaves index the primitive order of that binary BVH
+	class WideBVH final
+	{
+	public:
+		void Build(const BVH& bvh);
+		void Clear();
+
+		bool IsBuilt() const { return !m_Nodes.empty(); }
+
+		const std::vector<WideBVHNode>& GetNodes() const { return m_Nodes; }
+		size_t GetMemoryUsage() const { return m_Nodes.size() * sizeof(WideBVHNode); }
+
+		/**
+		 * \brief Slab tests a ray against all children of the node at once, with AVX2 when the CPU has it
+		 * \param distances receives the entry distance of every child
+		 * \return bitmask of the children that were hit (empty slots can be set too, check EmptySlot)
+		 */
+		static uint32_t IntersectChildren(const WideBVHNode& node, const Vector3& origin, const Vector3& invDirection, float tMin, float tMax, float* distances);
+
+	private:
+		uint32_t CollapseNode(const BVH& bvh, uint32_t binaryNodeIndex);
+
+		std::vector<WideBVHNode> m_Nodes{};
+	};
+}
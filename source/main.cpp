@@ -6,11 +6,14 @@
 
 //Standard includes
 #include <iostream>
+#include <string>
+#include <future>
 
 //Project includes
 #include "Timer.h"
 #include "Renderer.h"
 #include "Scene.h"
+#include "Benchmark.h"
 
 using namespace dae;
 
@@ -22,16 +25,19 @@ void ShutDown(SDL_Window* pWindow)
 
 int main(int argc, char* args[])
 {
-	//Unreferenced parameters
-	(void)argc;
-	(void)args;
+	const uint32_t width = 640;
+	const uint32_t height = 480;
+
+	//Headless benchmark run, no window needed
+	if (argc > 1 && std::string(args[1]) == "--benchmark")
+	{
+		Benchmark::Run(width, height);
+		return 0;
+	}
 
 	//Create window + surfaces
 	SDL_Init(SDL_INIT_VIDEO);
 
-	const uint32_t width = 640;
-	const uint32_t height = 480;
-
 	SDL_Window* pWindow = SDL_CreateWindow(
 		"RayTracer - Hoet Brian",
 		SDL_WINDOWPOS_UNDEFINED,
@@ -52,6 +58,7 @@ int main(int argc, char* args[])
 	const auto pScene = new Scene_W4_ReferenceScene();
 	//const auto pScene = new Scene_W4_BunnyScene();
 	pScene->Initialize();
+	pScene->UpdateAccelerationStructures();
 
 	float dotResult{};
 	dotResult = Vector3::Dot(Vector3::UnitX, Vector3::UnitX);
@@ -91,6 +98,9 @@ int main(int argc, char* args[])
 				case SDL_SCANCODE_F3:
 					if (not e.key.repeat) pRenderer->CycleLightingMode();
 					break;
+				case SDL_SCANCODE_F4:
+					if (not e.key.repeat) pRenderer->CycleTracingMode();
+					break;
 				case SDL_SCANCODE_F6:
 					if(not e.key.repeat) pTimer->StartBenchmark();
 						break;
@@ -100,11 +110,16 @@ int main(int argc, char* args[])
 
 		}
 
-		//--------- Update ---------
-		pScene->Update(pTimer);
-
-		//--------- Render ---------
+		//--------- Update & Render ---------
+		// The next frame is updated & compiled while the current one renders, so the image lags the input by a frame
+		auto nextFrame = std::async(std::launch::async, [pScene, pTimer]()
+			{
+				pScene->Update(pTimer);
+				pScene->BuildNextFrame();
+			});
 		pRenderer->Render(pScene);
+		nextFrame.wait();
+		pScene->SwapFrames();
 
 		//--------- Timer ---------
 		pTimer->Update();